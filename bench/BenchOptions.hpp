@@ -0,0 +1,47 @@
+/* Command line scaffolding shared by the benchmarks.
+ *
+ * Every option takes a value, `--key value', and list options take
+ * comma-separated values.
+ */
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//! Split a comma-separated list and convert every item to T.
+template <typename T>
+std::vector<T> parse_list(const std::string &arg) {
+    std::vector<T> ans;
+    std::stringstream ss(arg);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        std::stringstream conv(item);
+        T x;
+        conv >> x;
+        ans.push_back(x);
+    }
+    return ans;
+}
+
+/** Walk the `--key value' pairs of argv, handing each to `set(key, val)'.
+ *  `set' returns false for a key it does not know.
+ *  Returns false, after printing the reason, on an unknown option
+ *  or an option missing its value.
+ */
+template <typename F>
+bool parse_options(int argc, char *argv[], F set) {
+    for(int i=1; i<argc; i += 2) {
+        const std::string key = argv[i];
+        if(i+1 == argc) {
+            std::cerr << "Missing value for option " << key << std::endl;
+            return false;
+        }
+        if(!set(key, std::string(argv[i+1]))) {
+            std::cerr << "Unknown option " << key << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,181 @@
+/* Allocator throughput benchmark.
+ *
+ * Every warp repeatedly allocates and immediately frees a block,
+ * so the pool stays at the requested fill ratio for the whole run.
+ * One JSON record is printed per (backend, pool size, warps, fill, mode).
+ *
+ * Usage:
+ *   benchAlloc [--backend substr] [--pool N,...] [--warps W,...]
+ *              [--fill f,...] [--iters I]
+ *
+ *   --backend  only run accelerators whose name contains substr
+ *   --pool     pool sizes, in blocks
+ *   --warps    number of warps sharing the pool (contention)
+ *   --fill     fill ratios to hold the pool at
+ *   --iters    alloc/free cycles per warp
+ *
+ * ops_per_s counts both the alloc and the free of each cycle.
+ * probes_per_call is the mean number of free-list / summary windows
+ * read per warp-wide alloc or alloc_batch call.
+ */
+#define FPT_ALLOC_STATS
+#include <fpt/Alloc.hpp>
+#include "TestAlpaka.hpp"
+#include "BenchOptions.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Options {
+    std::string backend;
+    std::vector<uint32_t> pools{1u<<16, 1u<<20};
+    std::vector<uint32_t> warps{64, 1024};
+    std::vector<double> fills{0.1, 0.5, 0.9, 0.95, 0.99};
+    uint32_t iters = 100;
+};
+
+//! Allocate `target` blocks, spread over all lanes of the grid.
+struct FillKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename Pool>
+    ALPAKA_FN_ACC void operator()(
+            TAcc const& acc,
+            Pool pool,
+            const uint32_t target
+            ) const {
+        const auto gid = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+        const auto lanes = alpaka::getWorkDiv<alpaka::Grid, alpaka::Threads>(acc)[0];
+        const uint32_t rounds = (target + lanes - 1) / lanes;
+
+        for(uint32_t r=0; r<rounds; r++) {
+            const uint32_t i = r*lanes + gid;
+            pool.alloc_batch(acc, i, i < target);
+        }
+    }
+};
+
+//! Each warp runs `iters` alloc + free cycles.
+struct CycleKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename Pool>
+    ALPAKA_FN_ACC void operator()(
+            TAcc const& acc,
+            Pool pool,
+            const uint32_t iters,
+            const bool batch
+            ) const {
+        const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+
+        for(uint32_t it=0; it<iters; it++) {
+            const uint32_t start = blk*iters + it;
+            if(batch) {
+                uint32_t n = pool.alloc_batch(acc, start, true);
+                pool.free_batch(acc, n, n != ALLOC_FAIL);
+            } else {
+                uint32_t n = pool.alloc(acc, start);
+                if(n != ALLOC_FAIL)
+                    pool.free(acc, n);
+            }
+        }
+    }
+};
+
+struct RunBench {
+    template <typename Acc>
+    void operator()(const Options &opt, bool &first) {
+        using Dev = alpaka::Dev<Acc>;
+        using Pltf = alpaka::Pltf<Dev>;
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+        const std::string name = alpaka::getAccName<Acc>();
+        if(name.find(opt.backend) == std::string::npos)
+            return;
+
+        Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+        auto Q = Queue(dev);
+        const uint32_t warpSize = alpaka::getWarpSize(dev);
+
+        for(uint32_t N : opt.pools) {
+            auto A = fpt::Alloc<uint32_t, Acc>(dev, N);
+            for(uint32_t W : opt.warps) {
+                const alpaka::WorkDivMembers<Dim, Idx> workDiv{
+                        Vec::all(W), Vec::all(warpSize), Vec::ones()};
+                for(double fill : opt.fills) {
+                    for(bool batch : {false, true}) {
+                        A.reinit(0, Q);
+                        alpaka::exec<Acc>(Q, workDiv, FillKernel{},
+                                          A.device(), uint32_t(fill*N));
+                        const double held = 1.0 - double(A.count_free(Q))/N;
+                        A.reset_failures(Q);
+                        A.reset_probes(Q);
+
+                        auto t0 = std::chrono::steady_clock::now();
+                        alpaka::exec<Acc>(Q, workDiv, CycleKernel{},
+                                          A.device(), opt.iters, batch);
+                        alpaka::wait(Q);
+                        auto t1 = std::chrono::steady_clock::now();
+                        const double dt = std::chrono::duration<double>(t1 - t0).count();
+
+                        const double calls = double(W) * opt.iters;
+                        const double ops = calls * (batch ? warpSize : 1);
+                        const uint32_t fails = A.failures(Q);
+                        const uint32_t probes = A.probes(Q);
+
+                        std::cout << (first ? "[\n" : ",\n")
+                            << "  {\"backend\": \"" << name << "\""
+                            << ", \"warp_size\": " << warpSize
+                            << ", \"pool\": " << N
+                            << ", \"warps\": " << W
+                            << ", \"fill\": " << fill
+                            << ", \"fill_held\": " << held
+                            << ", \"batch\": " << (batch ? "true" : "false")
+                            << ", \"allocs\": " << ops
+                            << ", \"seconds\": " << dt
+                            << ", \"ops_per_s\": " << 2.0*ops/dt
+                            << ", \"probes_per_call\": " << probes/calls
+                            << ", \"failure_rate\": " << fails/ops
+                            << "}";
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    using Dim = alpaka::DimInt<1u>;
+    using Idx = uint32_t;
+    Options opt;
+
+    const bool ok = parse_options(argc, argv,
+                [&](const std::string &key, const std::string &val) {
+        if(key == "--backend") {
+            opt.backend = val;
+        } else if(key == "--pool") {
+            opt.pools = parse_list<uint32_t>(val);
+        } else if(key == "--warps") {
+            opt.warps = parse_list<uint32_t>(val);
+        } else if(key == "--fill") {
+            opt.fills = parse_list<double>(val);
+        } else if(key == "--iters") {
+            opt.iters = std::stoul(val);
+        } else {
+            return false;
+        }
+        return true;
+    });
+    if(!ok) return 1;
+
+    bool first = true;
+    alpaka::meta::forEachType<alpaka::test::EnabledAccs<Dim, Idx>>(
+                RunBench{}, std::cref(opt), std::ref(first));
+    std::cout << (first ? "[]" : "\n]") << std::endl;
+    return 0;
+}
@@ -0,0 +1,347 @@
+/* Cell kernel throughput benchmark.
+ *
+ * Atoms are drawn from a distribution, packed into cells in the order
+ * they were drawn, and sorted.  The sort, a 1-body kernel and the
+ * 2-body kernels are then timed on the sorted cells.
+ * One JSON record is printed per
+ * (backend, distribution, density, cell size, cutoff, operator).
+ *
+ * Usage:
+ *   benchKernels [--backend substr] [--length L] [--density rho,...]
+ *                [--cell h,...] [--cutoff Rc,...] [--dist name,...]
+ *                [--ops name,...] [--iters I] [--seed S]
+ *
+ *   --backend  only run accelerators whose name contains substr
+ *   --length   side of the periodic cubic box
+ *   --density  mean atoms per unit volume
+ *   --cell     cell widths (the box gets round(L/h) cells per side)
+ *   --cutoff   pair cutoffs, setting the cell stencil
+ *   --dist     uniform, clustered (gaussian blobs) or slab
+ *              (all atoms in the middle quarter of z)
+ *   --ops      sort, count, lj_en, lj_deriv
+ *   --iters    launches timed per record
+ *
+ * atoms_per_s counts every atom the kernel visits.  pairs_per_s counts
+ * the pairs the 2-body kernels evaluate, i.e. every pair of atoms in
+ * stencil cells, before any cutoff.  GB_per_s counts the cell data each
+ * launch reads and writes, with far cells counted once per home cell.
+ * The sort and count are timed together with zeroing their output.
+ * Atoms that did not fit in their cell during the initial sort are
+ * reported as `dropped'.
+ *
+ * Built with -DFPT_PERF on Linux, records for CPU backends also carry
+ * hardware counters per launch (see fpt/Perf.hpp), with ipc,
+ * bytes_per_pair (from last level cache misses) and vector_share
+ * derived from them.  Counters that cannot be opened read as -1.
+ */
+#include <fpt/Cell.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Singles.hpp>
+#include <fpt/Pairs.hpp>
+#ifdef FPT_PERF
+#include <fpt/Perf.hpp>
+#endif
+#include "TestAlpaka.hpp"
+#include "BenchOptions.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct Options {
+    std::string backend;
+    float length = 20.0;
+    std::vector<float> densities{0.1, 0.4, 0.8};
+    std::vector<float> cells{1.25, 2.5};
+    std::vector<float> cutoffs{2.5};
+    std::vector<std::string> dists{"uniform", "clustered", "slab"};
+    std::vector<std::string> ops{"sort", "count", "lj_en", "lj_deriv"};
+    uint32_t iters = 20;
+    uint32_t seed = 42;
+};
+
+//! Draw N atoms in [0,L)^3 and pack them into cells in the order drawn.
+std::vector<fpt::Cell> make_atoms(const std::string &dist, const uint32_t N,
+                                  const float L, const uint32_t ncells, const uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> U(0.0, 1.0);
+    std::normal_distribution<float> G(0.0, L/16);
+    std::vector<float> centers;
+    for(int c=0; c<3*8; c++)
+        centers.push_back(U(rng)*L);
+
+    std::vector<fpt::Cell> X(ncells);
+    for(auto &c : X)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            c.n[m] = 0;
+    for(uint32_t a=0; a<N; a++) {
+        float r[3];
+        if(dist == "clustered") {
+            const int c = std::min(7, int(U(rng)*8));
+            for(int d=0; d<3; d++)
+                r[d] = centers[3*c+d] + G(rng);
+        } else {
+            for(int d=0; d<3; d++)
+                r[d] = U(rng)*L;
+            if(dist == "slab")
+                r[2] = (0.375f + 0.25f*U(rng))*L;
+        }
+        for(int d=0; d<3; d++) {
+            r[d] -= L*std::floor(r[d]/L);
+            if(r[d] >= L) r[d] = 0.0f;
+        }
+        fpt::Cell &c = X[a/ATOMS_PER_CELL];
+        const int m = a%ATOMS_PER_CELL;
+        c.n[m] = 1;
+        c.x[m] = r[0];
+        c.y[m] = r[1];
+        c.z[m] = r[2];
+    }
+    return X;
+}
+
+//! Atoms per cell.
+std::vector<uint32_t> occupancy(const std::vector<fpt::Cell> &X) {
+    std::vector<uint32_t> occ(X.size(), 0);
+    for(size_t c=0; c<X.size(); c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            occ[c] += X[c].n[m] != 0;
+    return occ;
+}
+
+/** Atom pairs and far-cell loads visited by the 2-body
+ *  kernels, walking the stencil like Oper2Kernel does.
+ */
+void count_pairs(const fpt::CellSorter &srt, const std::vector<fpt::CellRange> &nbr,
+                 const std::vector<uint32_t> &occ, double &pairs, double &loads) {
+    const fpt::BoxCells cells{srt.device()};
+    pairs = 0.0;
+    loads = 0.0;
+    for(uint32_t c=0; c<srt.cells; c++) {
+        int i, j, k;
+        cells.decode(c, i, j, k);
+        int r = 0;
+        fpt::CellRange off = nbr[0];
+        while(fpt::next_row(cells, nbr.data(), r, i, j, k, off)) {
+            const uint32_t start = cells.row(j, k, off);
+            for(int di = off.i0; di <= off.i1; di++) {
+                const uint32_t f = cells.col(start, i, di);
+                pairs += double(occ[c]) * (occ[f] - (f == c));
+                loads += 1.0;
+            }
+            r++;
+        }
+    }
+}
+
+struct RunBench {
+    template <typename Acc>
+    void operator()(const Options &opt, bool &first) {
+        using Dev = alpaka::Dev<Acc>;
+        using Pltf = alpaka::Pltf<Dev>;
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+        const std::string name = alpaka::getAccName<Acc>();
+        if(name.find(opt.backend) == std::string::npos)
+            return;
+
+        Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+        const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+        auto Q = Queue(dev);
+        const uint32_t warpSize = alpaka::getWarpSize(dev);
+        const float L = opt.length;
+#ifdef FPT_PERF
+        fpt::PerfCounters perf;
+        const bool cpu = std::is_same<Dev, alpaka::DevCpu>::value;
+#endif
+
+        for(float h : opt.cells) {
+            const int n = std::max(1, int(std::lround(L/h)));
+            const auto srt = fpt::CellSorter(L, L, L, n, n, n);
+            const Idx ncells = srt.cells;
+            const auto workDiv = fpt::cellWorkDiv<Dim,Idx>(dev, ncells);
+
+            auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+                    alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+            auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+                    alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+            auto D = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+                    alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+            auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+                    alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+            auto count = alpaka::Buf<Dev, uint32_t, Dim, Idx>{
+                    alpaka::allocBuf<uint32_t, Idx>(dev, ncells)};
+            const auto cells = fpt::BoxCells{srt.device()};
+
+            for(const auto &dist : opt.dists) {
+                for(float rho : opt.densities) {
+                    const uint32_t N = std::min(double(ncells)*ATOMS_PER_CELL,
+                                                double(rho)*L*L*L);
+                    auto host = make_atoms(dist, N, L, ncells, opt.seed);
+                    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+                            host.data(), devHost, ncells);
+                    alpaka::memcpy(Q, X, view, ncells);
+
+                    // sorted cells for the other kernels
+                    alpaka::memset(Q, Y, 0, ncells);
+                    alpaka::exec<Acc>(Q, workDiv, fpt::sortAtomsKernel<Vec>{cells},
+                                      alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+                    alpaka::memcpy(Q, view, Y, ncells);
+                    alpaka::wait(Q);
+                    const auto occ = occupancy(host);
+                    double kept = 0.0;
+                    for(auto o : occ) kept += o;
+
+                    for(float Rc : opt.cutoffs) {
+                        const auto nbr_h = srt.list_cells(Rc);
+                        auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+                        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+                        double pairs, loads;
+                        count_pairs(srt, nbr_h, occ, pairs, loads);
+
+                        for(const auto &op : opt.ops) {
+                            // bytes per launch, and pairs evaluated
+                            double bytes = 0.0, npairs = 0.0;
+                            std::function<void()> launch;
+                            if(op == "sort") {
+                                bytes = 3.0*ncells*sizeof(fpt::Cell);
+                                launch = [&] {
+                                    alpaka::exec<Acc>(Q, workDiv, fpt::Oper1Kernel<fpt::ZeroCellOper,Vec>{},
+                                                      alpaka::getPtrNative(D), alpaka::getPtrNative(D));
+                                    alpaka::exec<Acc>(Q, workDiv, fpt::sortAtomsKernel<Vec>{cells},
+                                                      alpaka::getPtrNative(X), alpaka::getPtrNative(D));
+                                };
+                            } else if(op == "count") {
+                                bytes = double(ncells)*(sizeof(fpt::Cell) + 3*sizeof(uint32_t));
+                                launch = [&] {
+                                    alpaka::memset(Q, count, 0, ncells);
+                                    alpaka::exec<Acc>(Q, workDiv, fpt::Oper1Kernel<fpt::NumCellOper,Vec>{},
+                                                      alpaka::getPtrNative(Y), alpaka::getPtrNative(count));
+                                };
+                            } else if(op == "lj_en") {
+                                bytes = (loads + ncells)*sizeof(fpt::Cell) + ncells*sizeof(fpt::CellEnergy);
+                                npairs = pairs;
+                                launch = [&] {
+                                    alpaka::exec<Acc>(Q, workDiv, fpt::Oper2Kernel<LJEnOper,Vec>{},
+                                                      cells, alpaka::getPtrNative(nbr),
+                                                      alpaka::getPtrNative(Y), alpaka::getPtrNative(en));
+                                };
+                            } else if(op == "lj_deriv") {
+                                bytes = (loads + 2.0*ncells)*sizeof(fpt::Cell);
+                                npairs = pairs;
+                                launch = [&] {
+                                    alpaka::exec<Acc>(Q, workDiv, fpt::Oper2Kernel<LJDerivOper,Vec>{},
+                                                      cells, alpaka::getPtrNative(nbr),
+                                                      alpaka::getPtrNative(Y), alpaka::getPtrNative(D));
+                                };
+                            } else {
+                                std::cerr << "Unknown operator " << op << std::endl;
+                                continue;
+                            }
+
+                            launch(); // warm-up
+                            alpaka::wait(Q);
+#ifdef FPT_PERF
+                            const auto c0 = cpu ? perf.read() : fpt::PerfSample::none();
+#endif
+                            auto t0 = std::chrono::steady_clock::now();
+                            for(uint32_t it=0; it<opt.iters; it++)
+                                launch();
+                            alpaka::wait(Q);
+                            auto t1 = std::chrono::steady_clock::now();
+#ifdef FPT_PERF
+                            const auto c = cpu ? perf.read() - c0 : fpt::PerfSample::none();
+#endif
+                            const double dt = std::chrono::duration<double>(t1 - t0).count()
+                                            / opt.iters;
+
+                            std::cout << (first ? "[\n" : ",\n")
+                                << "  {\"backend\": \"" << name << "\""
+                                << ", \"warp_size\": " << warpSize
+                                << ", \"op\": \"" << op << "\""
+                                << ", \"dist\": \"" << dist << "\""
+                                << ", \"density\": " << rho
+                                << ", \"cell\": " << L/n
+                                << ", \"cutoff\": " << Rc
+                                << ", \"cells\": " << ncells
+                                << ", \"stencil\": " << loads/ncells
+                                << ", \"atoms\": " << N
+                                << ", \"dropped\": " << N - kept
+                                << ", \"iters\": " << opt.iters
+                                << ", \"seconds\": " << dt
+                                << ", \"atoms_per_s\": " << (op == "sort" ? N : kept)/dt
+                                << ", \"pairs_per_s\": " << npairs/dt
+                                << ", \"GB_per_s\": " << bytes/dt*1e-9;
+#ifdef FPT_PERF
+                            // per launch
+                            for(int e = 0; e < fpt::PerfSample::EVENTS; e++)
+                                std::cout << ", \"" << fpt::PerfSample::name(e) << "\": "
+                                          << (c.has(e) ? c.count[e]/opt.iters : -1.0);
+                            const double *k = c.count;
+                            using P = fpt::PerfSample;
+                            std::cout << ", \"ipc\": " << (k[P::CYCLES] > 0.0 && k[P::INSTRUCTIONS] >= 0.0
+                                        ? k[P::INSTRUCTIONS]/k[P::CYCLES] : -1.0)
+                                      << ", \"bytes_per_pair\": " << (npairs > 0.0 && k[P::CACHE_MISSES] >= 0.0
+                                        ? double(FPT_CACHE_LINE)*k[P::CACHE_MISSES]/(npairs*opt.iters) : -1.0)
+                                      << ", \"vector_share\": " << (k[P::FP_PACKED] >= 0.0 && k[P::FP_SCALAR] >= 0.0
+                                                && k[P::FP_PACKED] + k[P::FP_SCALAR] > 0.0
+                                        ? k[P::FP_PACKED]/(k[P::FP_PACKED] + k[P::FP_SCALAR]) : -1.0);
+#endif
+                            std::cout << "}";
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    using Dim = alpaka::DimInt<1u>;
+    using Idx = uint32_t;
+    Options opt;
+
+    const bool ok = parse_options(argc, argv,
+                [&](const std::string &key, const std::string &val) {
+        if(key == "--backend") {
+            opt.backend = val;
+        } else if(key == "--length") {
+            opt.length = std::stof(val);
+        } else if(key == "--density") {
+            opt.densities = parse_list<float>(val);
+        } else if(key == "--cell") {
+            opt.cells = parse_list<float>(val);
+        } else if(key == "--cutoff") {
+            opt.cutoffs = parse_list<float>(val);
+        } else if(key == "--dist") {
+            opt.dists = parse_list<std::string>(val);
+        } else if(key == "--ops") {
+            opt.ops = parse_list<std::string>(val);
+        } else if(key == "--iters") {
+            opt.iters = std::stoul(val);
+        } else if(key == "--seed") {
+            opt.seed = std::stoul(val);
+        } else {
+            return false;
+        }
+        return true;
+    });
+    if(!ok) return 1;
+
+    bool first = true;
+    alpaka::meta::forEachType<alpaka::test::EnabledAccs<Dim, Idx>>(
+                RunBench{}, std::cref(opt), std::ref(first));
+    std::cout << (first ? "[]" : "\n]") << std::endl;
+    return 0;
+}
@@ -62,7 +62,7 @@ int main(int argc, char *argv[]) {
     std::cout << "Random numbers:\n";
     std::cout << U(rng) << " " << U(rng) << " " << U(rng) << std::endl;
 
-    // TODO: benchmark sort times for different starting distributions
+    // bench/benchKernels.cpp times the sort for other starting distributions.
     #pragma omp parallel for
     for(int i = 0; i < srt.cells; i++) {
         for(int j=0; j<ATOMS_PER_CELL; j++) {
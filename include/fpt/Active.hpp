@@ -0,0 +1,234 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Singles.hpp>
+#include <fpt/Pairs.hpp>
+#include <fpt/Halo.hpp>
+
+#include <cassert>
+
+namespace fpt {
+
+/** Cell indexing that visits only the cells in `list'.
+ *  Block b works on cell list[b]; everything else
+ *  comes from the underlying indexing.
+ */
+template <typename Cells>
+struct ListedCells : Cells {
+    const uint32_t *list;
+
+    ListedCells(const Cells &cells, const uint32_t *list_)
+        : Cells(cells), list(list_) {}
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t home(const uint32_t block) const {
+            return list[block];
+    }
+};
+
+/// Cell indexing for the owned cells of a grid.
+inline BoxCells cell_index(const CellSorter &srt) {
+    return BoxCells{srt.device()};
+}
+
+inline HaloCells cell_index(const HaloGrid &grid) {
+    return grid.device();
+}
+
+/// Number of owned cells of a grid.
+inline uint32_t owned_cells(const CellSorter &srt) {
+    return srt.cells;
+}
+
+inline uint32_t owned_cells(const HaloGrid &grid) {
+    return grid.box.cells;
+}
+
+/** Count the atoms in every owned cell of X into occ,
+ *  and append the cells holding any atoms to list.
+ *  Launched with one block per owned cell.
+ */
+struct ActiveCellsKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename Cells>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const Cells cells,
+                const Cell *__restrict__ X,
+                uint32_t *__restrict__ occ,
+                uint32_t *__restrict__ list,
+                uint32_t *__restrict__ count
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const bin = cells.home(alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]);
+        auto &part = alpaka::declareSharedVar<uint32_t[ATOMS_PER_CELL], __COUNTER__>(acc);
+
+        uint32_t c = 0;
+        for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads)
+            c += X[bin].n[m] != 0;
+        part[idx] = c;
+        alpaka::syncBlockThreads(acc);
+
+        if(idx == 0) {
+            for(uint32_t t = 1; t < threads; t++)
+                c += part[t];
+            occ[bin] = c;
+            if(c != 0)
+                list[alpaka::atomicOp<alpaka::AtomicAdd>(acc, count, uint32_t(1))] = bin;
+        }
+    }
+};
+
+/** Occupancy counts and the list of occupied cells
+ *  of a cell buffer, rebuilt by update() after every sort.
+ *
+ *  The kernels made by factories taking an ActiveCells read
+ *  the number of listed cells on the device and stride over
+ *  them, so their work follows the number of occupied cells
+ *  rather than the volume of the box.  A task stays valid
+ *  across update()s and always runs over the current list.
+ *  Outputs of empty cells are not written.
+ */
+template <typename Acc>
+class ActiveCells {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using IdxBuf = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
+
+        const Dev &devAcc;
+        const Idx ncells; // length of the cell buffers
+
+        ActiveCells(const Dev &devAcc_, Idx ncells_)
+            : devAcc(devAcc_), ncells(ncells_)
+            , occ( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, ncells_)} )
+            , lst( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, ncells_)} )
+            , cnt( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(1))} ) { }
+
+        /** Enqueue rebuilding the lists for the owned cells of X.
+         *  Does not wait: kernels enqueued after it on Q see the new lists.
+         */
+        template <typename Grid, typename Queue>
+        void update(const Grid &grid, const alpaka::Buf<Dev, Cell, Dim, Idx> &X, Queue &Q) {
+            assert( alpaka::extent::getExtent<0>(X) == ncells );
+            alpaka::memset(Q, cnt, 0, Idx(1));
+            alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, Idx(owned_cells(grid))),
+                              ActiveCellsKernel{}, cell_index(grid),
+                              alpaka::getPtrNative(X), alpaka::getPtrNative(occ),
+                              alpaka::getPtrNative(lst), alpaka::getPtrNative(cnt));
+        }
+
+        /// Number of occupied cells, as of the last update().  Waits for Q.
+        template <typename Queue>
+        Idx size(Queue &Q) const {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto host = alpaka::allocBuf<uint32_t, Idx>(devHost, Idx(1));
+            alpaka::memcpy(Q, host, cnt, Idx(1));
+            alpaka::wait(Q);
+            return alpaka::getPtrNative(host)[0];
+        }
+
+        /// Number of atoms in each cell, indexed like the cell buffer.
+        const IdxBuf &occupancy() const {
+            return occ;
+        }
+
+        /// Occupied cells, in no particular order.
+        const IdxBuf &list() const {
+            return lst;
+        }
+
+        /// Number of occupied cells, on the device.
+        const IdxBuf &counter() const {
+            return cnt;
+        }
+
+        ///! Return device-accessible indexing over the listed cells.
+        template <typename Grid>
+        auto device(const Grid &grid) const {
+            using Cells = decltype(cell_index(grid));
+            return ListedCells<Cells>(cell_index(grid), alpaka::getPtrNative(lst));
+        }
+
+    private:
+        IdxBuf occ, lst, cnt;
+};
+
+/* Return a kernel sorting the atoms in the listed cells of X into Y.
+ * act must be updated for X before the kernel runs.
+ * Y must have been zeroed beforehand.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev, typename Grid>
+auto mkSorter(const Dev &devAcc,
+              const Grid &grid,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y,
+              const ActiveCells<Acc> &act) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    using Cells = decltype(act.device(grid));
+
+    // Stride over the listed cells, as many as there may be
+    Idx const per = launch_cells<Acc>(devAcc, "sort", act.ncells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, act.ncells, per);
+
+    std::cout << "Creating sorting kernel for the active cells of " << act.ncells << ".\n";
+    sortAtomsKernel<Vec, Cells> K{act.device(grid), 0, nullptr, 0,
+                                  alpaka::getPtrNative(act.counter())};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+}
+
+/** Create a 1-body operation over the listed cells of X.
+ */
+template <typename Oper1, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk1Body(const Dev &devAcc, const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out,
+             const ActiveCells<Acc> &act) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( act.ncells == alpaka::extent::getExtent<0>(X) );
+    assert( act.ncells == alpaka::extent::getExtent<0>(out) );
+
+    Idx const per = launch_cells<Acc>(devAcc, "1body", act.ncells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, act.ncells, per);
+
+    std::cout << "Creating 1-body kernel for the active cells of " << act.ncells << ".\n";
+    Oper1Kernel<Oper1,Vec> K{0, alpaka::getPtrNative(act.list()), 0,
+                             alpaka::getPtrNative(act.counter())};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+/** Create a 2-body operation over the listed cells of X.
+ *  Empty neighbor cells are still read.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev, typename Grid>
+auto mk2Body(const Dev &devAcc, const Grid &grid,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out,
+             const ActiveCells<Acc> &act) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    using Cells = decltype(act.device(grid));
+
+    // Spaces must match.
+    assert( act.ncells == alpaka::extent::getExtent<0>(X) );
+    assert( act.ncells == alpaka::extent::getExtent<0>(out) );
+
+    Idx const per = launch_cells<Acc>(devAcc, "2body", act.ncells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, act.ncells, per);
+
+    std::cout << "Creating 2-body kernel for the active cells of " << act.ncells << ".\n";
+    Oper2Kernel<Oper2,Vec,Cells> K{0, 0, alpaka::getPtrNative(act.counter())};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                act.device(grid), alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
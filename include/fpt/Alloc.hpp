@@ -1,22 +1,120 @@
 #pragma once
 
 #include <alpaka/alpaka.hpp>
+#include <cassert>
+
+/** Returned by Alloc_d::alloc when no free block could be found.
+ *  Block indices are always < N, so this can never name a real block.
+ */
+#define ALLOC_FAIL 0xFFFFFFFFu
+
+/** Number of random warp-sized windows of the free-list
+ *  to try before falling back to the summary search.
+ */
+#define ALLOC_PROBES 4
+
+/* Define FPT_ALLOC_STATS to count the free-list windows read
+ * by every allocation in the ALLOC_NPROBE counter.
+ */
 
 namespace fpt {
 
+    /** Slots in the device-side counter array kept by every Alloc.
+     */
+    enum AllocCounter : uint32_t {
+        ALLOC_NFAIL = 0, // number of failed alloc() calls since reinit
+        ALLOC_NFREE,     // number of free blocks
+        ALLOC_NPROBE,    // windows probed since reinit (needs FPT_ALLOC_STATS)
+        ALLOC_COUNTERS   // size of the counter array
+    };
+
+    /** Bit-mask of the block indices [lo, hi) falling into
+     *  free-list word m (i.e. blocks 32*m ... 32*m+31).
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t bitRange(uint32_t m, uint32_t lo, uint32_t hi) {
+        const uint64_t base = uint64_t(m)*32;
+        if(lo >= hi || hi <= base || lo >= base+32)
+            return 0;
+        const uint32_t a = lo > base ? lo - base : 0;
+        const uint32_t b = hi < base+32 ? hi - base : 32;
+        const uint32_t upper = b == 32 ? 0xFFFFFFFFu : (1u<<b) - 1;
+        return upper & ~((1u<<a) - 1);
+    }
+
     // from code.google.com/p/smhasher/wiki/MurmurHash3
-    ALPAKA_FN_HOST_ACC inline static uint32_t searchNext(uint32_t a, uint32_t b, uint32_t N) {
-        uint32_t h = a | (b << 16);
+    // Both finalizers are bijections.
+    ALPAKA_FN_HOST_ACC inline uint32_t fmix32(uint32_t h) {
         h ^= h >> 16;
         h *= 0x85ebca6b;
         h ^= h >> 13;
         h *= 0xc2b2ae35;
         h ^= h >> 16;
+        return h;
+    }
+    ALPAKA_FN_HOST_ACC inline uint64_t fmix64(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /** Next 32-bit state of the probe sequence keyed by b.
+     *  For fixed b, this is a permutation of all 2^32 states,
+     *  so iterating it never enters a short cycle.
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t probeHash(uint32_t h, uint32_t b) {
+        return fmix32(h ^ fmix32(b + 0x9e3779b9u));
+    }
+    ALPAKA_FN_HOST_ACC inline uint64_t probeHash64(uint64_t h, uint64_t b) {
+        return fmix64(h ^ fmix64(b + 0x9e3779b97f4a7c15ull));
+    }
+
+    /** Map a probe state uniformly onto [0, N) without a division.
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t probeIndex(uint32_t h, uint32_t N) {
+        return uint32_t( (uint64_t(h) * N) >> 32 );
+    }
+    ALPAKA_FN_HOST_ACC inline uint64_t probeIndex64(uint64_t h, uint64_t N) {
         return h % N;
     }
 
+    /** Single probe step, kept for callers that only need one
+     *  hashed index.  Covers the full range of N.
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t searchNext(uint32_t a, uint32_t b, uint32_t N) {
+        return probeIndex(probeHash(a, b), N);
+    }
+    ALPAKA_FN_HOST_ACC inline uint64_t searchNext64(uint64_t a, uint64_t b, uint64_t N) {
+        return probeIndex64(probeHash64(a, b), N);
+    }
+
+    /** Rotate x right by k (0 <= k < 32) bits.
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t rotr32(uint32_t x, uint32_t k) {
+        return (x >> k) | (x << ((32 - k) & 31));
+    }
+
+    /** The lowest c set bits of x (all of them if x has fewer).
+     */
+    ALPAKA_FN_HOST_ACC inline uint32_t lowBits(uint32_t x, uint32_t c) {
+        uint32_t ans = 0;
+        for(; c > 0 && x != 0; c--) {
+            const uint32_t b = x & (0u - x);
+            ans |= b;
+            x ^= b;
+        }
+        return ans;
+    }
+
     /**  Device-resident copy of Alloc.
      *   This is created by calling an Alloc's device() method.
+     *
+     *   Besides the free-list, frl, it keeps a summary bitmap, sum,
+     *   with one bit per frl word.  A summary bit is always set when
+     *   its frl word has a free block, but may stay set for a little
+     *   while after the word has been emptied.
      */
     template <typename A, typename Dev>
     class Alloc_d {
@@ -27,57 +125,71 @@ namespace fpt {
 
         const uint32_t N, M; // N = #arr, M = #blocks
         const uint32_t warp; // number of threads in a warp
+        const uint32_t S; // number of summary words (a multiple of warp)
 
       private:
         uint32_t *frl; // free list, size = M*warp
+        uint32_t *sum; // summary of non-zero frl words, size = S
+        uint32_t *cnt; // counters, size = ALLOC_COUNTERS
       public:
         A *arr; // allocatable array blocks
 
         Alloc_d(const uint32_t N_, const uint32_t M_, const uint32_t warp_,
-                    uint32_t *frl_, A *arr_)
-                        : N(N_), M(M_), warp(warp_), frl(frl_), arr(arr_) {}
+                const uint32_t S_, uint32_t *frl_, uint32_t *sum_,
+                uint32_t *cnt_, A *arr_)
+                        : N(N_), M(M_), warp(warp_), S(S_)
+                        , frl(frl_), sum(sum_), cnt(cnt_), arr(arr_) {}
 
         ALPAKA_FN_ACC bool is_free(uint32_t start) {
-            return frl[start/32] & (start % 32) != 0;
+            return (frl[start/32] >> (start % 32)) & 1;
         }
 
         // Every thread receives the same free count.
+        // This reads the ALLOC_NFREE counter, which alloc / free
+        // keep up to date, so it may be stale by the allocations
+        // in flight in other warps.
         template <typename Acc>
         ALPAKA_FN_ACC uint32_t count_free(Acc const& acc) {
-            const auto blk = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
-            const auto warpSize = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
             uint32_t nfree = 0;
-
-            for(uint32_t k=blk; k<M; k += warpSize) {
-                uint32_t x = frl[k];
-                for(int i=0; i<32; i++) {
-                    nfree += (x>>i)&1;
-                }
-            }
-            uint32_t tfree = 0;
-            for(int i=0; i<warpSize; i++) {
-                tfree += alpaka::warp::shfl(acc, nfree, i);
+            if(idx == 0) {
+                nfree = alpaka::atomicOp<alpaka::AtomicOr>(acc, &cnt[ALLOC_NFREE], 0u);
             }
-            return tfree;
+            return alpaka::warp::shfl(acc, nfree, 0);
+        }
+
+        // Count n failures in the ALLOC_NFAIL counter on behalf
+        // of a caller that gave up before asking for a block.
+        template <typename Acc>
+        ALPAKA_FN_ACC void count_failures(Acc const& acc, uint32_t n) {
+            alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFAIL], n);
         }
 
         // Device-accessible function to allocate.
-        // Searches for blocks starting with searchNext(`start`,blk,N)
+        // Searches for blocks at probeIndex(h_i, N),
+        // where h_0 = `start` and h_{i+1} = probeHash(h_i, blk)
         //
         // The entire point of this routine is to find any bit set to 1
         // in the frl.  Then atomically set it to 0 to indicate it's claimed.
         //
         // Must be called by all threads in a warp simultaneously.
         // All threads will receive the same result.
+        //
+        // Returns ALLOC_FAIL if no free block was found.  Every failure
+        // is also counted in the ALLOC_NFAIL counter, which the host
+        // can poll with Alloc::failures() and then grow() the pool.
         template <typename Acc>
         ALPAKA_FN_ACC uint32_t alloc(Acc const& acc, uint32_t start) {
             const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
             const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
 
-            uint32_t n = start;
-            
-            for(int i=0; i<10; i++) {
-                n = searchNext(n, blk, N);
+            uint32_t h = start;
+            uint32_t probes = 0;
+
+            for(int i=0; i<ALLOC_PROBES; i++) {
+                h = probeHash(h, uint32_t(blk));
+                const uint32_t n = probeIndex(h, N);
+                probes++;
 
                 uint32_t m0 = n/32;
                 uint32_t k0 = n%32;
@@ -94,27 +206,32 @@ namespace fpt {
                 for(int j=0; j<warp; j++) {
                     int thr = (m0+j)%warp; // search this thread's space
                     uint32_t m = base + thr;
-                    int b = 32; // indicates no bit found
 
                     if((mask & (1<<thr)) == 0) continue;
 
-                    if(idx == thr) { // this thread does up to 32 atomic operations
-                        for(b=0; b<32; b++) {
-                            int k = (k0+b)%32;
-                            uint32_t nF = (1<<k);
-                            uint32_t ans = alpaka::atomicOp<alpaka::AtomicAnd>(acc, &frl[m], ~nF);
-                            if(ans & nF) { // still 1 => success
-                                break;
-                            }
-                        }
+                    uint32_t got = ALLOC_FAIL;
+                    if(idx == thr) {
+                        got = claim(acc, m, k0);
+                    }
+                    got = alpaka::warp::shfl(acc, got, thr);
+                    if(got != ALLOC_FAIL) {
+                        count_probes(acc, probes);
+                        return got;
                     }
-                    b = alpaka::warp::shfl(acc, b, thr);
-                    if(b != 32)
-                        return m*32 + (k0+b)%32; // 32*m+k
                 }
             }
-            // FIXME: handle OOM condition
-            return 0;
+
+            // The random windows were all full, so the pool is
+            // crowded.  Let the summary guide the search instead.
+            uint32_t n = ALLOC_FAIL;
+            if(count_free(acc) != 0) {
+                n = search_summary(acc, probeHash(h, uint32_t(blk)), probes);
+            }
+            if(n == ALLOC_FAIL && idx == 0) {
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFAIL], 1u);
+            }
+            count_probes(acc, probes);
+            return n;
         }
 
         // Device-accessible function to de-allocate.
@@ -124,12 +241,111 @@ namespace fpt {
             uint32_t m = n/32;
             uint32_t k = n%32;
 
-            if(idx != m%32) return; // only need 1 thread to run this
+            if(idx != m%warp) return; // only need 1 thread to run this
 
             uint32_t nF = (1<<k);
-            alpaka::atomicOp<alpaka::AtomicOr>(acc, &frl[m], nF);
+            uint32_t old = alpaka::atomicOp<alpaka::AtomicOr>(acc, &frl[m], nF);
             // Note: return value should have had a 0 at position k,
             // or else we just double freed.
+            alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFREE], 1u);
+            if(old == 0) { // word m just became non-empty
+                alpaka::atomicOp<alpaka::AtomicOr>(acc, &sum[m/32], 1u << (m%32));
+            }
+        }
+
+        // Batched version of alloc -- every lane with `want` set
+        // receives its own block, and the rest get ALLOC_FAIL.
+        //
+        // The blocks are claimed from whole frl words at once:
+        // every lane of the warp takes as many of the free bits
+        // in its word as are still needed with a single atomicAnd,
+        // and the winnings are then dealt out to the requesting lanes.
+        // So k requests typically cost 1-2 atomics instead of k.
+        //
+        // Must be called by all threads in a warp simultaneously.
+        // Lanes that could not be served receive ALLOC_FAIL and
+        // are counted in ALLOC_NFAIL.
+        template <typename Acc>
+        ALPAKA_FN_ACC uint32_t alloc_batch(Acc const& acc, uint32_t start, bool want) {
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+
+            const auto lanes = alpaka::warp::ballot(acc, want);
+            const uint32_t need = alpaka::popcount(acc, lanes);
+            // position of this lane among the requesting lanes
+            const uint32_t rank = alpaka::popcount(acc,
+                                    lanes & ((decltype(lanes)(1) << idx) - 1));
+            uint32_t done = 0; // number of requests served so far
+            uint32_t mine = ALLOC_FAIL;
+            if(need == 0) return mine;
+
+            uint32_t h = start;
+            uint32_t probes = 0;
+            for(int i=0; i<ALLOC_PROBES && done < need; i++) {
+                h = probeHash(h, uint32_t(blk));
+                const uint32_t m0 = probeIndex(h, N)/32;
+                probes++;
+                const uint32_t base = m0 - (m0%warp);
+                claim_batch(acc, base + idx, need, done, want, rank, mine);
+            }
+
+            if(done < need && count_free(acc) != 0) {
+                const uint32_t windows = S / warp;
+                const uint32_t w0 = probeIndex(probeHash(h, uint32_t(blk)), windows);
+                for(uint32_t t=0; t<windows && done < need; t++) {
+                    const uint32_t base = ((w0 + t) % windows) * warp;
+                    uint32_t G = sum[base + idx];
+                    probes++;
+                    while(done < need && alpaka::warp::ballot(acc, G != 0) != 0) {
+                        uint32_t m = ALLOC_FAIL;
+                        if(G != 0) {
+                            m = (base + idx)*32 + alpaka::ffs(acc, std::int32_t(G)) - 1;
+                            G &= G - 1;
+                        }
+                        claim_batch(acc, m, need, done, want, rank, mine);
+                    }
+                }
+            }
+
+            if(done < need && idx == 0) {
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFAIL], need - done);
+            }
+            count_probes(acc, probes);
+            return mine;
+        }
+
+        // Batched version of free -- every lane with `has` set
+        // releases block n.  Lanes releasing blocks in the same
+        // frl word are combined into a single atomicOr.
+        //
+        // Must be called by all threads in a warp simultaneously.
+        template <typename Acc>
+        ALPAKA_FN_ACC void free_batch(Acc const& acc, uint32_t n, bool has) {
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            const uint32_t m = n/32;
+            const uint32_t nF = 1u << (n%32);
+
+            auto pending = alpaka::warp::ballot(acc, has);
+            while(pending != 0) {
+                const int leader = alpaka::ffs(acc, std::int64_t(pending)) - 1;
+                const uint32_t lm = alpaka::warp::shfl(acc, m, leader);
+                const bool mine = has && m == lm;
+                pending &= ~alpaka::warp::ballot(acc, mine);
+
+                uint32_t bits = 0; // all bits freed from word lm
+                for(int j=0; j<warp; j++) {
+                    bits |= alpaka::warp::shfl(acc, mine ? nF : 0u, j);
+                }
+                if(idx == leader) {
+                    uint32_t old = alpaka::atomicOp<alpaka::AtomicOr>(acc, &frl[lm], bits);
+                    alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFREE],
+                                    uint32_t(alpaka::popcount(acc, bits)));
+                    if(old == 0) {
+                        alpaka::atomicOp<alpaka::AtomicOr>(acc, &sum[lm/32], 1u << (lm%32));
+                    }
+                }
+                has = has && !mine;
+            }
         }
 
         // Device-accessible function to lookup an element.
@@ -137,6 +353,157 @@ namespace fpt {
             return arr[n];
         }
 
+      private:
+        // Called by a single thread.
+        // Claim any free block in frl word m, looking at bit k0 first.
+        // Returns the block index, or ALLOC_FAIL if the word is empty.
+        template <typename Acc>
+        ALPAKA_FN_ACC uint32_t claim(Acc const& acc, uint32_t m, uint32_t k0) {
+            uint32_t F = frl[m];
+            while(F != 0) {
+                const uint32_t k = (k0 + alpaka::ffs(acc,
+                                        std::int32_t(rotr32(F, k0))) - 1) % 32;
+                const uint32_t nF = 1u << k;
+                const uint32_t old = alpaka::atomicOp<alpaka::AtomicAnd>(acc, &frl[m], ~nF);
+                if(old & nF) { // still 1 => success
+                    alpaka::atomicOp<alpaka::AtomicSub>(acc, &cnt[ALLOC_NFREE], 1u);
+                    if((old & ~nF) == 0) {
+                        mark_empty(acc, m);
+                    }
+                    return m*32 + k;
+                }
+                F = old & ~nF; // lost the race, retry with a fresh view
+            }
+            mark_empty(acc, m);
+            return ALLOC_FAIL;
+        }
+
+        // Called by a single thread after seeing frl[m] == 0.
+        // Clears the summary bit, then puts it back if a free
+        // raced in before the clear became visible.
+        template <typename Acc>
+        ALPAKA_FN_ACC void mark_empty(Acc const& acc, uint32_t m) {
+            const uint32_t bit = 1u << (m%32);
+            alpaka::atomicOp<alpaka::AtomicAnd>(acc, &sum[m/32], ~bit);
+            if(alpaka::atomicOp<alpaka::AtomicOr>(acc, &frl[m], 0u) != 0) {
+                alpaka::atomicOp<alpaka::AtomicOr>(acc, &sum[m/32], bit);
+            }
+        }
+
+        template <typename Acc>
+        ALPAKA_FN_ACC void count_probes(Acc const& acc, uint32_t probes) {
+#ifdef FPT_ALLOC_STATS
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            if(idx == 0) {
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NPROBE], probes);
+            }
+#else
+            (void)acc;
+            (void)probes;
+#endif
+        }
+
+        // Exclusive prefix-sum of x over the lanes of the warp.
+        // The sum over all lanes is returned in total.
+        template <typename Acc>
+        ALPAKA_FN_ACC uint32_t warp_scan(Acc const& acc, uint32_t x, uint32_t &total) {
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            uint32_t pre = 0;
+            total = 0;
+            for(int j=0; j<warp; j++) {
+                const uint32_t y = alpaka::warp::shfl(acc, x, j);
+                pre += (j < idx) ? y : 0;
+                total += y;
+            }
+            return pre;
+        }
+
+        // Warp-collective step of alloc_batch.
+        // Each lane offers the free bits of frl word m (m = ALLOC_FAIL
+        // for none), claims just enough of them to serve the
+        // need - done outstanding requests, and the claimed blocks
+        // are handed to the requesting lanes in order of rank.
+        template <typename Acc>
+        ALPAKA_FN_ACC void claim_batch(Acc const& acc, uint32_t m,
+                                       const uint32_t need, uint32_t &done,
+                                       const bool want, const uint32_t rank,
+                                       uint32_t &mine) {
+            const uint32_t F = m != ALLOC_FAIL ? frl[m] : 0;
+            uint32_t avail, got_all;
+            const uint32_t before = warp_scan(acc, alpaka::popcount(acc, F), avail);
+            const uint32_t left = need - done;
+
+            uint32_t got = 0;
+            if(before < left && F != 0) {
+                const uint32_t take = lowBits(F, left - before);
+                const uint32_t old = alpaka::atomicOp<alpaka::AtomicAnd>(acc, &frl[m], ~take);
+                got = old & take;
+                if(got != 0) {
+                    alpaka::atomicOp<alpaka::AtomicSub>(acc, &cnt[ALLOC_NFREE],
+                                    uint32_t(alpaka::popcount(acc, got)));
+                }
+                if((old & ~take) == 0) {
+                    mark_empty(acc, m);
+                }
+            } else if(m != ALLOC_FAIL && F == 0) { // stale summary bit
+                mark_empty(acc, m);
+            }
+
+            const uint32_t ngot = alpaka::popcount(acc, got);
+            const uint32_t first = warp_scan(acc, ngot, got_all);
+
+            // requests [done, done+got_all) are served by this step
+            const uint32_t r = rank - done;
+            for(int j=0; j<warp; j++) {
+                const uint32_t gj = alpaka::warp::shfl(acc, got, j);
+                const uint32_t fj = alpaka::warp::shfl(acc, first, j);
+                const uint32_t mj = alpaka::warp::shfl(acc, m, j);
+                if(want && rank >= done && r >= fj && r - fj < uint32_t(alpaka::popcount(acc, gj))) {
+                    uint32_t x = gj;
+                    for(uint32_t c = r - fj; c > 0; c--) x &= x - 1;
+                    mine = mj*32 + alpaka::ffs(acc, std::int32_t(x)) - 1;
+                }
+            }
+            done += got_all;
+        }
+
+        // Sweep the summary one warp-sized window at a time,
+        // starting from a window chosen by h.  Only frl words
+        // flagged in the summary are visited, so this finds a free
+        // block (if there is one) after reading at most S/32 of
+        // the free-list.
+        //
+        // Must be called by all threads in a warp simultaneously.
+        template <typename Acc>
+        ALPAKA_FN_ACC uint32_t search_summary(Acc const& acc, uint32_t h, uint32_t &probes) {
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            const uint32_t windows = S / warp;
+            const uint32_t w0 = probeIndex(h, windows);
+
+            for(uint32_t t=0; t<windows; t++) {
+                const uint32_t base = ((w0 + t) % windows) * warp;
+                uint32_t G = sum[base + idx];
+                probes++;
+
+                auto mask = alpaka::warp::ballot(acc, G != 0);
+                while(mask != 0) {
+                    const int thr = alpaka::ffs(acc, std::int64_t(mask)) - 1;
+                    uint32_t n = ALLOC_FAIL;
+                    if(idx == thr) {
+                        while(G != 0 && n == ALLOC_FAIL) {
+                            const uint32_t b = alpaka::ffs(acc, std::int32_t(G)) - 1;
+                            G &= G - 1;
+                            n = claim(acc, (base + thr)*32 + b, h % 32);
+                        }
+                    }
+                    n = alpaka::warp::shfl(acc, n, thr);
+                    if(n != ALLOC_FAIL)
+                        return n;
+                    mask &= mask - 1;
+                }
+            }
+            return ALLOC_FAIL;
+        }
     };
 
     //#############################################################################
@@ -152,23 +519,181 @@ namespace fpt {
                 TAcc const& acc,
                 const uint32_t N0,
                 const uint32_t N,
-                uint32_t *frl
+                const uint32_t S,
+                uint32_t *frl,
+                uint32_t *sum,
+                uint32_t *cnt
                 ) const {
             const auto idx = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
-            uint32_t ans = 0;
-            // N/32, N%32 is the bit-number at which we start placing 0-s
-            if(idx <= N/32) {
-                if(idx == N/32) {
-                    ans |= (1<<(N%32)) - 1;
-                } else {
-                    ans = 0xFFFFFFFF;
+            // blocks [N0, N) are free, everything else is used / absent
+            frl[idx] = bitRange(idx, N0, N);
+            if(idx < S) { // summary of frl words [32*idx, 32*idx+32)
+                uint32_t ans = 0;
+                for(uint32_t b=0; b<32; b++) {
+                    ans |= uint32_t(bitRange(32*idx + b, N0, N) != 0) << b;
                 }
-                if(idx < N0) // initial used space
-                    ans = 0;
-                if(idx == N0/32)
-                    ans &= ~( (1<<(N0%32)) - 1 );
+                sum[idx] = ans;
+            }
+            if(idx == 0) {
+                cnt[ALLOC_NFAIL] = 0;
+                cnt[ALLOC_NFREE] = N > N0 ? N - N0 : 0;
+                cnt[ALLOC_NPROBE] = 0;
             }
+        }
+    };
+
+    //#############################################################################
+    //! Kernel copying the free-list of a pool with Nold blocks
+    //! into the free-list of a re-sized pool with N blocks.
+    //! Blocks [Nold, N) are added as free, and blocks >= N are dropped.
+    //! The new summary, sum, must be zeroed beforehand.
+    struct ResizeAllocKernel {
+        ALPAKA_NO_HOST_ACC_WARNING
+        template<typename TAcc>
+        ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const uint32_t Nold,
+                const uint32_t N,
+                const uint32_t words, // size of old free-list
+                const uint32_t *old,
+                uint32_t *frl,
+                uint32_t *sum,
+                uint32_t *cnt
+                ) const {
+            const auto idx = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+            uint32_t ans = idx < words ? old[idx] : 0;
+            ans |= bitRange(idx, Nold, N);
+            ans &= bitRange(idx, 0, N);
             frl[idx] = ans;
+            if(ans != 0) {
+                alpaka::atomicOp<alpaka::AtomicOr>(acc, &sum[idx/32], 1u << (idx%32));
+            }
+            if(idx == 0) { // unsigned wrap-around handles N < Nold
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &cnt[ALLOC_NFREE], N - Nold);
+            }
+        }
+    };
+
+    /** Allocated blocks in free-list word w = this thread's grid index,
+     *  (returned in live) and the number of allocated blocks
+     *  in all words before w.
+     *
+     *  pre[b] holds the number of allocated blocks before
+     *  chunk b of the free-list (the warp-sized chunk read by block b).
+     *  Must be called by all threads in a warp simultaneously.
+     */
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC uint32_t liveBefore(TAcc const& acc,
+                    const uint32_t *frl, const uint32_t *pre,
+                    const uint32_t N, uint32_t &live) {
+        const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const auto warp = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const auto w = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+
+        live = ~frl[w] & bitRange(w, 0, N);
+        const uint32_t c = alpaka::popcount(acc, live);
+        uint32_t before = pre != nullptr ? pre[blk] : 0;
+        for(int j=0; j<warp; j++) {
+            const uint32_t cj = alpaka::warp::shfl(acc, c, j);
+            before += (j < idx) ? cj : 0;
+        }
+        return before;
+    }
+
+    //#############################################################################
+    //! Kernel counting the allocated blocks in every
+    //! warp-sized chunk of the free-list.
+    struct CountLiveKernel {
+        ALPAKA_NO_HOST_ACC_WARNING
+        template<typename TAcc>
+        ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const uint32_t N,
+                const uint32_t *frl,
+                uint32_t *chunk
+                ) const {
+            const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+            const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+            const auto warp = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+
+            uint32_t live;
+            const uint32_t before = liveBefore(acc, frl, nullptr, N, live);
+            // the last lane knows the total for this chunk
+            if(idx == warp-1) {
+                chunk[blk] = before + alpaka::popcount(acc, live);
+            }
+        }
+    };
+
+    //#############################################################################
+    //! First compaction pass.  With L allocated blocks in all,
+    //! the holes (free blocks) in [0, L) are listed in order,
+    //! and blocks already in [0, L) map to themselves.
+    struct CompactHolesKernel {
+        ALPAKA_NO_HOST_ACC_WARNING
+        template<typename TAcc>
+        ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const uint32_t N,
+                const uint32_t L,
+                const uint32_t *frl,
+                const uint32_t *pre,
+                uint32_t *holes,
+                uint32_t *reloc
+                ) const {
+            const auto w = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+
+            uint32_t live;
+            uint32_t before = liveBefore(acc, frl, pre, N, live);
+            for(uint32_t b=0; b<32; b++) {
+                const uint32_t n = 32*w + b;
+                if(n >= N) break;
+                if((live >> b) & 1) {
+                    reloc[n] = n < L ? n : ALLOC_FAIL; // movers set in pass 2
+                    before++;
+                } else {
+                    reloc[n] = ALLOC_FAIL;
+                    if(n < L) {
+                        holes[n - before] = n;
+                    }
+                }
+            }
+        }
+    };
+
+    //#############################################################################
+    //! Second compaction pass.  The allocated blocks at n >= L
+    //! are moved into the holes -- the last one into the first hole.
+    struct CompactMoveKernel {
+        ALPAKA_NO_HOST_ACC_WARNING
+        template<typename TAcc, typename A>
+        ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const uint32_t N,
+                const uint32_t L,
+                const uint32_t *frl,
+                const uint32_t *pre,
+                const uint32_t *holes,
+                uint32_t *reloc,
+                A *arr
+                ) const {
+            const auto w = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+
+            uint32_t live;
+            uint32_t before = liveBefore(acc, frl, pre, N, live);
+            for(uint32_t b=0; b<32; b++) {
+                const uint32_t n = 32*w + b;
+                if(n >= N) break;
+                if(((live >> b) & 1) == 0) continue;
+                if(n >= L) {
+                    const uint32_t dest = holes[L - 1 - before];
+                    arr[dest] = arr[n];
+                    reloc[n] = dest;
+                }
+                before++;
+            }
         }
     };
 
@@ -185,41 +710,169 @@ namespace fpt {
         using FreeDev = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
         using BufDev = alpaka::Buf<Dev, A, Dim, Idx>;
 
-        const uint32_t N; // N = #arr
+        uint32_t N; // N = #arr (changed by grow)
         const uint32_t warp; // number of threads in a warp
-        const uint32_t M; // M = #blocks
+        uint32_t M; // M = #blocks (changed by grow)
+        uint32_t S; // S = #summary words (changed by grow)
         const Dev &devAcc;
 
     private:
         FreeDev frl; // free list, size = M*warp
+        FreeDev sum; // summary of non-zero frl words, size = S
+        FreeDev cnt; // counters, size = ALLOC_COUNTERS
         BufDev arr; // allocatable array blocks
 
+        // one bit per frl word, rounded up to whole warps
+        static uint32_t summary_words(uint32_t M, uint32_t warp) {
+            return ((M*warp + 31)/32 + warp - 1)/warp * warp;
+        }
+
     public:
         Alloc(const Dev &devAcc_, const uint32_t N_)
             : N(N_)
             , warp( alpaka::getWarpSize(devAcc_) )
             , M((N+32*warp-1)/(32*warp))
+            , S(summary_words(M, warp))
             , devAcc(devAcc_)
             , frl( FreeDev{alpaka::allocBuf<uint32_t, Idx>(
                                     devAcc_, M * warp)} )
+            , sum( FreeDev{alpaka::allocBuf<uint32_t, Idx>(devAcc_, S)} )
+            , cnt( FreeDev{alpaka::allocBuf<uint32_t, Idx>(
+                                    devAcc_, Idx(ALLOC_COUNTERS))} )
             , arr( BufDev{alpaka::allocBuf<A, Idx>(devAcc_, N)} ) {
-            // FIXME: kernel call to inialize frl (all 1, except last few
-            // cells when 32*warp doesn't divide N = 0)
+            auto Q = alpaka::Queue<Acc, alpaka::Blocking>(devAcc);
+            reinit(0, Q);
         }
 
         // Create device-resident allocator class.
+        // Handles become invalid after grow(), so re-create them.
         Alloc_d<A,Dev> device() {
-            return Alloc_d<A,Dev>(N, M, warp,
+            return Alloc_d<A,Dev>(N, M, warp, S,
                                 alpaka::getPtrNative(frl), 
+                                alpaka::getPtrNative(sum),
+                                alpaka::getPtrNative(cnt),
                                 alpaka::getPtrNative(arr) );
         }
 
+        // Buffer holding the blocks.  Like device() handles,
+        // it is replaced by grow() and shrink().
+        BufDev &data() {
+            return arr;
+        }
+        const BufDev &data() const {
+            return arr;
+        }
+
         template <typename Queue>
         void reinit(uint32_t N0, Queue &Q) {
             auto K = initKernel(N0);
             alpaka::enqueue(Q, K);
         }
 
+        // Number of failed allocations since the last reinit / reset_failures.
+        // Waits on Q to complete.
+        template <typename Queue>
+        uint32_t failures(Queue &Q) {
+            return read_counter(ALLOC_NFAIL, Q);
+        }
+
+        // Number of free blocks.  Waits on Q to complete.
+        template <typename Queue>
+        uint32_t count_free(Queue &Q) {
+            return read_counter(ALLOC_NFREE, Q);
+        }
+
+        // Number of free-list windows read by all allocations
+        // since the last reinit / reset_probes.  This is only
+        // counted when compiled with FPT_ALLOC_STATS.
+        // Waits on Q to complete.
+        template <typename Queue>
+        uint32_t probes(Queue &Q) {
+            return read_counter(ALLOC_NPROBE, Q);
+        }
+
+        template <typename Queue>
+        void reset_failures(Queue &Q) {
+            reset_counter(ALLOC_NFAIL, Q);
+        }
+
+        template <typename Queue>
+        void reset_probes(Queue &Q) {
+            reset_counter(ALLOC_NPROBE, Q);
+        }
+
+        // Grow the pool to hold N2 > N blocks.
+        //
+        // All allocated blocks keep their index and contents,
+        // and blocks [N, N2) become free.  Waits on Q to complete,
+        // so no kernel may be using the old device() handle
+        // when this is called.  Call device() again afterwards.
+        template <typename Queue>
+        void grow(uint32_t N2, Queue &Q) {
+            if(N2 <= N) return;
+            resize(N2, Q);
+        }
+
+        // Move all allocated blocks into a dense prefix, [0, L),
+        // and rebuild the free-list to match.  Returns L.
+        //
+        // On return, reloc[n] holds the new index of block n,
+        // or ALLOC_FAIL if block n was free.  reloc must have
+        // room for N entries.  Block owners should patch their
+        // references with it.  Waits on Q to complete, and
+        // resets the counters like reinit.
+        template <typename Queue>
+        uint32_t compact(FreeDev &reloc, Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            FreeDev pre{alpaka::allocBuf<uint32_t, Idx>(devAcc, M)};
+            FreeDev holes{alpaka::allocBuf<uint32_t, Idx>(devAcc, N/2 + 1)};
+            auto host = alpaka::allocBuf<uint32_t, Idx>(devHost, M);
+
+            alpaka::WorkDivMembers<Dim, uint32_t>
+                    workDiv{Vec::all(M), Vec::all(warp), Vec::all(1)};
+            alpaka::exec<Acc>(Q, workDiv, CountLiveKernel{}, N,
+                              alpaka::getPtrNative(frl),
+                              alpaka::getPtrNative(pre));
+
+            // exclusive scan over the chunks
+            alpaka::memcpy(Q, host, pre, M);
+            alpaka::wait(Q);
+            uint32_t *c = alpaka::getPtrNative(host);
+            uint32_t L = 0;
+            for(uint32_t b=0; b<M; b++) {
+                const uint32_t x = c[b];
+                c[b] = L;
+                L += x;
+            }
+            alpaka::memcpy(Q, pre, host, M);
+
+            alpaka::exec<Acc>(Q, workDiv, CompactHolesKernel{}, N, L,
+                              alpaka::getPtrNative(frl),
+                              alpaka::getPtrNative(pre),
+                              alpaka::getPtrNative(holes),
+                              alpaka::getPtrNative(reloc));
+            alpaka::exec<Acc>(Q, workDiv, CompactMoveKernel{}, N, L,
+                              alpaka::getPtrNative(frl),
+                              alpaka::getPtrNative(pre),
+                              alpaka::getPtrNative(holes),
+                              alpaka::getPtrNative(reloc),
+                              alpaka::getPtrNative(arr));
+            reinit(L, Q);
+            alpaka::wait(Q);
+            return L;
+        }
+
+        // Shrink the pool to hold N2 < N blocks.
+        //
+        // All blocks >= N2 must be free, as they are after compact()
+        // when N2 >= L.  Otherwise behaves like grow().
+        template <typename Queue>
+        void shrink(uint32_t N2, Queue &Q) {
+            if(N2 >= N) return;
+            assert( N - count_free(Q) <= N2 );
+            resize(N2, Q);
+        }
+
         // Kernel launch to (re)initialize free-list.
         auto initKernel(uint32_t N0) {
             // Launch with one warp per thread block:
@@ -231,7 +884,56 @@ namespace fpt {
 
             // Create the kernel execution task.
             ClearAllocKernel K{};
-            return alpaka::createTaskKernel<Acc>(workDiv, K, N0, N, alpaka::getPtrNative(frl));
+            return alpaka::createTaskKernel<Acc>(workDiv, K, N0, N, S,
+                                    alpaka::getPtrNative(frl),
+                                    alpaka::getPtrNative(sum),
+                                    alpaka::getPtrNative(cnt));
+        }
+
+    private:
+        template <typename Queue>
+        void reset_counter(AllocCounter c, Queue &Q) {
+            alpaka::ViewSubView<Dev, uint32_t, Dim, Idx> view(
+                        cnt, Vec::all(1), Vec::all(c));
+            alpaka::memset(Q, view, 0, Vec::all(1));
+        }
+
+        template <typename Queue>
+        uint32_t read_counter(AllocCounter c, Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto host = alpaka::allocBuf<uint32_t, Idx>(devHost, Idx(ALLOC_COUNTERS));
+            alpaka::memcpy(Q, host, cnt, Idx(ALLOC_COUNTERS));
+            alpaka::wait(Q);
+            return alpaka::getPtrNative(host)[c];
+        }
+
+        template <typename Queue>
+        void resize(uint32_t N2, Queue &Q) {
+            const uint32_t M2 = (N2+32*warp-1)/(32*warp);
+            const uint32_t S2 = summary_words(M2, warp);
+            FreeDev frl2{alpaka::allocBuf<uint32_t, Idx>(devAcc, M2 * warp)};
+            FreeDev sum2{alpaka::allocBuf<uint32_t, Idx>(devAcc, S2)};
+            BufDev arr2{alpaka::allocBuf<A, Idx>(devAcc, N2)};
+
+            alpaka::memcpy(Q, arr2, arr, N < N2 ? N : N2);
+            alpaka::memset(Q, sum2, 0, S2);
+
+            alpaka::WorkDivMembers<Dim, uint32_t>
+                    workDiv{Vec::all(M2), Vec::all(warp), Vec::all(1)};
+            ResizeAllocKernel K{};
+            alpaka::exec<Acc>(Q, workDiv, K, N, N2, M*warp,
+                              alpaka::getPtrNative(frl),
+                              alpaka::getPtrNative(frl2),
+                              alpaka::getPtrNative(sum2),
+                              alpaka::getPtrNative(cnt));
+            alpaka::wait(Q); // old buffers are released below
+
+            frl = frl2;
+            sum = sum2;
+            arr = arr2;
+            N = N2;
+            M = M2;
+            S = S2;
         }
     };
 
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+#include <fpt/Reduce.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+namespace fpt {
+
+/** Histogram the distances between pairs of atoms closer than R,
+ *  by the types of both atoms.
+ *
+ *  The cells are traversed as in Oper2Kernel, far cells loaded
+ *  into shared memory with load_cell, and atoms across periodic
+ *  walls shifted to their nearest image by cells.image().
+ *  Counts go to a histogram in shared memory, which each block
+ *  adds to hist once at the end, after striding over its cells.
+ *
+ *  Bin k of hist[(ta*Types + tb)*Bins + k] counts pairs with home
+ *  type ta, far type tb and distance in [k, k+1)*R/Bins.  Every pair
+ *  is counted from both atoms.  type[n] is the type of atom n,
+ *  or every atom is of type 0 if type is null.
+ */
+template <int Bins, int Types, typename Vec>
+struct PairHistKernel {
+    float R;        // histogram range
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const BoxCells cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ X,
+                const uint8_t *__restrict__ type,
+                unsigned long long *__restrict__ const hist
+                ) const {
+        constexpr uint32_t E = cell_elems<TAcc>();
+        constexpr uint32_t H = Types*Types*Bins;
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        auto &part = alpaka::declareSharedVar<uint32_t[H], __COUNTER__>(acc);
+        auto &far = alpaka::declareSharedVar<CellTranspose, __COUNTER__>(acc);
+
+        for(uint32_t h = idx; h < H; h += threads)
+            part[h] = 0;
+        alpaka::syncBlockThreads(acc);
+
+        const float R2 = R*R;
+        const float scale = Bins/R;
+        for(uint32_t bin = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; bin < count; bin += blocks) {
+            uint32_t bn[E], bt[E];
+            float bx[E], by[E], bz[E];
+            for(uint32_t e = 0; e < E; e++) {
+                const uint32_t j = idx + e*threads;
+                const bool in = j < ATOMS_PER_CELL;
+                bn[e] = in ? X[bin].n[j] : 0;
+                bt[e] = bn[e] != 0 && type != nullptr ? type[bn[e]] : 0;
+                bx[e] = in ? X[bin].x[j] : 0.0f;
+                by[e] = in ? X[bin].y[j] : 0.0f;
+                bz[e] = in ? X[bin].z[j] : 0.0f;
+            }
+
+            int bi, bj, bk;
+            cells.decode(bin, bi, bj, bk);
+            int r = 0; // current row of nbr
+            CellRange off = nbr[0];
+            while(next_row(cells, nbr, r, bi, bj, bk, off)) {
+                const float sy = cells.image(bj + off.j, 1);
+                const float sz = cells.image(bk + off.k, 2);
+                const uint32_t start = cells.row(bj, bk, off);
+                for(int di = off.i0; di <= off.i1; di++) {
+                    const float sx = cells.image(bi + di, 0);
+                    alpaka::syncBlockThreads(acc);
+                    const int self = load_cell(acc, X, cells.col(start, bi, di), far, bin);
+                    alpaka::syncBlockThreads(acc);
+
+                    for(int m = 0; m < ATOMS_PER_CELL; m++) {
+                        const uint32_t an = far.n[m];
+                        if(an == 0) continue;
+                        const uint32_t at = type != nullptr ? type[an] : 0;
+                        const float ax = far.x[m] + sx, ay = far.y[m] + sy, az = far.z[m] + sz;
+                        for(uint32_t e = 0; e < E; e++) {
+                            if(bn[e] == 0 || (self && m == int(idx + e*threads))) continue;
+                            const float d2 = SQR(bx[e]-ax) + SQR(by[e]-ay) + SQR(bz[e]-az);
+                            if(d2 >= R2) continue;
+                            int k = int(sqrtf(d2)*scale);
+                            k = k < Bins ? k : Bins-1;
+                            alpaka::atomicOp<alpaka::AtomicAdd>(acc,
+                                    &part[(bt[e]*Types + at)*Bins + k], uint32_t(1));
+                        }
+                    }
+                }
+                r++;
+            }
+        }
+        alpaka::syncBlockThreads(acc);
+
+        for(uint32_t h = idx; h < H; h += threads)
+            if(part[h] != 0)
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &hist[h], (unsigned long long)part[h]);
+    }
+};
+
+/** Radial distribution functions between atom types, accumulated
+ *  on the device over any number of frames.
+ *
+ *    fpt::PairHistogram<100, 2, Acc> rdf(devAcc, srt, R);  // zeroed
+ *    auto nbr = srt.list_cells(R);    // copied to nbr_d on the device
+ *    rdf.enqueue(queue, nbr_d, X, types);  // every few steps
+ *    auto g = rdf.rdf(rdf.get(queue), 0, 1, N0, N1);
+ *
+ *  types is a device array of one uint8_t type per atom number n.
+ *  R must be below half the box along periodic axes, so that no
+ *  cell of the stencil is visited twice.
+ */
+template <int Bins, int Types, typename Acc>
+class PairHistogram {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using HistBuf = alpaka::Buf<Dev, unsigned long long, Dim, Idx>;
+        static constexpr int Size = Types*Types*Bins;
+
+        const Dev &devAcc;
+        const CellSorter srt;
+        const float R;
+        int frames = 0; // enqueue() calls since the last reset()
+
+        PairHistogram(const Dev &devAcc_, const CellSorter &srt_, const float R_)
+            : devAcc(devAcc_), srt(srt_), R(R_)
+            , hist( HistBuf{alpaka::allocBuf<unsigned long long, Idx>(devAcc_, Idx(Size))} ) {
+            // The grid must not be sheared.
+            assert( srt.L[3] == 0.0 && srt.L[4] == 0.0 && srt.L[5] == 0.0 );
+            const auto nbr = srt.list_cells(R);
+            for(int a = 0; a < 3; a++)
+                assert( srt.bc[a] != BC_PERIODIC || 2*stencil_extent(nbr, a) + 1 <= srt.n[a] );
+            auto Q = alpaka::Queue<Acc, alpaka::Blocking>(devAcc);
+            reset(Q);
+        }
+
+        /// Zero the histogram.
+        template <typename Queue>
+        void reset(Queue &Q) {
+            alpaka::memset(Q, hist, 0, Idx(Size));
+            frames = 0;
+        }
+
+        /** Add the pairs of X (sorted on srt) to the histogram.
+         *  nbr must hold srt.list_cells(R).
+         */
+        template <typename Queue>
+        void enqueue(Queue &Q, const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+                     const alpaka::Buf<Dev, Cell, Dim, Idx> &X, const uint8_t *types = nullptr) {
+            if(frames == 0) reset(Q);
+            Idx const ncells = srt.cells;
+            assert( alpaka::extent::getExtent<0>(X) == ncells );
+            Idx const per = launch_cells<Acc>(devAcc, "2body", ncells);
+            alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, ncells, per),
+                              PairHistKernel<Bins,Types,Vec>{R, uint32_t(ncells)},
+                              BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
+                              alpaka::getPtrNative(X), types, alpaka::getPtrNative(hist));
+            frames++;
+        }
+
+        /// Copy the histogram to the host.  Waits for Q.
+        template <typename Queue>
+        std::vector<unsigned long long> get(Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto h = alpaka::allocBuf<unsigned long long, Idx>(devHost, Idx(Size));
+            alpaka::memcpy(Q, h, hist, Idx(Size));
+            alpaka::wait(Q);
+            const unsigned long long *p = alpaka::getPtrNative(h);
+            return std::vector<unsigned long long>(p, p + Size);
+        }
+
+        /** g(r) between types a and b at the bin centers, from
+         *  histogram h, with na and nb atoms of each type.
+         *  Averages over the frames accumulated.
+         */
+        std::vector<double> rdf(const std::vector<unsigned long long> &h,
+                                const int a, const int b, const double na, const double nb) const {
+            const double V = double(srt.L[0])*srt.L[1]*srt.L[2];
+            const double pairs = na*(a == b ? nb - 1.0 : nb);
+            const double w = R/Bins;
+            std::vector<double> g(Bins);
+            for(int k = 0; k < Bins; k++) {
+                const double shell = 4.0*M_PI/3.0*(std::pow((k+1)*w, 3) - std::pow(k*w, 3));
+                const double ideal = std::max(frames, 1) * pairs*shell/V;
+                g[k] = h[(a*Types + b)*Bins + k] / ideal;
+            }
+            return g;
+        }
+
+    private:
+        HistBuf hist;
+};
+
+/** Sums of cos(k.r) and sin(k.r) over the atoms for NK wave
+ *  vectors, reduced on the device with Reduction.  The static
+ *  structure factor is S(k) = |sum exp(i k.r)|^2 / N, see sk().
+ *
+ *    auto op = fpt::StructureOper<16>::along(2, Lz);
+ *    auto a = fpt::reduce1Body<fpt::StructureOper<16>,Acc>(devAcc, queue, X, op);
+ *    float s = op.sk(a, 0);
+ *
+ *  The reduction's shared memory holds ATOMS_PER_CELL accumulators,
+ *  so keep NK small (16 wave vectors use 8.5 kB).
+ */
+template <int NK>
+struct StructureOper {
+    float kx[NK], ky[NK], kz[NK];
+
+    struct Accum {
+        double n;
+        double re[NK], im[NK];
+    };
+
+    /// Wave vectors 2 pi m / L along axis (0,1,2 = x,y,z), m = 1 .. NK.
+    static StructureOper along(const int axis, const float L) {
+        StructureOper op;
+        for(int q = 0; q < NK; q++) {
+            const float k = 2.0*M_PI*(q+1)/L;
+            op.kx[q] = axis == 0 ? k : 0.0f;
+            op.ky[q] = axis == 1 ? k : 0.0f;
+            op.kz[q] = axis == 2 ? k : 0.0f;
+        }
+        return op;
+    }
+
+    static inline ALPAKA_FN_HOST_ACC void init(Accum &a) {
+        a.n = 0.0;
+        for(int q = 0; q < NK; q++)
+            a.re[q] = a.im[q] = 0.0;
+    }
+    inline ALPAKA_FN_HOST_ACC void f(Accum &a, int idx,
+                                     uint32_t n, float x, float y, float z) const {
+        a.n += 1.0;
+        for(int q = 0; q < NK; q++) {
+            const float ph = kx[q]*x + ky[q]*y + kz[q]*z;
+            a.re[q] += cosf(ph);
+            a.im[q] += sinf(ph);
+        }
+    }
+    static inline ALPAKA_FN_HOST_ACC void combine(Accum &a, const Accum &b) {
+        a.n += b.n;
+        for(int q = 0; q < NK; q++) {
+            a.re[q] += b.re[q];
+            a.im[q] += b.im[q];
+        }
+    }
+
+    /// S(k) for wave vector q.
+    static double sk(const Accum &a, const int q) {
+        return a.n > 0.0 ? (a.re[q]*a.re[q] + a.im[q]*a.im[q]) / a.n : 0.0;
+    }
+};
+
+}
@@ -3,8 +3,10 @@
 #include <algorithm>
 #include <alpaka/alpaka.hpp>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <numeric>
+#include <type_traits>
 #include <vector>
 #include <stdint.h>
 
@@ -13,6 +15,11 @@
 /** Round up list of CellRange to this size */
 #define CELL_LIST_PAD  32
 
+/** Returned by a cell indexing's target() for an atom
+ *  that has no cell to go to.
+ */
+#define CELL_NONE 0xFFFFFFFFu
+
 namespace fpt {
     struct CellEnergy {
         uint32_t n[ATOMS_PER_CELL];
@@ -43,14 +50,25 @@ namespace fpt {
         CellRange(signed char _i0, signed char _i1, signed char _j, signed char _k) : i0(_i0),i1(_i1),j(_j),k(_k) {};
     };
 
+    /** Boundary condition along one axis.
+     */
+    enum Boundary : int {
+        BC_PERIODIC = 0, // atoms leaving one side re-enter at the other
+        BC_OPEN,         // atoms leaving the box are dropped
+        BC_REFLECT       // atoms leaving the box are mirrored back inside
+    };
+
     /** Flat copy of CellSorter class to be passed by value to device
      */
     struct CellSorter_d {
         const float h[3];
         const int n[3];
+        const int bc[3];
 
-        CellSorter_d(float Lx, float Ly, float Lz, int nx, int ny, int nz)
-            : h{Lx/nx, Ly/ny, Lz/nz}, n{nx, ny, nz} {}
+        CellSorter_d(float Lx, float Ly, float Lz, int nx, int ny, int nz,
+                     Boundary bx = BC_PERIODIC, Boundary by = BC_PERIODIC,
+                     Boundary bz = BC_PERIODIC)
+            : h{Lx/nx, Ly/ny, Lz/nz}, n{nx, ny, nz}, bc{bx, by, bz} {}
 
         ALPAKA_FN_HOST_ACC inline
             void decodeBin(const unsigned int bin, int& i, int& j, int& k) const { 
@@ -77,6 +95,7 @@ namespace fpt {
          *
          * Must be called simultaneously by all threads in a warp.
          * The values of ntype and bin only matter on thread = srcThread.
+         * Thread t owns slots t, t + threads, t + 2 threads, ...
          */
         ALPAKA_NO_HOST_ACC_WARNING
         template<typename TAcc, typename Idx>
@@ -86,7 +105,9 @@ namespace fpt {
                 uint32_t ntype,
                 uint32_t bin) const {
             auto const idx(alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0u]); // threadIdx.x
-            uint64_t active = alpaka::warp::activemask(acc);
+            auto const threads(alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0u]);
+            const uint64_t full = ATOMS_PER_CELL == 64 ? ~uint64_t(0)
+                                : (uint64_t(1) << ATOMS_PER_CELL) - 1;
 
             bin = alpaka::warp::shfl(acc, int32_t(bin), srcThread);
             ntype = alpaka::warp::shfl(acc, int32_t(ntype), srcThread);
@@ -96,41 +117,199 @@ namespace fpt {
             int winner;
             int32_t cont = 1;
             while(cont) {
-                uint32_t n = cell.n[idx];
-                auto mask = alpaka::warp::ballot(acc, n != 0);
+                uint64_t mask = 0; // slots in use
+                for(uint32_t s0 = 0; s0 < ATOMS_PER_CELL; s0 += threads) {
+                    const uint32_t s = s0 + idx;
+                    const bool used = s < ATOMS_PER_CELL && cell.n[s] != 0;
+                    mask |= uint64_t(alpaka::warp::ballot(acc, used)) << s0;
+                }
 
-                if(mask == active) { // no open slots
+                if(mask == full) { // no open slots
                     // FIXME: allocate continuation
                     return -1;
                 }
-                for(winner=0; (1<<winner) & mask; winner++); // find winning thread (first 0)
+                for(winner=0; (uint64_t(1)<<winner) & mask; winner++); // find winning slot (first 0)
 
-                if(idx == winner) {
+                const int owner = winner % threads;
+                if(int(idx) == owner) {
                     cont = alpaka::atomicOp<alpaka::AtomicCas>(acc,
-                                  &cell.n[idx], uint32_t(0), ntype);
+                                  &cell.n[winner], uint32_t(0), ntype);
                 }
-                cont = alpaka::warp::shfl(acc, cont, winner);
+                cont = alpaka::warp::shfl(acc, cont, owner);
             }
             return winner;
         }
     };
 
+    /** Shift from the cell at unwrapped index u along axis a
+     *  to the periodic image of it that a modulo wraps to, so that
+     *  atoms read from the wrapped cell appear at x + shift.
+     *  Zero inside the box and along non-periodic axes.
+     */
+    ALPAKA_FN_HOST_ACC inline
+        float image_shift(const CellSorter_d &srt, const int u, const int a) {
+            const int n = srt.n[a];
+            if(srt.bc[a] != BC_PERIODIC || (u >= 0 && u < n))
+                return 0.0f;
+            const int w = u >= 0 ? u/n : -((n - 1 - u)/n); // floor(u/n)
+            return w*n*srt.h[a];
+    }
+
+    /** Cell indexing on a CellSorter box, used by the sort and
+     *  pair kernels.  Neighbor indices wrap with a modulo along
+     *  periodic axes, and the stencil is clipped at the other walls.
+     *
+     *  Block b of a kernel works on cell home(b).
+     *  Neighbors of a cell with (decoded) indices i,j,k
+     *  are col(row(j, k, off), i, off.i0 ... off.i1),
+     *  for every `off' that clip(i, j, k, off) keeps.  Atoms
+     *  of a neighbor reached across a periodic wall are shifted
+     *  by image() along each axis.
+     *  The sorter moves an atom into cell target(x, y, z).
+     */
+    struct BoxCells {
+        CellSorter_d srt;
+
+        ALPAKA_FN_HOST_ACC inline
+            uint32_t home(const uint32_t block) const {
+                return block;
+        }
+
+        ALPAKA_FN_HOST_ACC inline
+            void decode(const uint32_t bin, int &i, int &j, int &k) const {
+                srt.decodeBin(bin, i, j, k);
+        }
+
+        /// Wrap a cell index along periodic axes.
+        ALPAKA_FN_HOST_ACC inline
+            int index(const int i, const int a) const {
+                return srt.bc[a] == BC_PERIODIC ? (i + srt.n[a])%srt.n[a] : i;
+        }
+
+        /// Shift of the atoms in the cell at unwrapped index u along axis a.
+        ALPAKA_FN_HOST_ACC inline
+            float image(const int u, const int a) const {
+                return image_shift(srt, u, a);
+        }
+
+        /** Drop the part of row `off' that lies beyond a wall.
+         *  Returns false if nothing is left.
+         */
+        ALPAKA_FN_HOST_ACC inline
+            bool clip(const int i, const int j, const int k, CellRange &off) const {
+                if(srt.bc[1] != BC_PERIODIC && uint32_t(j+off.j) >= uint32_t(srt.n[1]))
+                    return false;
+                if(srt.bc[2] != BC_PERIODIC && uint32_t(k+off.k) >= uint32_t(srt.n[2]))
+                    return false;
+                if(srt.bc[0] != BC_PERIODIC) {
+                    if(off.i0 < -i) off.i0 = -i;
+                    if(off.i1 > srt.n[0]-1-i) off.i1 = srt.n[0]-1-i;
+                }
+                return off.i0 <= off.i1;
+        }
+
+        ALPAKA_FN_HOST_ACC inline
+            uint32_t row(const int j, const int k, const CellRange off) const {
+                return srt.calcBin(0, index(j+off.j, 1), index(k+off.k, 2));
+        }
+
+        ALPAKA_FN_HOST_ACC inline
+            uint32_t col(const uint32_t start, const int i, const int di) const {
+                return start + index(i + di, 0);
+        }
+
+        /** Fold a position into the box.
+         *  Returns false if it left through an open wall.
+         */
+        ALPAKA_FN_HOST_ACC inline
+            bool wrap(float &x, float &y, float &z) const {
+                return fold(x, 0) && fold(y, 1) && fold(z, 2);
+        }
+
+        /** Cell receiving an atom at x,y,z.
+         *  Called by every thread of the warp, with `valid' unset
+         *  on threads that hold no atom.
+         */
+        template <typename TAcc>
+        ALPAKA_FN_ACC inline
+            uint32_t target(TAcc const &acc, float x, float y, float z, bool valid) const {
+                return srt.calcBinF(x, y, z);
+        }
+
+        ALPAKA_FN_HOST_ACC inline
+            bool fold(float &x, const int a) const {
+                const float L = srt.n[a]*srt.h[a];
+                if(x >= 0.0f && x < L) return true;
+
+                switch(srt.bc[a]) {
+                case BC_PERIODIC:
+                    x -= L*floorf(x/L);
+                    if(x >= L) x = 0.0f; // rounded up from just below 0
+                    return true;
+                case BC_REFLECT:
+                    x = x < 0.0f ? -x : 2.0f*L - x;
+                    if(x >= L) x = L*(1.0f - 1e-6f); // exactly on the wall
+                    return x >= 0.0f;
+                default:
+                    return false;
+                }
+        }
+    };
+
+    /** Largest cell offset along axis (0,1,2 = x,y,z)
+     *  in the cell list `nbr'.
+     */
+    inline int stencil_extent(const std::vector<CellRange> &nbr, const int axis) {
+        int g = 0;
+        for(const auto &r : nbr) {
+            if(r.i0 > r.i1) continue; // terminator
+            const int e = axis == 0 ? std::max(std::abs(int(r.i0)), std::abs(int(r.i1)))
+                        : std::abs(int(axis == 1 ? r.j : r.k));
+            g = std::max(g, e);
+        }
+        return g;
+    }
+
+    /** Number of cells along axis (0,1,2 = x,y,z) spanned
+     *  by the cell list `nbr'.  On a periodic axis of n cells,
+     *  no cell is visited twice while this is at most n.
+     */
+    inline int stencil_span(const std::vector<CellRange> &nbr, const int axis) {
+        int lo = 127, hi = -128;
+        for(const auto &r : nbr) {
+            if(r.i0 > r.i1) continue; // terminator
+            lo = std::min(lo, int(axis == 0 ? r.i0 : (axis == 1 ? r.j : r.k)));
+            hi = std::max(hi, int(axis == 0 ? r.i1 : (axis == 1 ? r.j : r.k)));
+        }
+        return hi < lo ? 0 : hi - lo + 1;
+    }
+
     struct CellSorter {
         const float L[6]; // x,y,z,yx,zx,zy
         const int n[3];
         const unsigned int cells;
+        Boundary bc[3];
 
         CellSorter(float Lx, float Ly, float Lz, int nx, int ny, int nz, float Lyx=0.0, float Lzx=0.0, float Lzy=0.0)
-            : L{Lx, Ly, Lz, Lyx,Lzx,Lzy}, n{nx, ny, nz}, cells(nx*ny*nz) { }
+            : L{Lx, Ly, Lz, Lyx,Lzx,Lzy}, n{nx, ny, nz}, cells(nx*ny*nz)
+            , bc{BC_PERIODIC, BC_PERIODIC, BC_PERIODIC} { }
+
+        ///! Set the boundary condition along x, y and z.
+        CellSorter &set_boundary(Boundary bx, Boundary by, Boundary bz) {
+            bc[0] = bx;
+            bc[1] = by;
+            bc[2] = bz;
+            return *this;
+        }
 
         ///! Return device-accessible copy of this class.
         CellSorter_d device() const {
-            return CellSorter_d(L[0], L[1], L[2], n[0], n[1], n[2]);
+            return CellSorter_d(L[0], L[1], L[2], n[0], n[1], n[2], bc[0], bc[1], bc[2]);
         }
 
         // Create list of cells within cutoff Rc
         // inclusive range to iterate over (i0,i1),(j,k)
-        std::vector<CellRange> list_cells(const float Rc) {
+        std::vector<CellRange> list_cells(const float Rc) const {
             const float eps = 1e-6;
             std::vector<CellRange> cell_list;
             cell_list.reserve(28);
@@ -170,32 +349,147 @@ namespace fpt {
                     }
                 }
             }
+            end_list(cell_list);
+            return cell_list;
+        }
+
+        /** List the cells of grid `far' within cutoff Rc of a
+         *  cell of this grid, as offsets from the far cell holding
+         *  its lower corner.  Both grids must cover the same box.
+         *  Used for pairs between atoms binned on different grids.
+         */
+        std::vector<CellRange> list_cells(const CellSorter &far, const float Rc) const {
+            // Sheared grids do not line up.
+            assert(L[3] == 0.0 && L[4] == 0.0 && L[5] == 0.0);
+            assert(far.L[3] == 0.0 && far.L[4] == 0.0 && far.L[5] == 0.0);
+            const float eps = 1e-6;
+            std::vector<CellRange> cell_list;
+
+            float h[3], w[3];
+            int d0[3], d1[3];
+            for(int a=0; a<3; a++) {
+                assert(far.L[a] == L[a]);
+                h[a] = far.L[a]/far.n[a];
+                w[a] = float(far.n[a])/n[a]; // width of a home cell, in far cells
+                d0[a] = -1 - int(ceil(Rc/h[a]));
+                d1[a] =  1 + int(ceil(Rc/h[a] + w[a]));
+            }
+            // Smallest distance, in far cells, between far cell d and any
+            // home cell whose corner lies in far cell 0.  The home cell spans
+            // [f, f+w) far cells, for some 0 <= f < 1.
+            auto gap = [&](const int d, const int a) {
+                const float g = d > 0 ? d - 1 - w[a] : -d - 1.0f;
+                return g > 0.0f ? g : 0.0f;
+            };
+            // Whether far cell d lies within sqrt(R2) along axis a.
+            // As in list_cells(Rc), cells within eps of touching are left out.
+            auto within = [&](const int d, const int a, const float R2) {
+                const float g = gap(d, a);
+                return g == 0.0f || (R2 > 0.0f && g <= sqrt(R2)/h[a] - eps);
+            };
+
+            const float R2 = Rc*Rc;
+            for(int k=d0[2]; k<=d1[2]; k++) {
+                if(!within(k, 2, R2)) continue;
+                const float dz = gap(k, 2)*h[2];
+                const float R2z = R2 - dz*dz;
+                for(int j=d0[1]; j<=d1[1]; j++) {
+                    if(!within(j, 1, R2z)) continue;
+                    const float dy = gap(j, 1)*h[1];
+                    const float R2y = R2z - dy*dy;
+                    int i0 = d0[0], i1 = d1[0];
+                    while(!within(i0, 0, R2y)) i0++;
+                    while(!within(i1, 0, R2y)) i1--;
+                    assert(i0 >= -128 && i1 <= 127 && j >= -128 && j <= 127
+                                      && k >= -128 && k <= 127);
+                    cell_list.push_back(CellRange(i0,i1,j,k));
+                }
+            }
+            end_list(cell_list);
+            // Along periodic axes, no far cell may be visited twice.
+            for(int a=0; a<3; a++)
+                assert(far.bc[a] != BC_PERIODIC || stencil_span(cell_list, a) <= far.n[a]);
+            return cell_list;
+        }
+
+      private:
+        // Append the end-terminator, padded to a multiple of CELL_LIST_PAD.
+        static void end_list(std::vector<CellRange> &cell_list) {
             cell_list.push_back(CellRange(1,0,0,0)); // end-terminator
             if(cell_list.size()%CELL_LIST_PAD != 0) {
               for(int k = cell_list.size()%CELL_LIST_PAD; k<CELL_LIST_PAD; k++) { // pad to end of warp size
                 cell_list.push_back(CellRange(1,0,0,0)); // end-terminator
               }
             }
-            return cell_list;
         }
     };
 
     /** Load atom information from cell index `far' into
         the buffers n, x, y, z
+
+        Returns whether `far' is the cell `bin' this block works on.
      */
     ALPAKA_NO_HOST_ACC_WARNING
     template<typename TAcc>
     ALPAKA_FN_ACC inline int load_cell(TAcc const& acc,
                     const Cell *X, const unsigned int fbin,
-                    CellTranspose &far) {
-        auto const bin(alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0u]); // blockIdx.x
+                    CellTranspose &far, const unsigned int bin) {
         auto const idx(alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0u]); // threadIdx.x
+        auto const threads(alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0u]);
 
         const Cell &A = X[fbin];
-        far.n[idx] = A.n[idx];
-        far.x[idx] = A.x[idx];
-        far.y[idx] = A.y[idx];
-        far.z[idx] = A.z[idx];
+        for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+            far.n[m] = A.n[m];
+            far.x[m] = A.x[m];
+            far.y[m] = A.y[m];
+            far.z[m] = A.z[m];
+        }
         return fbin == bin;
     }
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC inline int load_cell(TAcc const& acc,
+                    const Cell *X, const unsigned int fbin,
+                    CellTranspose &far) {
+        auto const bin(alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0u]); // blockIdx.x
+        return load_cell(acc, X, fbin, far, bin);
+    }
+
+    /** Atom slots of a cell held by each thread of a cell kernel
+     *  running on TAcc, fixed at compile time so they can live in
+     *  registers.  CPU backends have a warp size of 1, so their one
+     *  thread per block walks every slot of the cell, as alpaka's
+     *  element level.  Other backends run one thread per slot.
+     *
+     *  Thread t holds slots t + e*threads, for e < cell_elems().
+     */
+    template <typename TAcc>
+    constexpr uint32_t cell_elems() {
+        return std::is_same<alpaka::Dev<TAcc>, alpaka::DevCpu>::value ? ATOMS_PER_CELL : 1;
+    }
+
+    /** Work division used by all cell kernels:
+     *  one warp (up to ATOMS_PER_CELL threads) per block,
+     *  each thread covering ATOMS_PER_CELL/threads slots.
+     *
+     *  There is one block per cell, unless per_block > 1.
+     *  Blocks then stride over the cells (see mk1Body, mk2Body
+     *  and mkSorter), and only kernels written for it may be
+     *  launched this way.
+     */
+    template <typename Dim, typename Idx, typename Dev>
+    alpaka::WorkDivMembers<Dim, Idx> cellWorkDiv(const Dev &devAcc, Idx ncells, Idx per_block = 1) {
+        using Vec = alpaka::Vec<Dim,Idx>;
+
+        Idx const warpExtent  = alpaka::getWarpSize(devAcc);
+        // min of 2
+        Idx const threads = warpExtent < ATOMS_PER_CELL ?
+                            warpExtent : ATOMS_PER_CELL;
+
+        return alpaka::WorkDivMembers<Dim, Idx>{
+                    Vec::all((ncells + per_block - 1)/per_block),
+                    Vec::all(threads),
+                    Vec::all((ATOMS_PER_CELL + threads - 1)/threads)};
+    }
 }
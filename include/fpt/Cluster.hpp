@@ -0,0 +1,293 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cassert>
+#include <vector>
+
+// label of an empty slot
+#define CLUSTER_NONE 0xFFFFFFFFu
+
+namespace fpt {
+
+/** Root of the set holding slot s, halving the path on the way.
+ *  Only non-roots are written, and always to one of their own
+ *  ancestors, so concurrent finds and unites stay consistent.
+ */
+ALPAKA_FN_HOST_ACC inline uint32_t cluster_find(uint32_t *parent, uint32_t s) {
+    uint32_t p = parent[s];
+    while(p != s) {
+        const uint32_t g = parent[p];
+        if(g != p) parent[s] = g;
+        s = p;
+        p = g;
+    }
+    return s;
+}
+
+/** Join the sets of slots a and b, lock-free.
+ *  The larger root is hooked onto the smaller with a CAS,
+ *  retrying from the new roots if another thread got there first.
+ */
+template <typename TAcc>
+ALPAKA_FN_ACC inline void cluster_unite(TAcc const &acc, uint32_t *parent, uint32_t a, uint32_t b) {
+    a = cluster_find(parent, a);
+    b = cluster_find(parent, b);
+    while(a != b) {
+        const uint32_t hi = a > b ? a : b;
+        const uint32_t lo = a > b ? b : a;
+        const uint32_t old = alpaka::atomicOp<alpaka::AtomicCas>(acc, &parent[hi], hi, lo);
+        if(old == hi) return;
+        a = cluster_find(parent, old);
+        b = cluster_find(parent, lo);
+    }
+}
+
+/** Start every occupied slot as its own cluster, and zero sizes.
+ *  Slots are numbered cell*ATOMS_PER_CELL + m.
+ */
+struct ClusterInitKernel {
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const Cell *__restrict__ X,
+                uint32_t *__restrict__ const parent,
+                uint32_t *__restrict__ const size
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < count; b += blocks) {
+            for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+                const uint32_t s = b*ATOMS_PER_CELL + m;
+                parent[s] = X[b].n[m] != 0 ? s : CLUSTER_NONE;
+                size[s] = 0;
+            }
+        }
+    }
+};
+
+/** Unite every pair of atoms closer than R.
+ *
+ *  Each thread holds cell_elems() home atoms and walks the
+ *  stencil of list_cells(R), shifting atoms across periodic walls
+ *  to the nearest image.  A pair is united from its lower slot only.
+ */
+template <typename Vec>
+struct ClusterLinkKernel {
+    float R2;       // squared bond distance
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const BoxCells cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ X,
+                uint32_t *__restrict__ const parent
+                ) const {
+        constexpr uint32_t E = cell_elems<TAcc>();
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+
+        for(uint32_t bin = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; bin < count; bin += blocks) {
+            uint32_t bn[E];
+            float bx[E], by[E], bz[E];
+            for(uint32_t e = 0; e < E; e++) {
+                const uint32_t j = idx + e*threads;
+                const bool in = j < ATOMS_PER_CELL;
+                bn[e] = in ? X[bin].n[j] : 0;
+                bx[e] = in ? X[bin].x[j] : 0.0f;
+                by[e] = in ? X[bin].y[j] : 0.0f;
+                bz[e] = in ? X[bin].z[j] : 0.0f;
+            }
+
+            int bi, bj, bk;
+            cells.decode(bin, bi, bj, bk);
+            int r = 0; // current row of nbr
+            CellRange off = nbr[0];
+            while(next_row(cells, nbr, r, bi, bj, bk, off)) {
+                const float sy = cells.image(bj + off.j, 1);
+                const float sz = cells.image(bk + off.k, 2);
+                const uint32_t start = cells.row(bj, bk, off);
+                for(int di = off.i0; di <= off.i1; di++) {
+                    const float sx = cells.image(bi + di, 0);
+                    const uint32_t fbin = cells.col(start, bi, di);
+                    const Cell &A = X[fbin];
+                    for(int m = 0; m < ATOMS_PER_CELL; m++) {
+                        if(A.n[m] == 0) continue;
+                        const uint32_t f = fbin*ATOMS_PER_CELL + m;
+                        const float ax = A.x[m] + sx, ay = A.y[m] + sy, az = A.z[m] + sz;
+                        for(uint32_t e = 0; e < E; e++) {
+                            const uint32_t s = bin*ATOMS_PER_CELL + idx + e*threads;
+                            if(bn[e] == 0 || f <= s) continue;
+                            const float d2 = SQR(bx[e]-ax) + SQR(by[e]-ay) + SQR(bz[e]-az);
+                            if(d2 < R2)
+                                cluster_unite(acc, parent, s, f);
+                        }
+                    }
+                }
+                r++;
+            }
+        }
+    }
+};
+
+/** Point every occupied slot at its root, and count the
+ *  atoms of each cluster into size[root].
+ */
+struct ClusterFlattenKernel {
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                uint32_t *__restrict__ const parent,
+                uint32_t *__restrict__ const size
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < count; b += blocks) {
+            for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+                const uint32_t s = b*ATOMS_PER_CELL + m;
+                if(parent[s] == CLUSTER_NONE) continue;
+                const uint32_t root = cluster_find(parent, s);
+                parent[s] = root;
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &size[root], uint32_t(1));
+            }
+        }
+    }
+};
+
+/** Add every cluster to hist[min(size, max_size)].
+ */
+struct ClusterHistKernel {
+    uint32_t count;    // cells to stride over
+    uint32_t max_size; // last bin of hist
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const uint32_t *__restrict__ parent,
+                const uint32_t *__restrict__ size,
+                uint32_t *__restrict__ const hist
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < count; b += blocks) {
+            for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+                const uint32_t s = b*ATOMS_PER_CELL + m;
+                if(parent[s] != s) continue;
+                const uint32_t k = size[s] < max_size ? size[s] : max_size;
+                alpaka::atomicOp<alpaka::AtomicAdd>(acc, &hist[k], uint32_t(1));
+            }
+        }
+    }
+};
+
+/** Clusters of atoms linked by bonds shorter than R,
+ *  found on the device with a parallel union-find.
+ *
+ *  After enqueue(), labels()[slot] is the lowest slot of the
+ *  cluster holding the atom in that slot (CLUSTER_NONE for
+ *  empty slots), and sizes() the histogram of cluster sizes.
+ *
+ *    fpt::Clusters<Acc> cl(devAcc, srt, 1.5f);
+ *    auto nbr = srt.list_cells(1.5f);   // copied to nbr_d on the device
+ *    cl.enqueue(queue, nbr_d, X);
+ *    auto hist = cl.sizes(queue);       // hist[k] = clusters of k atoms
+ *
+ *  R must be below half the box along periodic axes, so that no
+ *  cell of the stencil is visited twice.  Labels and sizes take
+ *  two words per atom slot.
+ */
+template <typename Acc>
+class Clusters {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using IdxBuf = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
+
+        const Dev &devAcc;
+        const CellSorter srt;
+        const float R;
+        const uint32_t max_size; // larger clusters share the last bin
+
+        Clusters(const Dev &devAcc_, const CellSorter &srt_, const float R_,
+                 const uint32_t max_size_ = 256)
+            : devAcc(devAcc_), srt(srt_), R(R_), max_size(max_size_)
+            , parent( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(srt_.cells)*ATOMS_PER_CELL)} )
+            , size( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(srt_.cells)*ATOMS_PER_CELL)} )
+            , hist( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(max_size_+1))} ) {
+            // Slots must fit in 32 bits, below CLUSTER_NONE.
+            assert( uint64_t(srt.cells)*ATOMS_PER_CELL < uint64_t(CLUSTER_NONE) );
+            // The grid must not be sheared.
+            assert( srt.L[3] == 0.0 && srt.L[4] == 0.0 && srt.L[5] == 0.0 );
+            const auto nbr = srt.list_cells(R);
+            for(int a = 0; a < 3; a++)
+                assert( srt.bc[a] != BC_PERIODIC || 2*stencil_extent(nbr, a) + 1 <= srt.n[a] );
+        }
+
+        /** Label the clusters of X (sorted on srt).
+         *  nbr must hold srt.list_cells(R).
+         */
+        template <typename Queue>
+        void enqueue(Queue &Q, const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+                     const alpaka::Buf<Dev, Cell, Dim, Idx> &X) {
+            Idx const ncells = srt.cells;
+            assert( alpaka::extent::getExtent<0>(X) == ncells );
+            auto const div1 = cellWorkDiv<Dim,Idx>(devAcc, ncells,
+                                                   launch_cells<Acc>(devAcc, "1body", ncells));
+            auto const div2 = cellWorkDiv<Dim,Idx>(devAcc, ncells,
+                                                   launch_cells<Acc>(devAcc, "2body", ncells));
+
+            alpaka::memset(Q, hist, 0, Idx(max_size+1));
+            alpaka::exec<Acc>(Q, div1, ClusterInitKernel{uint32_t(ncells)},
+                              alpaka::getPtrNative(X), alpaka::getPtrNative(parent),
+                              alpaka::getPtrNative(size));
+            alpaka::exec<Acc>(Q, div2, ClusterLinkKernel<Vec>{R*R, uint32_t(ncells)},
+                              BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
+                              alpaka::getPtrNative(X), alpaka::getPtrNative(parent));
+            alpaka::exec<Acc>(Q, div1, ClusterFlattenKernel{uint32_t(ncells)},
+                              alpaka::getPtrNative(parent), alpaka::getPtrNative(size));
+            alpaka::exec<Acc>(Q, div1, ClusterHistKernel{uint32_t(ncells), max_size},
+                              alpaka::getPtrNative(parent), alpaka::getPtrNative(size),
+                              alpaka::getPtrNative(hist));
+        }
+
+        ///! Device-side labels, one per atom slot.
+        const IdxBuf &labels() const {
+            return parent;
+        }
+
+        /** Copy the cluster size histogram to the host.  Waits for Q.
+         *  hist[k] counts clusters of k atoms, and hist[max_size]
+         *  those of max_size or more.
+         */
+        template <typename Queue>
+        std::vector<uint32_t> sizes(Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto h = alpaka::allocBuf<uint32_t, Idx>(devHost, Idx(max_size+1));
+            alpaka::memcpy(Q, h, hist, Idx(max_size+1));
+            alpaka::wait(Q);
+            const uint32_t *p = alpaka::getPtrNative(h);
+            return std::vector<uint32_t>(p, p + max_size+1);
+        }
+
+    private:
+        IdxBuf parent, size, hist;
+};
+
+}
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace fpt {
+
+/** Shift the z-coordinate of every atom in cells
+ *  [0, gridBlocks) of X by dz.
+ */
+struct ShiftCellsKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                Cell *__restrict__ X,
+                const float dz
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        Cell &A = X[alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]];
+
+        for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+            if(A.n[m] != 0)
+                A.z[m] += dz;
+        }
+    }
+};
+
+/** Number of z-layers of ghost cells needed on either
+ *  side of a slab to evaluate the cell list `nbr'.
+ */
+inline int ghost_layers(const std::vector<CellRange> &nbr) {
+    return stencil_extent(nbr, 2);
+}
+
+/** One z-slab of a SlabDecomposition.
+ *
+ *  The slab owns global z-layers [k0, k0+nz).  Its cell lists hold
+ *  `ghost' extra layers below and above those, so local layer l
+ *  is global layer k0 + l - ghost, and all coordinates are stored
+ *  relative to the bottom of the lowest ghost layer.
+ */
+template <typename Acc>
+struct Slab {
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Dev = alpaka::Dev<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::NonBlocking>;
+    using CellBuf = alpaka::Buf<Dev, Cell, Dim, Idx>;
+    using NbrBuf = alpaka::Buf<Dev, CellRange, Dim, Idx>;
+
+    Dev dev;
+    Queue compute;     // sorting and pair kernels
+    Queue comm;        // halo exchange and migration
+    CellSorter srt;    // local grid, including ghost layers
+    int k0, nz, ghost;
+    Idx layer;         // cells per z-layer
+    CellBuf X;         // current cells
+    CellBuf Y;         // sort target, swapped with X by sort()
+    CellBuf stage;     // arriving atoms: [0,ghost) from above, [ghost,2 ghost) from below
+    NbrBuf nbr;
+
+    Slab(const Dev &dev_, const CellSorter &box, int k0_, int nz_, int ghost_,
+         const std::vector<CellRange> &nbr_h)
+        : dev(dev_), compute(dev_), comm(dev_)
+        , srt(box.L[0], box.L[1], box.L[2]/box.n[2]*(nz_ + 2*ghost_),
+              box.n[0], box.n[1], nz_ + 2*ghost_)
+        , k0(k0_), nz(nz_), ghost(ghost_), layer(box.n[0]*box.n[1])
+        , X( CellBuf{alpaka::allocBuf<Cell, Idx>(dev_, Idx(srt.cells))} )
+        , Y( CellBuf{alpaka::allocBuf<Cell, Idx>(dev_, Idx(srt.cells))} )
+        , stage( CellBuf{alpaka::allocBuf<Cell, Idx>(dev_, Idx(2*ghost_)*layer)} )
+        , nbr( NbrBuf{alpaka::allocBuf<CellRange, Idx>(dev_, Idx(nbr_h.size()))} ) {
+        // z is bounded by the ghost layers; neighbors are reached by exchange.
+        srt.set_boundary(box.bc[0], box.bc[1], BC_OPEN);
+        alpaka::memset(compute, X, 0, Idx(srt.cells));
+        alpaka::memset(compute, Y, 0, Idx(srt.cells));
+        alpaka::memset(compute, stage, 0, Idx(2*ghost_)*layer);
+        alpaka::memcpy(compute, nbr, nbr_h, Idx(nbr_h.size()));
+        alpaka::wait(compute);
+    }
+
+    /// First cell of local layer l.
+    Idx cell0(int l) const {
+        return Idx(l)*layer;
+    }
+
+    /// Height of one layer.
+    float hz() const {
+        return srt.L[2]/srt.n[2];
+    }
+};
+
+/** Copy layers [sl, sl+nl) of src into layers [dl, dl+nl) of dst
+ *  and shift the copied atoms by dz.  Enqueued on q, which must
+ *  belong to the device of dst.
+ */
+template <typename Acc, typename Queue, typename Dev, typename Dim, typename Idx>
+void copy_layers(Queue &q, const Dev &dev,
+                 alpaka::Buf<Dev, Cell, Dim, Idx> &dst, int dl,
+                 const alpaka::Buf<Dev, Cell, Dim, Idx> &src, int sl,
+                 int nl, Idx layer, float dz) {
+    using Vec = alpaka::Vec<Dim, Idx>;
+    const Idx count = Idx(nl)*layer;
+    if(count == 0) return;
+
+    alpaka::ViewSubView<Dev, Cell, Dim, Idx> to(dst, Vec::all(count), Vec::all(Idx(dl)*layer));
+    alpaka::ViewSubView<Dev, Cell, Dim, Idx> from(src, Vec::all(count), Vec::all(Idx(sl)*layer));
+    alpaka::memcpy(q, to, from, Vec::all(count));
+
+    alpaka::exec<Acc>(q, cellWorkDiv<Dim,Idx>(dev, count), ShiftCellsKernel{},
+                      alpaka::getPtrNative(dst) + Idx(dl)*layer, dz);
+}
+
+/** Split a CellSorter grid into z-slabs, one per device.
+ *
+ *  Every slab keeps ghost layers deep enough for the cell list
+ *  of cutoff Rc, so the pair kernels never need to look outside
+ *  a slab.  Periodic wrapping in z is done by the halo exchange,
+ *  which moves ghost atoms to their shifted periodic images.
+ *  With an open wall in z, the end slabs are not linked and
+ *  atoms leaving through it are dropped.  Reflecting z walls
+ *  are not supported.
+ *
+ *  Atoms may not move more than one ghost depth in z between
+ *  calls to sort().
+ *
+ *  Devices may repeat, e.g. several slabs on one CPU device.
+ *
+ *  Typical step:
+ *
+ *    dd.sort();                 // re-bin and migrate atoms
+ *    dd.pairs<LJDerivOper>(dE); // exchange halos, overlapped with pair kernels
+ *    ... update positions of the interior cells of each slab ...
+ */
+template <typename Acc>
+class SlabDecomposition {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        template <typename T>
+        using Buf = alpaka::Buf<Dev, T, Dim, Idx>;
+
+        const CellSorter box;
+        const int ghost;
+        std::vector<Slab<Acc>> slabs;
+
+        SlabDecomposition(const CellSorter &box_, const float Rc,
+                          const std::vector<Dev> &devs)
+            : box(box_), ghost(ghost_layers(box_.list_cells(Rc))) {
+            // Sheared boxes would need an x/y shift in the halo exchange.
+            assert(box.L[3] == 0.0 && box.L[4] == 0.0 && box.L[5] == 0.0);
+            assert(box.bc[2] != BC_REFLECT);
+            const auto nbr = box.list_cells(Rc);
+            const int D = devs.size();
+            assert(D > 0);
+
+            int k0 = 0;
+            slabs.reserve(D);
+            for(int d=0; d<D; d++) {
+                const int nz = box.n[2]/D + (d < box.n[2]%D);
+                // Ghost layers must come from the nearest slab.
+                assert(nz >= ghost);
+                slabs.emplace_back(devs[d], box, k0, nz, ghost, nbr);
+                k0 += nz;
+            }
+        }
+
+        /** Bin the atoms in `ncells' host cells into the slabs.
+         *  The cells may be in any order.
+         *
+         *  Returns the number of atoms that did not fit into their cell.
+         */
+        int scatter(const Cell *host, Idx ncells) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            const auto box_d = box.device();
+            const float hz = box.L[2]/box.n[2];
+            int lost = 0;
+
+            std::vector<alpaka::Buf<alpaka::DevCpu, Cell, Dim, Idx>> bufs;
+            std::vector<int> slab_of(box.n[2]);
+            for(size_t d=0; d<slabs.size(); d++) {
+                const auto &s = slabs[d];
+                bufs.emplace_back(alpaka::allocBuf<Cell, Idx>(devHost, Idx(s.srt.cells)));
+                std::memset(alpaka::getPtrNative(bufs.back()), 0, sizeof(Cell)*s.srt.cells);
+                for(int k = s.k0; k < s.k0 + s.nz; k++)
+                    slab_of[k] = d;
+            }
+
+            for(Idx c=0; c<ncells; c++) {
+                for(int m=0; m<ATOMS_PER_CELL; m++) {
+                    if(host[c].n[m] == 0) continue;
+                    const float x = host[c].x[m], y = host[c].y[m], z = host[c].z[m];
+                    int i, j, k;
+                    box_d.decodeBin(box_d.calcBinF(x, y, z), i, j, k);
+                    k = std::min(std::max(k, 0), box.n[2]-1);
+
+                    const int d = slab_of[k];
+                    const auto &s = slabs[d];
+                    const float z0 = (s.k0 - ghost)*hz;
+                    Cell &A = alpaka::getPtrNative(bufs[d])[
+                                    s.srt.device().calcBin(i, j, k - s.k0 + ghost)];
+                    int slot = 0;
+                    while(slot < ATOMS_PER_CELL && A.n[slot] != 0) slot++;
+                    if(slot == ATOMS_PER_CELL) {
+                        lost++;
+                        continue;
+                    }
+                    A.n[slot] = host[c].n[m];
+                    A.x[slot] = x;
+                    A.y[slot] = y;
+                    A.z[slot] = z - z0;
+                }
+            }
+
+            for(size_t d=0; d<slabs.size(); d++) {
+                auto &s = slabs[d];
+                alpaka::memcpy(s.compute, s.X, bufs[d], Idx(s.srt.cells));
+                alpaka::wait(s.compute);
+            }
+            return lost;
+        }
+
+        /** Copy the atoms owned by every slab into the global
+         *  cell array `host' (box.cells long) in global coordinates.
+         */
+        void gather(Cell *host) {
+            const float hz = box.L[2]/box.n[2];
+            gather_out(slabs_X(), host);
+            for(const auto &s : slabs) {
+                const float z0 = (s.k0 - ghost)*hz;
+                for(Idx c = s.k0*s.layer; c < (s.k0 + s.nz)*s.layer; c++) {
+                    for(int m=0; m<ATOMS_PER_CELL; m++) {
+                        if(host[c].n[m] != 0)
+                            host[c].z[m] += z0;
+                    }
+                }
+            }
+        }
+
+        /** Copy the interior part of per-slab outputs, as written by
+         *  pairs(), into the global array `host' (box.cells long).
+         */
+        template <typename T>
+        void gather_out(const std::vector<Buf<T>> &out, T *host) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            assert(out.size() == slabs.size());
+
+            for(size_t d=0; d<slabs.size(); d++) {
+                auto &s = slabs[d];
+                const Idx count = s.nz*s.layer;
+                alpaka::ViewPlainPtr<alpaka::DevCpu, T, Dim, Idx> to(
+                        host + s.k0*s.layer, devHost, Vec::all(count));
+                alpaka::ViewSubView<Dev, T, Dim, Idx> from(
+                        out[d], Vec::all(count), Vec::all(s.cell0(ghost)));
+                alpaka::memcpy(s.compute, to, from, Vec::all(count));
+                alpaka::wait(s.compute);
+            }
+        }
+
+        /** Allocate one output buffer per slab, covering its ghost cells.
+         */
+        template <typename T>
+        std::vector<Buf<T>> alloc_out() const {
+            std::vector<Buf<T>> out;
+            for(const auto &s : slabs)
+                out.emplace_back(alpaka::allocBuf<T, Idx>(s.dev, Idx(s.srt.cells)));
+            return out;
+        }
+
+        /** Re-bin the owned atoms of every slab and migrate atoms
+         *  that left their slab to its neighbor.  On return, X holds
+         *  the sorted atoms and empty ghost layers.
+         */
+        void sort() {
+            const int D = slabs.size();
+            sync();
+
+            for(auto &s : slabs) {
+                alpaka::memset(s.compute, s.Y, 0, Idx(s.srt.cells));
+                const Idx count = s.nz*s.layer;
+                alpaka::exec<Acc>(s.compute, cellWorkDiv<Dim,Idx>(s.dev, count),
+                                  sortAtomsKernel<Vec>{BoxCells{s.srt.device()}, s.cell0(ghost)},
+                                  alpaka::getPtrNative(s.X), alpaka::getPtrNative(s.Y));
+            }
+            sync();
+
+            // Atoms sorted into the ghost layers of Y belong to a neighbor.
+            for(int d=0; d<D; d++) {
+                auto &s = slabs[d];
+                const auto &up = slabs[(d+1)%D];
+                const auto &dn = slabs[(d+D-1)%D];
+                const float hz = s.hz();
+
+                if(has_up(d))
+                    copy_layers<Acc>(s.comm, s.dev, s.stage, 0,
+                                     up.Y, 0, ghost, s.layer, s.nz*hz);
+                if(has_down(d))
+                    copy_layers<Acc>(s.comm, s.dev, s.stage, ghost,
+                                     dn.Y, dn.nz+ghost, ghost, s.layer, -dn.nz*hz);
+            }
+            sync();
+
+            for(auto &s : slabs) {
+                const Idx count = Idx(2*ghost)*s.layer;
+                if(count != 0) {
+                    alpaka::exec<Acc>(s.comm, cellWorkDiv<Dim,Idx>(s.dev, count),
+                                      sortAtomsKernel<Vec>{BoxCells{s.srt.device()}},
+                                      alpaka::getPtrNative(s.stage),
+                                      alpaka::getPtrNative(s.Y));
+                }
+            }
+            sync();
+
+            for(auto &s : slabs) {
+                clear_ghosts(s.compute, s, s.Y);
+                std::swap(s.X, s.Y);
+            }
+            sync();
+        }
+
+        /** Start copying the boundary layers of every slab into
+         *  the ghost layers of its neighbors.  Runs asynchronously
+         *  on the comm queues and only writes ghost cells,
+         *  so kernels reading interior cells may run alongside.
+         */
+        void exchange() {
+            const int D = slabs.size();
+            for(int d=0; d<D; d++) {
+                auto &s = slabs[d];
+                const auto &up = slabs[(d+1)%D];
+                const auto &dn = slabs[(d+D-1)%D];
+                const float hz = s.hz();
+
+                if(has_down(d))
+                    copy_layers<Acc>(s.comm, s.dev, s.X, 0,
+                                     dn.X, dn.nz, ghost, s.layer, -dn.nz*hz);
+                if(has_up(d))
+                    copy_layers<Acc>(s.comm, s.dev, s.X, s.nz+ghost,
+                                     up.X, ghost, ghost, s.layer, s.nz*hz);
+            }
+        }
+
+        /** Run a 2-body operator over the owned cells of every slab.
+         *
+         *  Cells more than one ghost depth away from a slab boundary
+         *  are computed while the halos are exchanged.  The rest
+         *  run once the exchange completes.  Returns without waiting
+         *  for the pair kernels.
+         */
+        template <typename Oper2>
+        void pairs(std::vector<Buf<typename Oper2::Output>> &out) {
+            assert(out.size() == slabs.size());
+            sync();
+
+            for(size_t d=0; d<slabs.size(); d++) {
+                auto &s = slabs[d];
+                if(s.nz > 2*ghost)
+                    run2<Oper2>(s, out[d], 2*ghost, s.nz - 2*ghost);
+            }
+            exchange();
+            for(auto &s : slabs)
+                alpaka::wait(s.comm);
+
+            for(size_t d=0; d<slabs.size(); d++) {
+                auto &s = slabs[d];
+                if(s.nz > 2*ghost) {
+                    run2<Oper2>(s, out[d], ghost, ghost);
+                    run2<Oper2>(s, out[d], s.nz, ghost);
+                } else {
+                    run2<Oper2>(s, out[d], ghost, s.nz);
+                }
+            }
+        }
+
+        /// Wait for all queues of all slabs.
+        void sync() {
+            for(auto &s : slabs) {
+                alpaka::wait(s.compute);
+                alpaka::wait(s.comm);
+            }
+        }
+
+    private:
+        /// Whether slab d exchanges atoms with the slab above it.
+        bool has_up(const int d) const {
+            return d+1 < int(slabs.size()) || box.bc[2] == BC_PERIODIC;
+        }
+
+        /// Whether slab d exchanges atoms with the slab below it.
+        bool has_down(const int d) const {
+            return d > 0 || box.bc[2] == BC_PERIODIC;
+        }
+
+        std::vector<Buf<Cell>> slabs_X() const {
+            std::vector<Buf<Cell>> X;
+            for(const auto &s : slabs)
+                X.push_back(s.X);
+            return X;
+        }
+
+        template <typename Queue>
+        void clear_ghosts(Queue &q, Slab<Acc> &s, Buf<Cell> &buf) {
+            const Idx count = Idx(ghost)*s.layer;
+            if(count == 0) return;
+            alpaka::ViewSubView<Dev, Cell, Dim, Idx> lo(buf, Vec::all(count), Vec::all(Idx(0)));
+            alpaka::ViewSubView<Dev, Cell, Dim, Idx> hi(buf, Vec::all(count),
+                                                        Vec::all(s.cell0(s.nz + ghost)));
+            alpaka::memset(q, lo, 0, Vec::all(count));
+            alpaka::memset(q, hi, 0, Vec::all(count));
+        }
+
+        /// Enqueue Oper2 on local layers [l0, l0+nl) of slab s.
+        template <typename Oper2>
+        void run2(Slab<Acc> &s, Buf<typename Oper2::Output> &out, int l0, int nl) {
+            const Idx count = Idx(nl)*s.layer;
+            if(count == 0) return;
+            alpaka::exec<Acc>(s.compute, cellWorkDiv<Dim,Idx>(s.dev, count),
+                              Oper2Kernel<Oper2,Vec>{s.cell0(l0)},
+                              BoxCells{s.srt.device()}, alpaka::getPtrNative(s.nbr),
+                              alpaka::getPtrNative(s.X), alpaka::getPtrNative(out));
+        }
+};
+
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Singles.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cassert>
+#include <vector>
+
+namespace fpt {
+
+/** Cell indexing for one replica of an Ensemble, whose
+ *  cells start at `base' in the packed buffer.
+ *  Local block b works on cell base + b.
+ */
+struct ReplicaCells : BoxCells {
+    uint32_t base;
+
+    ALPAKA_FN_HOST_ACC
+    ReplicaCells(const CellSorter_d &srt_, const uint32_t base_)
+        : BoxCells{srt_}, base(base_) {}
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t home(const uint32_t block) const {
+            return base + block;
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        void decode(const uint32_t bin, int &i, int &j, int &k) const {
+            srt.decodeBin(bin - base, i, j, k);
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t row(const int j, const int k, const CellRange off) const {
+            return base + BoxCells::row(j, k, off);
+    }
+
+    template <typename TAcc>
+    ALPAKA_FN_ACC inline
+        uint32_t target(TAcc const &acc, float x, float y, float z, bool valid) const {
+            return base + srt.calcBinF(x, y, z);
+    }
+};
+
+/** Device side of Ensemble.
+ *
+ *  Replica r owns cells [first[r], first[r+1]) and
+ *  stencil rows starting at nbr + nbr_first[r].
+ */
+struct EnsembleCells {
+    const CellSorter_d *geom;
+    const uint32_t *first;
+    const CellRange *nbr;
+    const uint32_t *nbr_first;
+    uint32_t replicas;
+
+    /// Replica holding packed cell (or block) b.
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t replica(const uint32_t b) const {
+            uint32_t lo = 0, hi = replicas; // first[lo] <= b < first[hi]
+            while(hi - lo > 1) {
+                const uint32_t mid = (lo + hi)/2;
+                if(first[mid] <= b) lo = mid;
+                else hi = mid;
+            }
+            return lo;
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        ReplicaCells cells(const uint32_t r) const {
+            return ReplicaCells(geom[r], first[r]);
+    }
+};
+
+/** Run the cell() of a sorting or 2-body kernel for every
+ *  packed cell of an Ensemble, with the indexing of the replica
+ *  it belongs to.  Block b works on packed cells b, b + blocks, ...
+ *  below count (one per launched block if count is 0), and finds
+ *  the replica of each from its index.
+ *
+ *  Sorting:  operator()(acc, ens, X, Y)
+ *  Pairs:    operator()(acc, ens, X, out)
+ */
+template <typename Body>
+struct EnsembleKernel {
+    Body body;
+    uint32_t count = 0; // packed cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename Out>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const EnsembleCells ens,
+                const Cell *__restrict__ X,
+                Out *__restrict__ const out
+                ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const uint32_t n = count != 0 ? count : blocks;
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < n; b += blocks) {
+            const uint32_t r = ens.replica(b);
+            run(acc, body, ens, r, X, out, b - ens.first[r]);
+        }
+    }
+
+  private:
+    template<typename TAcc, typename Vec>
+    static ALPAKA_FN_ACC void run(TAcc const &acc, const sortAtomsKernel<Vec,ReplicaCells> &K,
+                                  const EnsembleCells &ens, const uint32_t r,
+                                  const Cell *X, Cell *Y, const uint32_t block) {
+        K.cell(acc, ens.cells(r), X, Y, block);
+    }
+
+    template<typename TAcc, typename Oper2, typename Vec>
+    static ALPAKA_FN_ACC void run(TAcc const &acc, const Oper2Kernel<Oper2,Vec,ReplicaCells> &K,
+                                  const EnsembleCells &ens, const uint32_t r, const Cell *X,
+                                  typename Oper2::Output *out, const uint32_t block) {
+        K.cell(acc, ens.cells(r), ens.nbr + ens.nbr_first[r], X, X, out, block);
+    }
+};
+
+/** Many small, independent systems run as one.
+ *
+ *  Replica r has its own CellSorter geometry, and its cells
+ *  are packed into one buffer of `cells' cells, starting at
+ *  offset(r).  Atoms never move between replicas, and pairs
+ *  are only found within a replica.  Every kernel is launched
+ *  once for the whole ensemble, over all packed cells,
+ *  so hundreds of replicas of a few thousand atoms fill the
+ *  device like one large box.
+ *
+ *  Positions are stored in the frame of their replica's box.
+ *  1-body kernels do not need the geometry, so the plain
+ *  mk1Body(devAcc, X, out) covers every replica.
+ */
+template <typename Acc>
+class Ensemble {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        template <typename T>
+        using Buf = alpaka::Buf<Dev, T, Dim, Idx>;
+
+        const std::vector<CellSorter> boxes;
+        const Idx replicas;
+        const Idx cells; // packed cells of all replicas
+
+        /// Ensemble of the given replicas, with pair cutoff Rc.
+        template <typename Queue>
+        Ensemble(const Dev &devAcc, const std::vector<CellSorter> &boxes_, const float Rc, Queue &Q)
+            : boxes(boxes_), replicas(boxes_.size()), cells(count(boxes_))
+            , geom( Buf<CellSorter_d>{alpaka::allocBuf<CellSorter_d, Idx>(devAcc, replicas)} )
+            , first( Buf<uint32_t>{alpaka::allocBuf<uint32_t, Idx>(devAcc, replicas+1)} )
+            , nbr_first( Buf<uint32_t>{alpaka::allocBuf<uint32_t, Idx>(devAcc, replicas)} )
+            , nbr( Buf<CellRange>{alpaka::allocBuf<CellRange, Idx>(devAcc, stencils(boxes_, Rc))} ) {
+            assert(replicas > 0);
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+
+            std::vector<CellSorter_d> g;
+            std::vector<CellRange> rows;
+            std::vector<uint32_t> nf;
+            first_h.assign(1, 0);
+            for(const auto &box : boxes) {
+                g.push_back(box.device());
+                first_h.push_back(first_h.back() + box.cells);
+                nf.push_back(rows.size());
+                const auto lst = box.list_cells(Rc);
+                rows.insert(rows.end(), lst.begin(), lst.end());
+            }
+
+            alpaka::ViewPlainPtr<alpaka::DevCpu, CellSorter_d, Dim, Idx> vg(
+                    g.data(), devHost, replicas);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vfirst(
+                    first_h.data(), devHost, replicas+1);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vnf(
+                    nf.data(), devHost, replicas);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, CellRange, Dim, Idx> vrows(
+                    rows.data(), devHost, Idx(rows.size()));
+            alpaka::memcpy(Q, geom, vg, replicas);
+            alpaka::memcpy(Q, first, vfirst, replicas+1);
+            alpaka::memcpy(Q, nbr_first, vnf, replicas);
+            alpaka::memcpy(Q, nbr, vrows, Idx(rows.size()));
+            alpaka::wait(Q);
+        }
+
+        /// First packed cell of replica r.
+        Idx offset(const Idx r) const {
+            return first_h[r];
+        }
+
+        ///! Return the device-side indexing.
+        EnsembleCells device() const {
+            return EnsembleCells{alpaka::getPtrNative(geom), alpaka::getPtrNative(first),
+                                 alpaka::getPtrNative(nbr), alpaka::getPtrNative(nbr_first),
+                                 uint32_t(replicas)};
+        }
+
+    private:
+        Buf<CellSorter_d> geom;
+        Buf<uint32_t> first;
+        Buf<uint32_t> nbr_first;
+        Buf<CellRange> nbr;
+        std::vector<uint32_t> first_h;
+
+        static Idx count(const std::vector<CellSorter> &boxes) {
+            Idx n = 0;
+            for(const auto &box : boxes)
+                n += box.cells;
+            return n;
+        }
+
+        static Idx stencils(const std::vector<CellSorter> &boxes, const float Rc) {
+            Idx n = 0;
+            for(const auto &box : boxes)
+                n += box.list_cells(Rc).size();
+            return n;
+        }
+};
+
+/** Return a kernel sorting the atoms of every replica
+ *  in X into Y.  Y must have been zeroed beforehand.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkSorter(const Dev &devAcc, const Ensemble<Acc> &ens,
+              const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(X) == ens.cells );
+    assert( alpaka::extent::getExtent<0>(Y) == ens.cells );
+
+    Idx const per = launch_cells<Acc>(devAcc, "sort", ens.cells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, ens.cells, per);
+
+    std::cout << "Creating sorting kernel for " << ens.replicas << " replicas ("
+              << ens.cells << " cells).\n";
+    // The kernel's own indexing is unused: each block gets its replica's.
+    sortAtomsKernel<Vec,ReplicaCells> body{ReplicaCells(ens.boxes[0].device(), 0)};
+    return alpaka::createTaskKernel<Acc>(workDiv, EnsembleKernel<decltype(body)>{body, uint32_t(ens.cells)},
+                ens.device(), alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+}
+
+/** Create a 2-body operation over every replica.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const Ensemble<Acc> &ens,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(X) == ens.cells );
+    assert( alpaka::extent::getExtent<0>(out) == ens.cells );
+
+    Idx const per = launch_cells<Acc>(devAcc, "2body", ens.cells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, ens.cells, per);
+
+    std::cout << "Creating 2-body kernel for " << ens.replicas << " replicas ("
+              << ens.cells << " cells).\n";
+    Oper2Kernel<Oper2,Vec,ReplicaCells> body{};
+    return alpaka::createTaskKernel<Acc>(workDiv, EnsembleKernel<decltype(body)>{body, uint32_t(ens.cells)},
+                ens.device(), alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cassert>
+#include <vector>
+
+namespace fpt {
+
+/** Cell indexing on a grid padded with ghost cells.
+ *
+ *  The owned cells are surrounded by g[a] layers of ghost cells
+ *  along each axis, which hold shifted periodic images of the
+ *  owned atoms.  Neighbor cells are then found by direct strided
+ *  indexing.  Coordinates are measured from the corner of the
+ *  padded grid.
+ */
+struct HaloCells {
+    CellSorter_d srt; // padded grid
+    int g[3];         // ghost cells on each side
+    int n[3];         // owned cells per axis
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t home(const uint32_t block) const {
+            const int i = block % n[0];
+            const int j = (block/n[0]) % n[1];
+            const int k = block/(n[0]*n[1]);
+            return srt.calcBin(i+g[0], j+g[1], k+g[2]);
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        void decode(const uint32_t bin, int &i, int &j, int &k) const {
+            srt.decodeBin(bin, i, j, k);
+    }
+
+    /// Ghost cells cover the whole stencil, so nothing is clipped.
+    ALPAKA_FN_HOST_ACC inline
+        bool clip(const int i, const int j, const int k, CellRange &off) const {
+            return true;
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t row(const int j, const int k, const CellRange off) const {
+            return srt.calcBin(0, j+off.j, k+off.k);
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t col(const uint32_t start, const int i, const int di) const {
+            return start + i + di;
+    }
+
+    /// Ghost cells already hold shifted images.
+    ALPAKA_FN_HOST_ACC inline
+        float image(const int u, const int a) const {
+            return 0.0f;
+    }
+
+    /// Fold a position that left the owned cells back inside.
+    ALPAKA_FN_HOST_ACC inline
+        bool wrap(float &x, float &y, float &z) const {
+            fold(x, 0);
+            fold(y, 1);
+            fold(z, 2);
+            return true;
+    }
+
+    template <typename TAcc>
+    ALPAKA_FN_ACC inline
+        uint32_t target(TAcc const &acc, float x, float y, float z, bool valid) const {
+            return srt.calcBinF(x, y, z);
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        void fold(float &x, const int a) const {
+            const float lo = g[a]*srt.h[a];
+            const float L = n[a]*srt.h[a];
+            if(x < lo) x += L;
+            if(x >= lo + L) x -= L;
+    }
+};
+
+/** Copy periodic images of the owned cells into every ghost
+ *  cell of X, shifting their coordinates by the image offset.
+ *  Blocks stride over the padded cells.
+ */
+struct HaloFillKernel {
+    uint32_t count = 0; // blocks to stride over, 0 for one per launched block
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const HaloCells cells,
+                Cell *__restrict__ X
+                ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const uint32_t n = count != 0 ? count : blocks;
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < n; b += blocks)
+            cell(acc, cells, X, b);
+    }
+
+    /// Fill padded cell bin, with all threads of the block.
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void cell(
+                TAcc const& acc,
+                const HaloCells cells,
+                Cell *__restrict__ X,
+                const uint32_t bin
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+
+        int p[3], s[3];
+        cells.decode(bin, p[0], p[1], p[2]);
+        bool owned = true;
+        for(int a=0; a<3; a++) {
+            const int n = cells.n[a];
+            s[a] = ((p[a] - cells.g[a])%n + n)%n + cells.g[a];
+            owned = owned && s[a] == p[a];
+        }
+        if(owned) return;
+
+        const float dx = (p[0]-s[0])*cells.srt.h[0];
+        const float dy = (p[1]-s[1])*cells.srt.h[1];
+        const float dz = (p[2]-s[2])*cells.srt.h[2];
+        const Cell &A = X[cells.srt.calcBin(s[0], s[1], s[2])];
+        Cell &B = X[bin];
+        for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+            B.n[m] = A.n[m];
+            B.x[m] = A.x[m] + dx;
+            B.y[m] = A.y[m] + dy;
+            B.z[m] = A.z[m] + dz;
+        }
+    }
+};
+
+/** A periodic CellSorter grid padded with ghost cells deep
+ *  enough for a cell list.
+ *
+ *  Cell buffers for this grid have pad.cells entries, and atom
+ *  coordinates are offset by origin(a) from those in `box'.
+ *
+ *  Each step:
+ *
+ *    zero Y, then enqueue mkSorter(devAcc, grid, X, Y) // sort owned cells, wrap escapees
+ *    enqueue mkHaloFill(devAcc, grid, Y)               // refresh ghost cells
+ *    enqueue mk2Body<Oper2,...>(devAcc, grid, nbr, Y, out)
+ */
+struct HaloGrid {
+    const CellSorter box; // owned cells
+    const int g[3];       // ghost cells on each side of every axis
+    const CellSorter pad; // owned and ghost cells
+
+    HaloGrid(const CellSorter &box_, const float Rc)
+        : HaloGrid(box_, box_.list_cells(Rc)) {}
+
+    HaloGrid(const CellSorter &box_, const std::vector<CellRange> &nbr)
+        : box(box_)
+        , g{stencil_extent(nbr, 0), stencil_extent(nbr, 1), stencil_extent(nbr, 2)}
+        , pad(box_.L[0] + 2*g[0]*box_.L[0]/box_.n[0],
+              box_.L[1] + 2*g[1]*box_.L[1]/box_.n[1],
+              box_.L[2] + 2*g[2]*box_.L[2]/box_.n[2],
+              box_.n[0] + 2*g[0], box_.n[1] + 2*g[1], box_.n[2] + 2*g[2]) {
+        // Sheared boxes would need an x/y shift on the images.
+        assert(box.L[3] == 0.0 && box.L[4] == 0.0 && box.L[5] == 0.0);
+        // Only periodic walls have images.
+        for(int a=0; a<3; a++)
+            assert(box.bc[a] == BC_PERIODIC);
+        // Ghost cells must be images of owned cells, not of other ghosts.
+        for(int a=0; a<3; a++)
+            assert(g[a] <= box.n[a]);
+    }
+
+    /// Offset of owned coordinates along axis a.
+    float origin(const int a) const {
+        return g[a]*box.L[a]/box.n[a];
+    }
+
+    ///! Return device-accessible indexing.
+    HaloCells device() const {
+        return HaloCells{pad.device(),
+                         {g[0], g[1], g[2]},
+                         {box.n[0], box.n[1], box.n[2]}};
+    }
+};
+
+/* Return a kernel sorting the owned cells of X into Y.
+ * Atoms that left the owned cells are wrapped back inside.
+ * Y must have been zeroed beforehand.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkSorter(const Dev &devAcc,
+              const HaloGrid &grid,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    assert( alpaka::extent::getExtent<0>(X) == grid.pad.cells );
+
+    // One warp per thread block, striding over `per' cells
+    Idx const count = grid.box.cells;
+    Idx const per = launch_cells<Acc>(devAcc, "sort", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating sorting kernel for " << count << " cells.\n";
+    sortAtomsKernel<Vec, HaloCells> K{grid.device(), 0, nullptr, uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+}
+
+/* Return a kernel filling the ghost cells of X.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkHaloFill(const Dev &devAcc,
+                const HaloGrid &grid,
+                alpaka::Buf<Dev, Cell, Dim, Idx> &X) {
+    assert( alpaka::extent::getExtent<0>(X) == grid.pad.cells );
+
+    Idx const count = grid.pad.cells;
+    Idx const per = launch_cells<Acc>(devAcc, "1body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating halo kernel for " << count << " cells.\n";
+    HaloFillKernel K{uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                grid.device(), alpaka::getPtrNative(X));
+}
+
+/** Create a 2-body operation over the owned cells of a padded grid.
+ *  The ghost cells of X must be filled.  No index wraps, so
+ *  neighbor cells are found without integer division.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const HaloGrid &grid,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(X) == grid.pad.cells );
+    assert( alpaka::extent::getExtent<0>(out) == grid.pad.cells );
+
+    Idx const count = grid.box.cells;
+    Idx const per = launch_cells<Acc>(devAcc, "2body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating 2-body kernel for " << count << " cells.\n";
+    Oper2Kernel<Oper2,Vec,HaloCells> K{0, uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                grid.device(), alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
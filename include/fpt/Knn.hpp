@@ -0,0 +1,275 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+namespace fpt {
+
+/** The K nearest neighbors of one atom slot, nearest first.
+ *  Neighbors are named by slot, cell*ATOMS_PER_CELL + m.
+ *  Every atom closer than `radius' is a candidate, so the list
+ *  is exact if count == K and dist[K-1] <= radius.
+ */
+template <int K>
+struct Neighbors {
+    uint32_t count;      // neighbors found, up to K
+    float radius;        // search radius covered
+    uint32_t slot[K];
+    float dist[K];
+};
+
+/** Stencils of expanding shells around a cell, for kNN searches.
+ *
+ *  Shell s holds the cells of list_cells(radii[s]) missing from
+ *  list_cells(radii[s-1]), each shell ending with a terminator.
+ *  Shells stop before the stencil would wrap onto itself along a
+ *  periodic axis, so no cell is visited twice.  The radii kept are
+ *  returned in `radii'.
+ */
+inline std::vector<CellRange> knn_shells(const CellSorter &srt, std::vector<float> &radii) {
+    std::vector<CellRange> ans;
+    std::vector<CellRange> prev;
+    size_t kept = 0;
+    for(const float R : radii) {
+        std::vector<CellRange> lst = srt.list_cells(R);
+        bool wraps = false;
+        for(int a = 0; a < 3; a++)
+            if(srt.bc[a] == BC_PERIODIC && 2*stencil_extent(lst, a) + 1 > srt.n[a])
+                wraps = true;
+        if(wraps) break;
+
+        for(const auto &r : lst) {
+            if(r.i0 > r.i1) continue; // terminator
+            int p0 = 1, p1 = 0; // part of this row in the last shell
+            for(const auto &q : prev)
+                if(q.i0 <= q.i1 && q.j == r.j && q.k == r.k) {
+                    p0 = q.i0;
+                    p1 = q.i1;
+                }
+            if(p0 > p1) {
+                ans.push_back(r);
+                continue;
+            }
+            if(r.i0 < p0)
+                ans.push_back(CellRange(r.i0, p0-1, r.j, r.k));
+            if(p1 < r.i1)
+                ans.push_back(CellRange(p1+1, r.i1, r.j, r.k));
+        }
+        ans.push_back(CellRange(1,0,0,0)); // end of shell
+        prev = lst;
+        kept++;
+    }
+    radii.resize(kept);
+    return ans;
+}
+
+/** Radii of cells widths 1, 2, 3, ... (of the narrowest
+ *  axis), as many as knn_shells will keep.
+ */
+inline std::vector<float> knn_radii(const CellSorter &srt, const int max_shells = 16) {
+    float h = srt.L[0]/srt.n[0];
+    for(int a = 1; a < 3; a++)
+        h = std::min(h, srt.L[a]/srt.n[a]);
+    std::vector<float> radii;
+    for(int s = 1; s <= max_shells; s++)
+        radii.push_back(s*h);
+    knn_shells(srt, radii);
+    return radii;
+}
+
+/** K nearest neighbors of every atom in X, for K <= 32.
+ *
+ *  Each thread holds cell_elems() home atoms, with a bounded
+ *  max-heap of the K best distances for each.  Shells are scanned
+ *  outward, and a home atom stops once its heap is full and its
+ *  worst distance is within the radius covered.  Across periodic
+ *  walls, atoms are shifted to the nearest image.
+ *
+ *  Block b works on cell b, striding over `count' cells.
+ */
+template <int K, typename Vec>
+struct KnnKernel {
+    static_assert(K >= 1 && K <= 32, "kNN supports 1 <= K <= 32");
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const BoxCells cells,
+                const CellRange *__restrict__ shells,
+                const float *__restrict__ radii,
+                const uint32_t nshells,
+                const Cell *__restrict__ X,
+                Neighbors<K> *__restrict__ const out
+                ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < count; b += blocks)
+            cell(acc, cells, shells, radii, nshells, X, out, b);
+    }
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void cell(
+                TAcc const& acc,
+                const BoxCells &cells,
+                const CellRange *__restrict__ shells,
+                const float *__restrict__ radii,
+                const uint32_t nshells,
+                const Cell *__restrict__ X,
+                Neighbors<K> *__restrict__ const out,
+                const uint32_t bin
+                ) const {
+        constexpr uint32_t E = cell_elems<TAcc>();
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+
+        // home atoms, and a max-heap of squared distances for each
+        uint32_t bn[E];
+        float bx[E], by[E], bz[E];
+        float hd[E][K];
+        uint32_t hs[E][K];
+        uint32_t hn[E];
+        float R = 0.0f;
+        bool done = true;
+        for(uint32_t e = 0; e < E; e++) {
+            const uint32_t j = idx + e*threads;
+            bn[e] = j < ATOMS_PER_CELL ? X[bin].n[j] : 0;
+            bx[e] = j < ATOMS_PER_CELL ? X[bin].x[j] : 0.0f;
+            by[e] = j < ATOMS_PER_CELL ? X[bin].y[j] : 0.0f;
+            bz[e] = j < ATOMS_PER_CELL ? X[bin].z[j] : 0.0f;
+            hn[e] = 0;
+            done = done && bn[e] == 0;
+        }
+
+        int bi, bj, bk;
+        cells.decode(bin, bi, bj, bk);
+        int r = 0; // current row of shells
+        for(uint32_t s = 0; s < nshells && !done; s++) {
+            CellRange off = shells[r];
+            while(next_row(cells, shells, r, bi, bj, bk, off)) {
+                const float sy = cells.image(bj + off.j, 1);
+                const float sz = cells.image(bk + off.k, 2);
+                const uint32_t start = cells.row(bj, bk, off);
+                for(int di = off.i0; di <= off.i1; di++) {
+                    const float sx = cells.image(bi + di, 0);
+                    const uint32_t fbin = cells.col(start, bi, di);
+                    const Cell &A = X[fbin];
+                    for(int m = 0; m < ATOMS_PER_CELL; m++) {
+                        if(A.n[m] == 0) continue;
+                        const float ax = A.x[m] + sx, ay = A.y[m] + sy, az = A.z[m] + sz;
+                        for(uint32_t e = 0; e < E; e++) {
+                            if(bn[e] == 0 || (fbin == bin && m == int(idx + e*threads)))
+                                continue;
+                            const float d2 = SQR(bx[e]-ax) + SQR(by[e]-ay) + SQR(bz[e]-az);
+                            push(hd[e], hs[e], hn[e], d2, fbin*ATOMS_PER_CELL + m);
+                        }
+                    }
+                }
+                r++;
+            }
+            r++; // past the end of shell s
+
+            R = radii[s];
+            done = true;
+            for(uint32_t e = 0; e < E; e++)
+                done = done && (bn[e] == 0 || (hn[e] == K && hd[e][0] <= R*R));
+        }
+
+        for(uint32_t e = 0; e < E; e++) {
+            const uint32_t j = idx + e*threads;
+            if(j >= ATOMS_PER_CELL) continue;
+            Neighbors<K> &o = out[bin*ATOMS_PER_CELL + j];
+            o.count = hn[e];
+            o.radius = R;
+            // pop the largest to the back
+            for(uint32_t c = hn[e]; c > 0; c--) {
+                o.dist[c-1] = sqrtf(hd[e][0]);
+                o.slot[c-1] = hs[e][0];
+                hd[e][0] = hd[e][c-1];
+                hs[e][0] = hs[e][c-1];
+                sift(hd[e], hs[e], c-1);
+            }
+        }
+    }
+
+  private:
+    /// Offer (d2, slot) to a heap of n entries.
+    static ALPAKA_FN_HOST_ACC inline void push(float *hd, uint32_t *hs, uint32_t &n,
+                                               const float d2, const uint32_t slot) {
+        if(n < K) { // sift up
+            uint32_t c = n++;
+            while(c > 0 && hd[(c-1)/2] < d2) {
+                hd[c] = hd[(c-1)/2];
+                hs[c] = hs[(c-1)/2];
+                c = (c-1)/2;
+            }
+            hd[c] = d2;
+            hs[c] = slot;
+        } else if(d2 < hd[0]) {
+            hd[0] = d2;
+            hs[0] = slot;
+            sift(hd, hs, n);
+        }
+    }
+
+    /// Restore the heap order of the first n entries after a new root.
+    static ALPAKA_FN_HOST_ACC inline void sift(float *hd, uint32_t *hs, const uint32_t n) {
+        const float d2 = hd[0];
+        const uint32_t slot = hs[0];
+        uint32_t c = 0;
+        while(2*c + 1 < n) {
+            uint32_t l = 2*c + 1;
+            if(l + 1 < n && hd[l+1] > hd[l]) l++;
+            if(hd[l] <= d2) break;
+            hd[c] = hd[l];
+            hs[c] = hs[l];
+            c = l;
+        }
+        hd[c] = d2;
+        hs[c] = slot;
+    }
+};
+
+/** Create a kNN search over every atom of X (sorted on srt),
+ *  leaving the neighbors of slot m of cell c in
+ *  out[c*ATOMS_PER_CELL + m].  shells and radii come from
+ *  knn_shells(srt, radii), copied to the device.
+ *
+ *    auto radii = fpt::knn_radii(srt);
+ *    auto shells = fpt::knn_shells(srt, radii);   // copy both to the device
+ *    auto K = fpt::mkKnn<8,Acc,Dim,Idx>(devAcc, srt, shells_d, radii_d, X, out);
+ */
+template <int K, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkKnn(const Dev &devAcc, const CellSorter &srt,
+           const alpaka::Buf<Dev, CellRange, Dim, Idx> &shells,
+           const alpaka::Buf<Dev, float, Dim, Idx> &radii,
+           const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+           alpaka::Buf<Dev, Neighbors<K>, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    Idx const ncells = srt.cells;
+    assert( alpaka::extent::getExtent<0>(X) == ncells );
+    assert( alpaka::extent::getExtent<0>(out) == ncells*ATOMS_PER_CELL );
+    // The grid must not be sheared.
+    assert( srt.L[3] == 0.0 && srt.L[4] == 0.0 && srt.L[5] == 0.0 );
+
+    // One warp per thread block, striding over `per' cells
+    Idx const per = launch_cells<Acc>(devAcc, "knn", ncells);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, ncells, per);
+
+    std::cout << "Creating " << K << "-nearest neighbor kernel for " << ncells << " cells.\n";
+    KnnKernel<K,Vec> Kn{uint32_t(ncells)};
+    return alpaka::createTaskKernel<Acc>(workDiv, Kn,
+                BoxCells{srt.device()}, alpaka::getPtrNative(shells),
+                alpaka::getPtrNative(radii), uint32_t(alpaka::extent::getExtent<0>(radii)),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
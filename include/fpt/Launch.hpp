@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <alpaka/alpaka.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <stdint.h>
+
+namespace fpt {
+    /** Cells per block chosen for the kernels made by mk1Body,
+     *  mk2Body and mkSorter, by accelerator, device and kind of
+     *  kernel ("sort", "1body" or "2body").  tune_launch()
+     *  (fpt/Tune.hpp) stores the fastest ones here.
+     */
+    class LaunchCache {
+        public:
+            static LaunchCache &get() {
+                static LaunchCache cache;
+                return cache;
+            }
+
+            template <typename Acc, typename Dev>
+            static std::string key(const Dev &dev, const std::string &kind) {
+                return alpaka::getAccName<Acc>() + "/" + alpaka::getName(dev) + "/" + kind;
+            }
+
+            /// Tuned cells per block, or 0 if key was never tuned.
+            uint32_t find(const std::string &key) const {
+                std::lock_guard<std::mutex> lock(mtx);
+                const auto it = per_block.find(key);
+                return it == per_block.end() ? 0 : it->second;
+            }
+
+            void set(const std::string &key, const uint32_t n) {
+                std::lock_guard<std::mutex> lock(mtx);
+                per_block[key] = n;
+            }
+
+            /// Forget all tuning.
+            void clear() {
+                std::lock_guard<std::mutex> lock(mtx);
+                per_block.clear();
+            }
+
+        private:
+            mutable std::mutex mtx;
+            std::map<std::string, uint32_t> per_block;
+    };
+
+    /** Cells per block for a kernel of the given kind over ncells
+     *  cells.  Tuned values come first.  Otherwise GPUs get one
+     *  cell per block.  On CPU backends a block is only a loop
+     *  iteration, so blocks are made large enough to leave about
+     *  64 per core.
+     */
+    template <typename Acc, typename Dev, typename Idx>
+    Idx launch_cells(const Dev &devAcc, const std::string &kind, const Idx ncells) {
+        const uint32_t n = LaunchCache::get().find(LaunchCache::key<Acc>(devAcc, kind));
+        if(n != 0) return n;
+        if(!std::is_same<Dev, alpaka::DevCpu>::value) return 1;
+        const Idx blocks = 64*std::max(1u, std::thread::hardware_concurrency());
+        return std::max(Idx(1), ncells/blocks);
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace fpt {
+
+/** Cell indexing from the cells of one grid (near) to the
+ *  cells of another grid (srt) over the same box.
+ *
+ *  Block b works on near cell b.  It is decoded to the srt cell
+ *  holding its lower corner, and neighbors are then found on srt
+ *  like in BoxCells.  Use with a stencil from
+ *  near.list_cells(srt, Rc).
+ */
+struct LevelCells : BoxCells {
+    CellSorter_d near; // grid of the home cells
+
+    LevelCells(const CellSorter_d &near_, const CellSorter_d &far_)
+        : BoxCells{far_}, near(near_) {}
+
+    ALPAKA_FN_HOST_ACC inline
+        void decode(const uint32_t bin, int &i, int &j, int &k) const {
+            near.decodeBin(bin, i, j, k);
+            i = i*srt.n[0] / near.n[0];
+            j = j*srt.n[1] / near.n[1];
+            k = k*srt.n[2] / near.n[2];
+    }
+};
+
+/** A box binned twice: fine cells for atoms with a short
+ *  cutoff, and coarse cells for atoms with a long one.
+ *
+ *  Each kind of atom is sorted on its own grid, with its own
+ *  cell buffers.  Every interaction class then scans only the
+ *  volume its cutoff needs:
+ *
+ *    small-small  mk2Body(devAcc, level[FINE], nbr, Xs, out)
+ *    large-large  mk2Body(devAcc, level[COARSE], nbr, Xl, out)
+ *    small-large  mk2Body(devAcc, grid, FINE, COARSE, nbr, Xs, Xl, out)
+ *    large-small  mk2Body(devAcc, grid, COARSE, FINE, nbr, Xl, Xs, out)
+ *
+ *  with nbr = grid.list_cells(home, far, Rc) for the pair's cutoff.
+ *  The cross-level kernels leave the contribution of the far atoms
+ *  on the home atoms, so each side is computed separately.
+ */
+struct LevelGrid {
+    enum Level {FINE = 0, COARSE = 1};
+    const CellSorter level[2];
+
+    LevelGrid(const CellSorter &fine, const CellSorter &coarse)
+        : level{fine, coarse} {
+        for(int a=0; a<3; a++) {
+            assert(fine.L[a] == coarse.L[a]);
+            assert(fine.bc[a] == coarse.bc[a]);
+        }
+    }
+
+    /// Periodic box with cells no smaller than each cutoff.
+    LevelGrid(float Lx, float Ly, float Lz, const float rc_fine, const float rc_coarse)
+        : LevelGrid(sized(Lx, Ly, Lz, rc_fine), sized(Lx, Ly, Lz, rc_coarse)) {}
+
+    /// Stencil for home cells on one level and far cells on another.
+    std::vector<CellRange> list_cells(const Level home, const Level far, const float Rc) const {
+        if(home == far)
+            return level[home].list_cells(Rc);
+        return level[home].list_cells(level[far], Rc);
+    }
+
+    static CellSorter sized(float Lx, float Ly, float Lz, const float Rc) {
+        return CellSorter(Lx, Ly, Lz, std::max(1, int(Lx/Rc)),
+                          std::max(1, int(Ly/Rc)), std::max(1, int(Lz/Rc)));
+    }
+};
+
+/** Create a 2-body operation between the atoms of H, binned on
+ *  level `home', and those of X, binned on level `far'.
+ *  out is indexed like H.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const LevelGrid &grid,
+             const LevelGrid::Level home, const LevelGrid::Level far,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &H,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    const CellSorter &near = grid.level[home];
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(H) == near.cells );
+    assert( alpaka::extent::getExtent<0>(X) == grid.level[far].cells );
+    assert( alpaka::extent::getExtent<0>(out) == near.cells );
+
+    // One warp per thread block, striding over `per' cells
+    Idx const count = near.cells;
+    Idx const per = launch_cells<Acc>(devAcc, "2body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating cross-level 2-body kernel for " << count << " cells.\n";
+    Oper2Kernel<Oper2,Vec,LevelCells> K{0, uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                LevelCells(near.device(), grid.level[far].device()),
+                alpaka::getPtrNative(nbr), alpaka::getPtrNative(H),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
 
 #define SQR(x) ((x)*(x))
 
@@ -89,6 +90,21 @@ struct LJDerivOper {
 
 namespace fpt {
 
+/** Advance r to the next row of nbr that keeps some cells
+ *  after clipping around the home cell (i,j,k), and store
+ *  the clipped row in off.  Returns false at the end of the list.
+ */
+template <typename Cells>
+ALPAKA_FN_HOST_ACC inline bool next_row(const Cells &cells, const CellRange *nbr,
+                                        int &r, const int i, const int j, const int k,
+                                        CellRange &off) {
+    for(off = nbr[r]; off.i0 <= off.i1; off = nbr[++r]) {
+        if(cells.clip(i, j, k, off))
+            return true;
+    }
+    return false;
+}
+
 /**
   Compute a pairwise function by summing over all atoms in a far cell.
   Work is distributed such that every thread is associated with
@@ -97,34 +113,71 @@ namespace fpt {
 
   Loading of data from the `next' far cell is overlapped with computations
   on the `current' far cell.
- 
-  Data Layout Schematic
-  (WARNING: outdated, currently using 1 thread per 'near' atom slot):
-      c0 = blockIdx.x*ATOMS_PER_CELL
-      r0 = blockIdx.y*ATOMS_PER_CELL
-
-              --x--> (a)
-     .              c0, c0+1, ..., c0+ATOMS_PER_CELL
-     y   r0          0    1    ...   31
-     |   r0+1        0    1    ...   31
-     v   ...
-    (b)  r0+ATOMS_PER_CELL 0    1    ...   31
 
+  Atoms of far cells reached across a periodic wall are shifted
+  to the image next to the home cell, by cells.image().
+ 
+  Each thread holds cell_elems() home atoms: one on GPUs,
+  the whole cell on CPU backends.  The loop over home atoms is
+  innermost, so the compiler can vectorize it there.
  */
 // pairFunc
-template <typename Oper2, typename Vec>
+template <typename Oper2, typename Vec, typename Cells = BoxCells>
 struct Oper2Kernel {
+    uint32_t bin0 = 0; // first block, passed to cells.home()
+    uint32_t count = 0; // blocks to stride over, 0 for one per launched block
+    const uint32_t *count_at = nullptr; // if set, stride over *count_at blocks instead
+
     ALPAKA_NO_HOST_ACC_WARNING
     template<typename TAcc>
     ALPAKA_FN_ACC void operator()(
                 TAcc const& acc,
-                const CellSorter_d box,
+                const Cells cells,
                 const CellRange *__restrict__ nbr,
                 const Cell *__restrict__ X,
                 typename Oper2::Output *__restrict__ const out
                 ) const {
-        auto const j = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
-        auto const bin = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        (*this)(acc, cells, nbr, X, X, out);
+    }
+
+    /** Pairs between the atoms of home cells in H and
+     *  those of their neighbor cells in X.  When H and X
+     *  differ (e.g. two grids), no pair is a self-pair.
+     */
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const Cells cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ H,
+                const Cell *__restrict__ X,
+                typename Oper2::Output *__restrict__ const out
+                ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const uint32_t n = count_at != nullptr ? *count_at : count != 0 ? count : blocks;
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < n; b += blocks)
+            cell(acc, cells, nbr, H, X, out, b);
+    }
+
+    /// Work on cell home(bin0 + block), with all threads of the block.
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void cell(
+                TAcc const& acc,
+                const Cells cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ H,
+                const Cell *__restrict__ X,
+                typename Oper2::Output *__restrict__ const out,
+                const uint32_t block
+                ) const {
+        constexpr uint32_t E = cell_elems<TAcc>();
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const bin = cells.home(bin0 + block);
+        // far cell index matching the home cell
+        const uint32_t me = H == X ? uint32_t(bin) : CELL_NONE;
 
         // far cell read repeatedly
         auto& far = alpaka::declareSharedVar<CellTranspose, __COUNTER__>(acc);
@@ -132,80 +185,88 @@ struct Oper2Kernel {
         uint32_t an[ATOMS_PER_CELL];
         float ax[ATOMS_PER_CELL], ay[ATOMS_PER_CELL], az[ATOMS_PER_CELL];
 
-        // atom belonging to this thread
-        uint32_t bn;
-        float bx, by, bz;
+        // atoms belonging to this thread, in slots idx + e*threads
+        uint32_t bn[E];
+        float bx[E], by[E], bz[E];
         int bi, bj, bk;
-        box.decodeBin(bin, bi, bj, bk);
-        // prevent modulo wrapping issues
-        bi += box.n[0]; bj += box.n[1]; bk += box.n[2];
-
-        const Cell &B = X[bin];
-        bn = B.n[j];
-        bx = B.x[j];
-        by = B.y[j];
-        bz = B.z[j];
+        cells.decode(bin, bi, bj, bk);
+
+        const Cell &B = H[bin];
+        for(uint32_t e = 0; e < E; e++) {
+            const uint32_t j = idx + e*threads;
+            const bool in = j < ATOMS_PER_CELL;
+            bn[e] = in ? B.n[j] : 0;
+            bx[e] = in ? B.x[j] : 0.0f;
+            by[e] = in ? B.y[j] : 0.0f;
+            bz[e] = in ? B.z[j] : 0.0f;
+        }
 
-        typename Oper2::Accum ans{};
+        typename Oper2::Accum ans[E] = {};
 
+        int r = 0; // current row of nbr
         CellRange off = nbr[0];
+        bool more = next_row(cells, nbr, r, bi, bj, bk, off);
+        int i = off.i0;
+        unsigned int start = cells.row(bj, bk, off);
+        int self2 = more ? load_cell(acc, X, cells.col(start, bi, i), far, me) : 0;
+        // periodic image shift of the loaded far cell
+        float sx2 = more ? cells.image(bi + i, 0) : 0.0f;
+        float sy2 = more ? cells.image(bj + off.j, 1) : 0.0f;
+        float sz2 = more ? cells.image(bk + off.k, 2) : 0.0f;
+
+        while(more) {
+            alpaka::syncBlockThreads(acc);
+
+            // Copy last far cell
+            const int self = self2;
+            for(int m=0; m<ATOMS_PER_CELL; m++) {
+                an[m] = far.n[m];
+                ax[m] = far.x[m] + sx2;
+                ay[m] = far.y[m] + sy2;
+                az[m] = far.z[m] + sz2;
+            }
+            alpaka::syncBlockThreads(acc);
+
+            // Load next far cell (A) as a group
+            if(i < off.i1) {
+                i++;
+            } else {
+                r++;
+                more = next_row(cells, nbr, r, bi, bj, bk, off);
+                i = off.i0;
+                start = cells.row(bj, bk, off);
+            }
+            if(more) {
+                self2 = load_cell(acc, X, cells.col(start, bi, i), far, me);
+                sx2 = cells.image(bi + i, 0);
+                sy2 = cells.image(bj + off.j, 1);
+                sz2 = cells.image(bk + off.k, 2);
+            }
 
-        unsigned int start = box.calcBin(0, (bj+off.j)%box.n[1], (bk+off.k)%box.n[2]);
-        int self2 = load_cell(acc, X, start + (bi + off.i0)%box.n[0], far);
-
-        for(int k=0; off.i0 <= off.i1; k++) { // offsets define a valid range
-            for(int i = off.i0; i <= off.i1; i++) {
-                alpaka::syncBlockThreads(acc);
-
-                // Copy last far cell
-                const int self = self2;
-                for(int m=0; m<ATOMS_PER_CELL; m++) {
-                    an[m] = far.n[m];
-                    ax[m] = far.x[m];
-                    ay[m] = far.y[m];
-                    az[m] = far.z[m];
+            // Computing only pairs with m > j would be twice as fast,
+            // but needs every far cell visited from one side only.
+            for (int m = 0; m < ATOMS_PER_CELL; m++) {
+                if(an[m] == 0) continue;
+                for(uint32_t e = 0; e < E; e++) {
+                    if(self && m == int(idx + e*threads)) continue;
+
+                    float dx = bx[e] - ax[m];
+                    float dy = by[e] - ay[m];
+                    float dz = bz[e] - az[m];
+                    Oper2::pair(ans[e], dx, dy, dz);
                 }
-                // Load next far cell (A) as a group
-                if(i < off.i1) {
-                    self2 = load_cell(acc, X, start + (bi + i+1)%box.n[0], far);
-                } else {
-                    off = nbr[k+1]; // the old 'off' isn't useful anymore
-                    if(off.i0 <= off.i1) {
-                        start = box.calcBin(0, (bj+off.j)%box.n[1], (bk+off.k)%box.n[2]);
-                        self2 = load_cell(acc, X, start + (bi + off.i0)%box.n[0], far);
-                    }
-                }
-
-                /*if(bn != 0) {
-                    const int i0 = self*(j+1);
-                    for (int i = i0; i < ATOMS_PER_CELL; i++) {
-                        if(an[i] == 0) continue;
-                    //for (int i = 0; i < ATOMS_PER_CELL; i++) { // this code is technically correct,
-                    //    if(i < i0 || an[i] == 0) continue;     // but some compiler transform evaluates ans += nan ...
-                        float r2 = SQR(ax[i]-bx) + SQR(ay[i]-by) + SQR(az[i]-bz);
-                        ans += lj_en(r2); //erfcf(sqrtf(r2));
-                    }}
-                }*/
-                // The loop above would be twice as fast, but should exclude some far cells
-                // and I don't want to bother, since the weird loop starting at i0 makes it buggy / slow!
-                //if(bn != 0) {
-                    for (int m = 0; m < ATOMS_PER_CELL; m++) {
-                        if(an[m] == 0 || self*(m==j)) continue;
-
-                        float dx = bx - ax[m];
-                        float dy = by - ay[m];
-                        float dz = bz - az[m];
-                        Oper2::pair(ans, dx, dy, dz);
-                    }
-                //}
             }
         }
 
-        Oper2::finalize(out[bin], ans, bn, j);
+        for(uint32_t e = 0; e < E; e++) {
+            const uint32_t j = idx + e*threads;
+            if(j < ATOMS_PER_CELL)
+                Oper2::finalize(out[bin], ans[e], bn[e], j);
+        }
     }
 };
 
-/** Create a 2-body operation.
+/** Create a 2-body operation over cells [first, first+count).
  *
  * Oper2 must be a class including members:
  *     type Output = type of output per cell
@@ -222,32 +283,34 @@ struct Oper2Kernel {
 template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
 auto mk2Body(const Dev &devAcc, const CellSorter &srt, const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
              const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
-             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out,
+             Idx first, Idx count) {
     using Vec = alpaka::Vec<Dim,Idx>;
 
-    // Launch with one warp per thread block
-    Idx const warpExtent  = alpaka::getWarpSize(devAcc);
-
     // Spaces must match.
     Idx const ncells = alpaka::extent::getExtent<0>(X);
     assert( ncells == alpaka::extent::getExtent<0>(out) );
+    assert( first + count <= ncells );
 
-    Vec const gridBlockExtent = Vec::all(ncells);
-    // min of 2
-    Vec blockThreadExtent = Vec::all(
-            warpExtent < ATOMS_PER_CELL ?
-            warpExtent : ATOMS_PER_CELL);
-
-    alpaka::WorkDivMembers<Dim, Idx> workDiv{
-                gridBlockExtent,
-                blockThreadExtent,
-                Vec::all(1)};
+    // One warp per thread block, striding over `per' cells
+    Idx const per = launch_cells<Acc>(devAcc, "2body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
 
-    std::cout << "Creating 2-body kernel for " << ncells << " cells.\n";
-    Oper2Kernel<Oper2,Vec> K{};
+    std::cout << "Creating 2-body kernel for " << count << " cells.\n";
+    Oper2Kernel<Oper2,Vec> K{uint32_t(first), uint32_t(count)};
     return alpaka::createTaskKernel<Acc>(workDiv, K,
-                srt.device(), alpaka::getPtrNative(nbr),
+                BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
                 alpaka::getPtrNative(X), alpaka::getPtrNative(out));
 }
 
+/** As above, but run over all cells.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const CellSorter &srt, const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+    Idx const ncells = alpaka::extent::getExtent<0>(X);
+    return mk2Body<Oper2,Acc,Dim,Idx>(devAcc, srt, nbr, X, out, Idx(0), ncells);
+}
+
 }
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/** Raw event codes for packed and scalar floating point
+ *  instructions.  By default these are FP_ARITH_INST_RETIRED
+ *  (packed 128/256/512-bit single, and scalar single), counted
+ *  on Intel CPUs only.  Elsewhere the events read as missing.
+ *  Define them to the codes of other CPUs, or to 0 to disable.
+ */
+#ifndef FPT_PERF_FP_PACKED
+#define FPT_PERF_FP_PACKED (fpt::intel_cpu() ? 0xA8C7 : 0)
+#endif
+#ifndef FPT_PERF_FP_SCALAR
+#define FPT_PERF_FP_SCALAR (fpt::intel_cpu() ? 0x02C7 : 0)
+#endif
+
+/** Bytes moved per last level cache miss, for bytes / work
+ *  estimates.
+ */
+#ifndef FPT_CACHE_LINE
+#define FPT_CACHE_LINE 64
+#endif
+
+namespace fpt {
+
+/// Whether this is an Intel CPU, going by its cpuid vendor.
+inline bool intel_cpu() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+    if(!__get_cpuid(0, &a, &b, &c, &d)) return false;
+    return b == 0x756e6547 && d == 0x49656e69 && c == 0x6c65746e; // "GenuineIntel"
+#else
+    return false;
+#endif
+}
+
+/** Counter values, summed over the threads of the process.
+ *  Events the kernel refused to open are negative.
+ */
+struct PerfSample {
+    enum Event : int {
+        TASK_CLOCK = 0, // ns of CPU time
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,   // last level cache
+        BRANCH_MISSES,
+        FP_PACKED,      // vector FP instructions
+        FP_SCALAR,      // scalar FP instructions
+        EVENTS
+    };
+    double count[EVENTS];
+
+    static const char *name(const int e) {
+        static const char *names[EVENTS] = {"task_clock", "cycles", "instructions",
+                "cache_misses", "branch_misses", "fp_packed", "fp_scalar"};
+        return names[e];
+    }
+
+    /// No counts at all.
+    static PerfSample none() {
+        PerfSample s;
+        for(int e = 0; e < EVENTS; e++)
+            s.count[e] = -1.0;
+        return s;
+    }
+
+    bool has(const int e) const {
+        return count[e] >= 0.0;
+    }
+
+    PerfSample operator-(const PerfSample &b) const {
+        PerfSample d;
+        for(int e = 0; e < EVENTS; e++)
+            d.count[e] = has(e) && b.has(e) ? count[e] - b.count[e] : -1.0;
+        return d;
+    }
+};
+
+/** Hardware counters through Linux perf_event_open.
+ *
+ *  CPU backends run kernels on a pool of threads, so counters
+ *  are opened on every thread of the process at construction,
+ *  and are inherited by every thread started later.  Those are
+ *  counted with the thread that started them, including ones
+ *  started and joined within a kernel launch.  Counters
+ *  multiplexed by the kernel are scaled by their running time.
+ *
+ *  Hardware events are often unavailable in VMs and containers,
+ *  or when /proc/sys/kernel/perf_event_paranoid is above 2.
+ *  They then read as negative, and the software task clock
+ *  usually still works.
+ */
+class PerfCounters {
+    public:
+        PerfCounters() {
+            DIR *dir = opendir("/proc/self/task");
+            if(dir == nullptr) return;
+            while(struct dirent *ent = readdir(dir)) {
+                const long tid = std::strtol(ent->d_name, nullptr, 10);
+                if(tid <= 0) continue;
+                Thread t;
+                for(int e = 0; e < PerfSample::EVENTS; e++)
+                    t.fd[e] = open(tid, e);
+                threads.push_back(t);
+            }
+            closedir(dir);
+        }
+        PerfCounters(const PerfCounters &) = delete;
+        PerfCounters &operator=(const PerfCounters &) = delete;
+
+        ~PerfCounters() {
+            for(auto &t : threads)
+                for(int e = 0; e < PerfSample::EVENTS; e++)
+                    if(t.fd[e] >= 0) close(t.fd[e]);
+        }
+
+        /// Current totals.  Threads that exited keep their final counts.
+        PerfSample read() const {
+            PerfSample s = PerfSample::none();
+            for(int e = 0; e < PerfSample::EVENTS; e++) {
+                for(auto &t : threads) {
+                    const int fd = t.fd[e];
+                    uint64_t v[3]; // value, time enabled, time running
+                    if(fd < 0 || ::read(fd, v, sizeof(v)) != sizeof(v))
+                        continue;
+                    double x = double(v[0]);
+                    if(v[2] != 0 && v[2] < v[1])
+                        x *= double(v[1]) / v[2];
+                    s.count[e] = (s.count[e] < 0.0 ? 0.0 : s.count[e]) + x;
+                }
+            }
+            return s;
+        }
+
+    private:
+        struct Thread {
+            int fd[PerfSample::EVENTS];
+        };
+        std::vector<Thread> threads; // present at construction
+
+        static int open(const long tid, const int e) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            switch(e) {
+            case PerfSample::TASK_CLOCK:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_TASK_CLOCK;
+                break;
+            case PerfSample::CYCLES:
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case PerfSample::INSTRUCTIONS:
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case PerfSample::CACHE_MISSES:
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case PerfSample::BRANCH_MISSES:
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case PerfSample::FP_PACKED:
+            case PerfSample::FP_SCALAR:
+                attr.type = PERF_TYPE_RAW;
+                attr.config = e == PerfSample::FP_PACKED ? FPT_PERF_FP_PACKED : FPT_PERF_FP_SCALAR;
+                if(attr.config == 0) return -1;
+                break;
+            }
+            return int(syscall(SYS_perf_event_open, &attr, pid_t(tid), -1, -1, 0));
+        }
+};
+
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cassert>
+
+namespace fpt {
+
+/// A query point.
+struct Probe {
+    float x, y, z;
+};
+
+/** Look up the atoms of X within radius R of every probe.
+ *
+ *  Each thread takes cell_elems() probes.  A probe is binned with
+ *  calcBinF, and the stencil of its cell (list_cells(R)) is
+ *  walked, clipped at open walls.  Across periodic walls, atom
+ *  coordinates are shifted to the image nearest the probe.
+ *  Probes outside the box through an open wall find no atoms.
+ *
+ *  QOper must be a class including members:
+ *     type Output = result per probe
+ *     type Accum  = zero-initialized local result
+ *     pair : Accum&,n,dx,dy,dz -> void, for atom n within R,
+ *            with d = probe - atom
+ *     finalize : Output&,const Accum& -> void
+ *
+ *  Block b works on probes [b, b+1)*ATOMS_PER_CELL, and blocks
+ *  stride over the probes as in the other cell kernels.  Probes
+ *  in spatial order (e.g. grid order) share the cells they load.
+ */
+template <typename QOper, typename Vec>
+struct QueryKernel {
+    uint32_t count; // probes
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const BoxCells cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ X,
+                const float R2,
+                const Probe *__restrict__ P,
+                typename QOper::Output *__restrict__ const out
+                ) const {
+        constexpr uint32_t E = cell_elems<TAcc>();
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const uint32_t n = (count + ATOMS_PER_CELL - 1)/ATOMS_PER_CELL;
+
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < n; b += blocks) {
+            for(uint32_t e = 0; e < E; e++) {
+                const uint32_t p = b*ATOMS_PER_CELL + idx + e*threads;
+                if(p < count)
+                    probe(cells, nbr, X, R2, P[p], out[p]);
+            }
+        }
+    }
+
+    /// Run one probe.
+    ALPAKA_FN_HOST_ACC void probe(
+                const BoxCells &cells,
+                const CellRange *__restrict__ nbr,
+                const Cell *__restrict__ X,
+                const float R2,
+                Probe q,
+                typename QOper::Output &out
+                ) const {
+        typename QOper::Accum ans{};
+        if(!cells.wrap(q.x, q.y, q.z)) {
+            QOper::finalize(out, ans);
+            return;
+        }
+        int i, j, k;
+        cells.decode(cells.srt.calcBinF(q.x, q.y, q.z), i, j, k);
+
+        int r = 0; // current row of nbr
+        CellRange off = nbr[0];
+        while(next_row(cells, nbr, r, i, j, k, off)) {
+            const float sy = cells.image(j + off.j, 1);
+            const float sz = cells.image(k + off.k, 2);
+            const uint32_t start = cells.row(j, k, off);
+            for(int di = off.i0; di <= off.i1; di++) {
+                const float sx = cells.image(i + di, 0);
+                const Cell &A = X[cells.col(start, i, di)];
+                for(int m = 0; m < ATOMS_PER_CELL; m++) {
+                    if(A.n[m] == 0) continue;
+                    const float dx = q.x - (A.x[m] + sx);
+                    const float dy = q.y - (A.y[m] + sy);
+                    const float dz = q.z - (A.z[m] + sz);
+                    if(dx*dx + dy*dy + dz*dz < R2)
+                        QOper::pair(ans, A.n[m], dx, dy, dz);
+                }
+            }
+            r++;
+        }
+        QOper::finalize(out, ans);
+    }
+};
+
+/// Number of atoms within the radius.
+struct CountQuery {
+    using Output = uint32_t;
+    using Accum = uint32_t;
+
+    static inline ALPAKA_FN_HOST_ACC void pair(Accum &c, uint32_t n, float dx, float dy, float dz) {
+        c++;
+    }
+    static inline ALPAKA_FN_HOST_ACC void finalize(Output &out, const Accum &c) {
+        out = c;
+    }
+};
+
+/** Atoms within the radius: their number, and the n
+ *  of the first K found (in no particular order).
+ */
+template <int K>
+struct ListQuery {
+    struct Output {
+        uint32_t count;
+        uint32_t n[K];
+    };
+    using Accum = Output;
+
+    static inline ALPAKA_FN_HOST_ACC void pair(Accum &a, uint32_t n, float dx, float dy, float dz) {
+        if(a.count < K)
+            a.n[a.count] = n;
+        a.count++;
+    }
+    static inline ALPAKA_FN_HOST_ACC void finalize(Output &out, const Accum &a) {
+        out = a;
+    }
+};
+
+/** LJ energy of a test particle at the probe, from the
+ *  atoms within the radius (insertion tests).
+ */
+struct LJProbeQuery {
+    using Output = float;
+    using Accum = double;
+
+    static inline ALPAKA_FN_HOST_ACC void pair(Accum &en, uint32_t n, float dx, float dy, float dz) {
+        en += lj_en(SQR(dx) + SQR(dy) + SQR(dz));
+    }
+    static inline ALPAKA_FN_HOST_ACC void finalize(Output &out, const Accum &en) {
+        out = en;
+    }
+};
+
+/** Create a query of the atoms in X (sorted on srt) within
+ *  radius R of every probe in P, leaving results in out.
+ *  nbr must hold srt.list_cells(R).
+ *
+ *    auto nbr = srt.list_cells(R);  // copied to the device
+ *    auto K = mkQuery<CountQuery,Acc,Dim,Idx>(devAcc, srt, nbr_d, X, R, P, count);
+ *    alpaka::enqueue(queue, K);
+ */
+template <typename QOper, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkQuery(const Dev &devAcc, const CellSorter &srt,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X, const float R,
+             const alpaka::Buf<Dev, Probe, Dim, Idx> &P,
+             alpaka::Buf<Dev, typename QOper::Output, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    Idx const nprobes = alpaka::extent::getExtent<0>(P);
+    assert( alpaka::extent::getExtent<0>(X) == srt.cells );
+    assert( alpaka::extent::getExtent<0>(out) == nprobes );
+    // The grid must not be sheared.
+    assert( srt.L[3] == 0.0 && srt.L[4] == 0.0 && srt.L[5] == 0.0 );
+
+    // ATOMS_PER_CELL probes per block, striding over `per' of them
+    Idx const nblocks = (nprobes + ATOMS_PER_CELL - 1)/ATOMS_PER_CELL;
+    Idx const per = launch_cells<Acc>(devAcc, "query", nblocks);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, nblocks, per);
+
+    std::cout << "Creating query kernel for " << nprobes << " probes.\n";
+    QueryKernel<QOper,Vec> K{uint32_t(nprobes)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(X), R*R, alpaka::getPtrNative(P),
+                alpaka::getPtrNative(out));
+}
+
+}
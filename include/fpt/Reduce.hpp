@@ -0,0 +1,266 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+
+#include <cassert>
+#include <cfloat>
+
+namespace fpt {
+
+/** Reduce every atom of a cell buffer to one value.
+ *
+ *  Oper must provide
+ *     type Accum   = partial result, trivially copyable
+ *     init    : Accum -> void, set to the identity
+ *     f       : Accum,idx,n,x,y,z -> void, add one atom
+ *     combine : Accum,Accum -> void, add the second to the first
+ *
+ *  f is only called on occupied slots.  It may be a non-static
+ *  member, for operators carrying parameters (see HistOper).
+ *
+ *  Each thread accumulates the slots it holds over the cells its
+ *  block strides over.  The threads of the block (one warp) are
+ *  combined through shared memory, and thread 0 writes the partial
+ *  of its block to partial[blockIdx].
+ */
+template <typename Oper, typename Vec>
+struct Reduce1Kernel {
+    Oper op;
+    uint32_t count; // cells to stride over
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const Cell *__restrict__ X,
+                typename Oper::Accum *__restrict__ const partial
+                ) const {
+        using Accum = typename Oper::Accum;
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        auto const blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        auto &part = alpaka::declareSharedVar<Accum[ATOMS_PER_CELL], __COUNTER__>(acc);
+
+        Accum a;
+        Oper::init(a);
+        for(uint32_t b = blk; b < count; b += blocks) {
+            const Cell &A = X[b];
+            for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads) {
+                if(A.n[m] == 0) continue;
+                op.f(a, m, A.n[m], A.x[m], A.y[m], A.z[m]);
+            }
+        }
+        part[idx] = a;
+        alpaka::syncBlockThreads(acc);
+
+        if(idx == 0) {
+            for(uint32_t t = 1; t < threads; t++)
+                Oper::combine(a, part[t]);
+            partial[blk] = a;
+        }
+    }
+};
+
+/** Combine partial[0 .. count) into *result.
+ *  Launched with a single block.
+ */
+template <typename Oper>
+struct CombineKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const typename Oper::Accum *__restrict__ partial,
+                const uint32_t count,
+                typename Oper::Accum *__restrict__ const result
+                ) const {
+        using Accum = typename Oper::Accum;
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto &part = alpaka::declareSharedVar<Accum[ATOMS_PER_CELL], __COUNTER__>(acc);
+
+        Accum a;
+        Oper::init(a);
+        for(uint32_t b = idx; b < count; b += threads)
+            Oper::combine(a, partial[b]);
+        part[idx] = a;
+        alpaka::syncBlockThreads(acc);
+
+        if(idx == 0) {
+            for(uint32_t t = 1; t < threads; t++)
+                Oper::combine(a, part[t]);
+            *result = a;
+        }
+    }
+};
+
+/** Device-side reduction of a cell buffer with Oper, for
+ *  global quantities that should not travel to the host
+ *  cell by cell.
+ *
+ *  enqueue() runs two kernels: one partial per block, striding
+ *  over the cells as mk1Body does, then a single block combining
+ *  the partials.  get() copies the result to the host.
+ *
+ *    fpt::Reduction<fpt::CenterOper, Acc> com(devAcc, srt.cells);
+ *    com.enqueue(queue, X);
+ *    auto c = com.get(queue);   // centroid c.x/c.n, c.y/c.n, c.z/c.n
+ */
+template <typename Oper, typename Acc>
+class Reduction {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using Accum = typename Oper::Accum;
+        using AccumBuf = alpaka::Buf<Dev, Accum, Dim, Idx>;
+
+        const Dev &devAcc;
+        const Idx ncells;
+        const Idx per_block; // cells per block of the first pass
+        const Idx blocks;    // partials
+
+        Reduction(const Dev &devAcc_, const Idx ncells_, const Oper op_ = Oper{})
+            : devAcc(devAcc_), ncells(ncells_)
+            , per_block(launch_cells<Acc>(devAcc_, "1body", ncells_))
+            , blocks((ncells_ + per_block - 1)/per_block), op(op_)
+            , partial( AccumBuf{alpaka::allocBuf<Accum, Idx>(devAcc_, std::max(blocks, Idx(1)))} )
+            , result( AccumBuf{alpaka::allocBuf<Accum, Idx>(devAcc_, Idx(1))} ) { }
+
+        /// Reduce the first ncells cells of X.
+        template <typename Queue>
+        void enqueue(Queue &Q, const alpaka::Buf<Dev, Cell, Dim, Idx> &X) {
+            assert( alpaka::extent::getExtent<0>(X) >= ncells );
+            alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, ncells, per_block),
+                              Reduce1Kernel<Oper,Vec>{op, uint32_t(ncells)},
+                              alpaka::getPtrNative(X), alpaka::getPtrNative(partial));
+            alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, Idx(1)), CombineKernel<Oper>{},
+                              alpaka::getPtrNative(partial), uint32_t(blocks),
+                              alpaka::getPtrNative(result));
+        }
+
+        /// Copy the result of the last enqueue() to the host.  Waits for Q.
+        template <typename Queue>
+        Accum get(Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto h = alpaka::allocBuf<Accum, Idx>(devHost, Idx(1));
+            alpaka::memcpy(Q, h, result, Idx(1));
+            alpaka::wait(Q);
+            return *alpaka::getPtrNative(h);
+        }
+
+        ///! Device-side result, for kernels reading it in place.
+        const Accum *device() const {
+            return alpaka::getPtrNative(result);
+        }
+
+    private:
+        const Oper op;
+        AccumBuf partial, result;
+};
+
+/** Reduce all cells of X, and return the result.  Waits for Q.
+ */
+template <typename Oper, typename Acc, typename Queue, typename Dim, typename Idx, typename Dev>
+typename Oper::Accum reduce1Body(const Dev &devAcc, Queue &Q,
+                                 const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+                                 const Oper op = Oper{}) {
+    Reduction<Oper, Acc> red(devAcc, Idx(alpaka::extent::getExtent<0>(X)), op);
+    red.enqueue(Q, X);
+    return red.get(Q);
+}
+
+/** Number of atoms and the sum of their coordinates.
+ *  The centroid is x/n, y/n, z/n.  Over a buffer of
+ *  velocities, the sums are the total momentum (unit masses).
+ */
+struct CenterOper {
+    struct Accum {
+        double n, x, y, z;
+    };
+
+    static inline ALPAKA_FN_HOST_ACC void init(Accum &a) {
+        a.n = a.x = a.y = a.z = 0.0;
+    }
+    static inline ALPAKA_FN_HOST_ACC void f(Accum &a, int idx,
+                                            uint32_t n, float x, float y, float z) {
+        a.n += 1.0;
+        a.x += x;
+        a.y += y;
+        a.z += z;
+    }
+    static inline ALPAKA_FN_HOST_ACC void combine(Accum &a, const Accum &b) {
+        a.n += b.n;
+        a.x += b.x;
+        a.y += b.y;
+        a.z += b.z;
+    }
+};
+
+/** Smallest and largest coordinate along each axis.
+ *  lo > hi when there are no atoms.
+ */
+struct BoundsOper {
+    struct Accum {
+        float lo[3], hi[3];
+    };
+
+    static inline ALPAKA_FN_HOST_ACC void init(Accum &a) {
+        for(int d = 0; d < 3; d++) {
+            a.lo[d] = FLT_MAX;
+            a.hi[d] = -FLT_MAX;
+        }
+    }
+    static inline ALPAKA_FN_HOST_ACC void f(Accum &a, int idx,
+                                            uint32_t n, float x, float y, float z) {
+        const float r[3] = {x, y, z};
+        for(int d = 0; d < 3; d++) {
+            a.lo[d] = r[d] < a.lo[d] ? r[d] : a.lo[d];
+            a.hi[d] = r[d] > a.hi[d] ? r[d] : a.hi[d];
+        }
+    }
+    static inline ALPAKA_FN_HOST_ACC void combine(Accum &a, const Accum &b) {
+        for(int d = 0; d < 3; d++) {
+            a.lo[d] = b.lo[d] < a.lo[d] ? b.lo[d] : a.lo[d];
+            a.hi[d] = b.hi[d] > a.hi[d] ? b.hi[d] : a.hi[d];
+        }
+    }
+};
+
+/** Histogram of atom coordinates along one axis (0,1,2 = x,y,z).
+ *  Bin k counts atoms in [lo + k*width, lo + (k+1)*width).
+ *  Atoms outside go to the first or last bin.
+ *
+ *    fpt::HistOper<64> zh{2, 0.0f, Lz/64};
+ *    auto h = fpt::reduce1Body<fpt::HistOper<64>,Acc>(devAcc, queue, X, zh);
+ */
+template <int Bins>
+struct HistOper {
+    int axis;
+    float lo, width;
+
+    struct Accum {
+        uint32_t count[Bins];
+    };
+
+    static inline ALPAKA_FN_HOST_ACC void init(Accum &a) {
+        for(int k = 0; k < Bins; k++)
+            a.count[k] = 0;
+    }
+    inline ALPAKA_FN_HOST_ACC void f(Accum &a, int idx,
+                                     uint32_t n, float x, float y, float z) const {
+        const float r = axis == 0 ? x : (axis == 1 ? y : z);
+        const float u = (r - lo)/width;
+        const int k = u < 0.0f ? 0 : (u >= Bins ? Bins-1 : int(u));
+        a.count[k]++;
+    }
+    static inline ALPAKA_FN_HOST_ACC void combine(Accum &a, const Accum &b) {
+        for(int k = 0; k < Bins; k++)
+            a.count[k] += b.count[k];
+    }
+};
+
+}
@@ -1,13 +1,34 @@
 #pragma once
 
 #include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
 
 namespace fpt {
+/// Call Oper1::f with acc first, for operators whose f takes it.
+template <typename Oper1, typename TAcc>
+ALPAKA_FN_ACC inline auto call1(TAcc const &acc, typename Oper1::Output &out, int idx,
+                                uint32_t n, float x, float y, float z, int)
+        -> decltype(Oper1::f(acc, out, idx, n, x, y, z)) {
+    return Oper1::f(acc, out, idx, n, x, y, z);
+}
+
+/// Call Oper1::f without acc otherwise.
+template <typename Oper1, typename TAcc>
+ALPAKA_FN_ACC inline void call1(TAcc const &, typename Oper1::Output &out, int idx,
+                                uint32_t n, float x, float y, float z, long) {
+    Oper1::f(out, idx, n, x, y, z);
+}
+
 /**
  * Compute a 1-body operator.
  */
 template <typename Oper1, typename Vec>
 struct Oper1Kernel {
+    uint32_t bin0 = 0; // first cell to work on
+    const uint32_t *list = nullptr; // if set, block b works on cell list[b]
+    uint32_t count = 0; // blocks to stride over, 0 for one per launched block
+    const uint32_t *count_at = nullptr; // if set, stride over *count_at blocks instead
+
     ALPAKA_NO_HOST_ACC_WARNING
     template<typename TAcc>
     ALPAKA_FN_ACC void operator()(
@@ -15,28 +36,50 @@ struct Oper1Kernel {
                 const Cell *__restrict__ X,
                 typename Oper1::Output *__restrict__ const out
                 ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const uint32_t n = count_at != nullptr ? *count_at : count != 0 ? count : blocks;
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]; b < n; b += blocks)
+            this->cell(acc, X, out, b);
+    }
+
+    /// Work on the cell of block blk, with all threads of the block.
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc>
+    ALPAKA_FN_ACC void cell(
+                TAcc const& acc,
+                const Cell *__restrict__ X,
+                typename Oper1::Output *__restrict__ const out,
+                const uint32_t blk
+                ) const {
         const int idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
-        const auto cell = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        const int threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        const auto cell = list != nullptr ? list[blk] : bin0 + blk;
 
         const Cell &A = X[cell];
-        uint32_t n = A.n[idx];
-        float x = A.x[idx];
-        float y = A.y[idx];
-        float z = A.z[idx];
-        Oper1::f(out[cell], idx, n, x, y, z);
+        for(int m = idx; m < ATOMS_PER_CELL; m += threads) {
+            uint32_t n = A.n[m];
+            float x = A.x[m];
+            float y = A.y[m];
+            float z = A.z[m];
+            call1<Oper1>(acc, out[cell], m, n, x, y, z, 0);
+        }
     }
 };
 
-/** 1-body operator to count the total number of particles per cell
+/** 1-body operator to count the total number of particles per cell.
+ *  Adds to out, which must be zeroed beforehand.  Every thread of
+ *  the block adds to the same count, so it does so atomically.
  */
 struct NumCellOper {
     using Output = uint32_t;
 
     ALPAKA_NO_HOST_ACC_WARNING
+    template <typename TAcc>
     static inline ALPAKA_FN_ACC void f(
-            Output& out, int idx,
+            TAcc const &acc, Output& out, int idx,
             uint32_t n, float x, float y, float z) {
-        out += (n != 0);
+        if(n != 0)
+            alpaka::atomicOp<alpaka::AtomicAdd>(acc, &out, 1u);
     }
 };
 
@@ -73,6 +116,8 @@ struct ZeroEnOper {
 /** Create a 1-body operation.  Oper1 has f : out[cell],idx,n,x,y,z -> out[cell]
  *  cell = cell(x,y,z), the cell that the particle lies within
  *
+ *  Only cells [first, first+count) are visited.
+ *
  * Example enque calls
  *  ZeroEnK = mk1Body<ZeroEnOper,Acc,Dim,Idx>(devAcc, X, out);
  *  alpaka::enqueue(queue, ZeroEnK);
@@ -82,33 +127,34 @@ struct ZeroEnOper {
 */
 template <typename Oper1, typename Acc, typename Dim, typename Idx, typename Dev>
 auto mk1Body(const Dev &devAcc, const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
-             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out) {
+             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out,
+             Idx first, Idx count) {
     using Vec = alpaka::Vec<Dim,Idx>;
 
-    // Launch with one warp per thread block
-    Idx const warpExtent  = alpaka::getWarpSize(devAcc);
-
     // Spaces must match.
     Idx const ncells = alpaka::extent::getExtent<0>(X);
     assert( ncells == alpaka::extent::getExtent<0>(out) );
+    assert( first + count <= ncells );
 
-    Vec const gridBlockExtent = Vec::all(ncells);
-    // min of 2
-    Vec blockThreadExtent = Vec::all(
-            warpExtent < ATOMS_PER_CELL ?
-            warpExtent : ATOMS_PER_CELL);
-
-    alpaka::WorkDivMembers<Dim, Idx> workDiv{
-                gridBlockExtent,
-                blockThreadExtent,
-                Vec::all(1)};
+    // One warp per thread block, striding over `per' cells
+    Idx const per = launch_cells<Acc>(devAcc, "1body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
 
-    std::cout << "Creating 1-body kernel for " << ncells << " cells.\n";
-    Oper1Kernel<Oper1,Vec> K{};
+    std::cout << "Creating 1-body kernel for " << count << " cells.\n";
+    Oper1Kernel<Oper1,Vec> K{first, nullptr, uint32_t(count)};
     return alpaka::createTaskKernel<Acc>(workDiv, K,
                 alpaka::getPtrNative(X), alpaka::getPtrNative(out));
 }
 
+/** As above, but run over all cells.
+ */
+template <typename Oper1, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk1Body(const Dev &devAcc, const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out) {
+    Idx const ncells = alpaka::extent::getExtent<0>(X);
+    return mk1Body<Oper1,Acc,Dim,Idx>(devAcc, X, out, Idx(0), ncells);
+}
+
 }
 
 // e.g. call_1body<ZeroEnOper>();
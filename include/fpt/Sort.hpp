@@ -1,14 +1,21 @@
 #pragma once
 
 #include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
 
 namespace fpt {
 
-template <typename Vec>
+template <typename Vec, typename Cells = BoxCells>
 class sortAtomsKernel {
 public:
-    const CellSorter_d srt;
-    sortAtomsKernel(const CellSorter &srt_) : srt(srt_.device()) {}
+    const Cells cells;
+    const uint32_t bin0; // first block, passed to cells.home()
+    uint32_t *const dropped; // if set, counts atoms lost to full cells
+    const uint32_t count; // blocks to stride over, 0 for one per launched block
+    const uint32_t *const count_at; // if set, stride over *count_at blocks instead
+    sortAtomsKernel(const Cells &cells_, uint32_t bin0_ = 0, uint32_t *dropped_ = nullptr,
+                    uint32_t count_ = 0, const uint32_t *count_at_ = nullptr)
+        : cells(cells_), bin0(bin0_), dropped(dropped_), count(count_), count_at(count_at_) {}
 
     //-----------------------------------------------------------------------------
     //! The kernel entry point.
@@ -24,68 +31,101 @@ public:
             const Cell *__restrict__ X,
             Cell *__restrict__ Y
             ) const {
+        const uint32_t blocks = alpaka::getWorkDiv<alpaka::Grid, alpaka::Blocks>(acc)[0u];
+        const uint32_t n = count_at != nullptr ? *count_at : count != 0 ? count : blocks;
+        for(uint32_t b = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0u]; b < n; b += blocks)
+            cell(acc, cells, X, Y, bin0 + b);
+    }
+
+    /** Sort the atoms of cell C.home(block), with all threads
+     *  of the block.  The indexing is passed in, so batched
+     *  launches can hand each block its own.
+     */
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename C>
+    ALPAKA_FN_ACC void cell(
+            TAcc const& acc,
+            const C &cells,
+            const Cell *__restrict__ X,
+            Cell *__restrict__ Y,
+            const uint32_t block
+            ) const {
         using Idx = typename Vec::Val;
-        using Dim = typename Vec::Dim;
-        Idx const bin(alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0u]); // blockIdx.x
+        constexpr uint32_t E = cell_elems<TAcc>();
+        Idx const bin(cells.home(block));
         Idx const idx(alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0u]); // threadIdx.x
-        Idx const natoms(alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0u]);
+        Idx const threads(alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0u]);
 
-        //auto& far = alpaka::declareSharedVar<CellTranspose, __COUNTER__>(acc);
-        //load_cell(acc,X,bin,far);
-        //alpaka::syncBlockThreads(acc);
+        // atoms in slots idx + e*threads
+        uint32_t n[E], to_bin[E];
+        float x[E], y[E], z[E];
+        uint64_t mask = 0; // slots holding an atom to move
+        for(uint32_t e = 0; e < E; e++) {
+            const uint32_t s = idx + e*threads;
+            const bool in = s < ATOMS_PER_CELL;
+            n[e] = in ? X[bin].n[s] : 0;
+            x[e] = in ? X[bin].x[s] : 0.0f;
+            y[e] = in ? X[bin].y[s] : 0.0f;
+            z[e] = in ? X[bin].z[s] : 0.0f;
+            if(n[e] != 0 && !cells.wrap(x[e], y[e], z[e]))
+                n[e] = 0; // left the box through an open wall
+            to_bin[e] = cells.target(acc, x[e], y[e], z[e], n[e] != 0);
+            if(to_bin[e] == CELL_NONE)
+                n[e] = 0; // nowhere to go
+            mask |= uint64_t(alpaka::warp::ballot(acc, n[e] != 0)) << (e*threads);
+        }
 
-        uint32_t n = X[bin].n[idx];
-        float x = X[bin].x[idx];
-        float y = X[bin].y[idx];
-        float z = X[bin].z[idx];
-        const uint32_t to_bin = srt.calcBinF(x, y, z);
-        
-        uint64_t mask = alpaka::warp::ballot(acc, n != 0);
-        for(Idx j = 0; j < natoms; j++) { // group-insert at each idx
-            if(((1<<j)&mask) == 0) continue; // no work
+        for(uint32_t s = 0; s < ATOMS_PER_CELL; s++) { // group-insert at each slot
+            if(((uint64_t(1)<<s)&mask) == 0) continue; // no work
+            const uint32_t src = s % threads;
+            const uint32_t e = s / threads;
 
-            const int lane = srt.addToBin(acc, Y, j, n, to_bin); // successful lane
+            const int lane = cells.srt.addToBin(acc, Y, src, n[e], to_bin[e]); // successful lane
             if(lane < 0) { // error - dropped particle.
+                if(src == idx && dropped != nullptr)
+                    alpaka::atomicOp<alpaka::AtomicAdd>(acc, dropped, uint32_t(1));
                 continue;
             }
-            if(j == idx) {
-                Y[to_bin].x[lane] = x;
-                Y[to_bin].y[lane] = y;
-                Y[to_bin].z[lane] = z;
+            if(src == idx) {
+                Y[to_bin[e]].x[lane] = x[e];
+                Y[to_bin[e]].y[lane] = y[e];
+                Y[to_bin[e]].z[lane] = z[e];
             }
         }
     }
 };
 
 
-/* Return a sorting kernel */
+/* Return a kernel sorting the atoms in cells [first, first+count) of X
+ * into Y.  Y must have been zeroed beforehand.
+ */
 template<typename Acc, typename Dim, typename Idx, typename Dev>
 auto mkSorter(const Dev &devAcc,
               const CellSorter &srt,
               alpaka::Buf<Dev, Cell, Dim, Idx> &X,
-              alpaka::Buf<Dev, Cell, Dim, Idx> &Y) {
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y,
+              Idx first, Idx count) {
     using Vec = alpaka::Vec<Dim,Idx>;
 
-    // Launch with one warp per thread block
-    Idx const warpExtent  = alpaka::getWarpSize(devAcc);
-
-    Vec const gridBlockExtent = Vec::all(srt.cells);
-    // min of 2
-    Vec blockThreadExtent = Vec::all(
-            warpExtent < ATOMS_PER_CELL ?
-            warpExtent : ATOMS_PER_CELL);
+    // One warp per thread block, striding over `per' cells
+    Idx const per = launch_cells<Acc>(devAcc, "sort", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
 
-    alpaka::WorkDivMembers<Dim, Idx> workDiv{
-                gridBlockExtent,
-                blockThreadExtent,
-                Vec::all(1)};
-
-    std::cout << "Creating sorting kernel for " << srt.cells << " cells.\n";
+    std::cout << "Creating sorting kernel for " << count << " cells.\n";
 
     // Create the kernel execution task.
-    sortAtomsKernel<Vec> K{srt};
+    sortAtomsKernel<Vec> K{BoxCells{srt.device()}, first, nullptr, uint32_t(count)};
     return alpaka::createTaskKernel<Acc>(workDiv, K,
                 alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
 }
 
+/* Return a sorting kernel */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkSorter(const Dev &devAcc,
+              const CellSorter &srt,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y) {
+    return mkSorter<Acc,Dim,Idx>(devAcc, srt, X, Y, Idx(0), Idx(srt.cells));
+}
+
 }
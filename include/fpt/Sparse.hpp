@@ -0,0 +1,297 @@
+#pragma once
+
+#include <fpt/Alloc.hpp>
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cassert>
+
+/** Key of an unused hash slot. */
+#define SPARSE_EMPTY   0xFFFFFFFFu
+/** Value of a hash slot whose block is still being allocated. */
+#define SPARSE_PENDING 0xFFFFFFFFu
+/** Owner of a block holding no cell, including the empty block 0. */
+#define SPARSE_FREE    0xFFFFFFFFu
+
+namespace fpt {
+
+/** Cell indexing on a sparse grid.
+ *
+ *  Only occupied cells of the box have storage.  They live in
+ *  blocks of an Alloc<Cell> pool, and a hash table maps the
+ *  index of a cell in the box to its block.  Block 0 is never
+ *  handed out and stays empty; cells without a block read it.
+ *
+ *  Block b of a kernel works on block b.  Neighbors are found
+ *  like in BoxCells, but col() looks the cell up in the table.
+ *  Blocks holding no cell have no neighbors.
+ */
+template <typename Dev>
+struct SparseCells : BoxCells {
+    uint32_t *key;   // hash slot -> box cell, or SPARSE_EMPTY
+    uint32_t *val;   // hash slot -> block, or 0 if none was free
+    uint32_t *owner; // block -> box cell, or SPARSE_FREE
+    uint32_t mask;   // hash slots - 1
+    Alloc_d<Cell, Dev> pool;
+
+    SparseCells(const CellSorter_d &srt_, uint32_t *key_, uint32_t *val_,
+                uint32_t *owner_, const uint32_t slots, const Alloc_d<Cell, Dev> &pool_)
+        : BoxCells{srt_}, key(key_), val(val_), owner(owner_)
+        , mask(slots - 1), pool(pool_) {}
+
+    /// Indices of the cell of block bin, or i = -1 for a free block.
+    ALPAKA_FN_HOST_ACC inline
+        void decode(const uint32_t bin, int &i, int &j, int &k) const {
+            const uint32_t c = owner[bin];
+            if(c == SPARSE_FREE) {
+                i = j = k = -1;
+                return;
+            }
+            srt.decodeBin(c, i, j, k);
+    }
+
+    /// As in BoxCells, but nothing is left around a free block.
+    ALPAKA_FN_HOST_ACC inline
+        bool clip(const int i, const int j, const int k, CellRange &off) const {
+            return i >= 0 && BoxCells::clip(i, j, k, off);
+    }
+
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t col(const uint32_t start, const int i, const int di) const {
+            return find(start + index(i + di, 0));
+    }
+
+    /// Block holding box cell c, or the empty block 0.
+    ALPAKA_FN_HOST_ACC inline
+        uint32_t find(const uint32_t c) const {
+            uint32_t s = fmix32(c) & mask;
+            for(uint32_t p = 0; p <= mask; p++, s = (s+1) & mask) {
+                const uint32_t k = key[s];
+                if(k == c) return val[s];
+                if(k == SPARSE_EMPTY) break;
+            }
+            return 0;
+    }
+
+    /** Block receiving an atom at x,y,z, allocated on first use.
+     *  Must be called by all threads in a warp simultaneously.
+     *  Returns CELL_NONE if the pool ran out of blocks, or if the
+     *  hash table is full.  The latter counts as a pool failure
+     *  for every atom dropped.
+     */
+    template <typename TAcc>
+    ALPAKA_FN_ACC inline
+        uint32_t target(TAcc const &acc, float x, float y, float z, bool valid) const {
+            const uint32_t c = srt.calcBinF(x, y, z);
+            bool won = false;
+            const uint32_t s = valid ? claim(acc, c, won) : SPARSE_EMPTY;
+
+            // One block for every slot this warp inserted.
+            Alloc_d<Cell, Dev> blocks(pool);
+            const uint32_t b = blocks.alloc_batch(acc, c, won);
+            if(won) {
+                if(b != ALLOC_FAIL)
+                    owner[b] = c;
+                alpaka::atomicOp<alpaka::AtomicExch>(acc, &val[s], b == ALLOC_FAIL ? 0u : b);
+            }
+            if(s == SPARSE_EMPTY) {
+                if(valid)
+                    blocks.count_failures(acc, 1u);
+                return CELL_NONE;
+            }
+
+            // Wait for the inserting warp to publish the block.
+            // It did so before waiting on anything itself.
+            uint32_t v;
+            do {
+                v = alpaka::atomicOp<alpaka::AtomicOr>(acc, &val[s], 0u);
+            } while(v == SPARSE_PENDING);
+            return v == 0 ? CELL_NONE : v;
+    }
+
+  private:
+    /** Hash slot of box cell c, inserting c if it is new.
+     *  Sets `won' on the one thread that inserted it.
+     *  Returns SPARSE_EMPTY if the table is full.
+     */
+    template <typename TAcc>
+    ALPAKA_FN_ACC inline
+        uint32_t claim(TAcc const &acc, const uint32_t c, bool &won) const {
+            uint32_t s = fmix32(c) & mask;
+            for(uint32_t p = 0; p <= mask; p++, s = (s+1) & mask) {
+                uint32_t k = key[s];
+                if(k == SPARSE_EMPTY)
+                    k = alpaka::atomicOp<alpaka::AtomicCas>(acc, &key[s], SPARSE_EMPTY, c);
+                if(k == SPARSE_EMPTY) {
+                    won = true;
+                    return s;
+                }
+                if(k == c) return s;
+            }
+            return SPARSE_EMPTY;
+    }
+};
+
+/** A CellSorter box storing only its occupied cells.
+ *
+ *  Memory follows the number of occupied cells rather than
+ *  the volume of the box, so very large or very dilute boxes fit.
+ *  Cell buffers (outputs included) are indexed by block, and
+ *  have `capacity' entries.  owners() gives the box cell of
+ *  every block.
+ *
+ *  Each step:
+ *
+ *    B.clear(queue)
+ *    enqueue mkSorter(devAcc, A.data(), B)   // allocates B's cells
+ *    enqueue mk2Body<Oper2,...>(devAcc, B, nbr, out)
+ *    swap A and B
+ *
+ *  The first sort may read a dense cell buffer instead of A.data().
+ *  Atoms whose cell found no free block are dropped, and failures()
+ *  counts those cells.  The hash table keeps a slot for each of
+ *  them too, so it fills up once about `capacity' cells have
+ *  failed.  From then on every atom of a new cell is dropped
+ *  and counted in failures() on its own.
+ */
+template <typename Acc>
+class SparseGrid {
+    public:
+        using Dim = alpaka::DimInt<1u>;
+        using Idx = uint32_t;
+        using Dev = alpaka::Dev<Acc>;
+        using IdxBuf = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
+        using CellBuf = typename Alloc<Cell, Acc>::BufDev;
+
+        const CellSorter box;
+        const uint32_t capacity; // blocks, counting the empty block 0
+        const uint32_t slots;    // hash table size, a power of 2
+
+        SparseGrid(const Dev &devAcc, const CellSorter &box_, const uint32_t capacity_)
+            : box(box_), capacity(capacity_), slots(table_size(capacity_))
+            , pool(devAcc, capacity_)
+            , key( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc, slots)} )
+            , val( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc, slots)} )
+            , own( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc, capacity_)} )
+            , cells(box_.device(), alpaka::getPtrNative(key), alpaka::getPtrNative(val),
+                    alpaka::getPtrNative(own), slots, pool.device()) {
+            assert(capacity > 1);
+            auto Q = alpaka::Queue<Acc, alpaka::Blocking>(devAcc);
+            clear(Q);
+        }
+
+        /// Empty every cell and release all blocks.
+        template <typename Queue>
+        void clear(Queue &Q) {
+            pool.reinit(1, Q); // block 0 stays taken
+            alpaka::memset(Q, key, 0xFF, slots);
+            alpaka::memset(Q, val, 0xFF, slots);
+            alpaka::memset(Q, own, 0xFF, capacity); // SPARSE_FREE
+            alpaka::memset(Q, pool.data(), 0, capacity);
+        }
+
+        /// Number of cells holding a block.  Waits on Q to complete.
+        template <typename Queue>
+        uint32_t occupied(Queue &Q) {
+            return capacity - 1 - pool.count_free(Q);
+        }
+
+        /** Cells that found no free block since clear(), plus atoms
+         *  dropped while the hash table was full.  Waits on Q.
+         */
+        template <typename Queue>
+        uint32_t failures(Queue &Q) {
+            return pool.failures(Q);
+        }
+
+        /// Cell storage, indexed by block.
+        CellBuf &data() {
+            return pool.data();
+        }
+        const CellBuf &data() const {
+            return pool.data();
+        }
+
+        /// Box cell of every block.  Free blocks read SPARSE_FREE.
+        const IdxBuf &owners() const {
+            return own;
+        }
+
+        ///! Return device-accessible indexing.
+        SparseCells<Dev> device() const {
+            return cells;
+        }
+
+    private:
+        Alloc<Cell, Acc> pool;
+        IdxBuf key, val, own;
+        const SparseCells<Dev> cells;
+
+        // at most half full
+        static uint32_t table_size(const uint32_t capacity) {
+            uint32_t n = 1;
+            while(n < 2*capacity) n *= 2;
+            return n;
+        }
+};
+
+/* Return a kernel sorting the atoms of every cell of X into
+ * the sparse grid Y.  X may be another SparseGrid's data()
+ * or a dense cell buffer for Y.box.  Y must have been cleared
+ * beforehand.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkSorter(const Dev &devAcc,
+              const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              SparseGrid<Acc> &Y) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    const Idx count = alpaka::extent::getExtent<0>(X);
+
+    // One warp per thread block, striding over `per' cells
+    Idx const per = launch_cells<Acc>(devAcc, "sort", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating sparse sorting kernel for " << count << " cells.\n";
+    sortAtomsKernel<Vec, SparseCells<Dev>> K{Y.device(), 0, nullptr, uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                alpaka::getPtrNative(X), alpaka::getPtrNative(Y.data()));
+}
+
+/** Create a 2-body operation over every block of a sparse grid.
+ *  out is indexed by block.  Blocks holding no cell
+ *  visit no neighbors.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const SparseGrid<Acc> &grid,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(out) == grid.capacity );
+
+    Idx const count = grid.capacity;
+    Idx const per = launch_cells<Acc>(devAcc, "2body", count);
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, count, per);
+
+    std::cout << "Creating sparse 2-body kernel for " << count << " blocks.\n";
+    Oper2Kernel<Oper2,Vec,SparseCells<Dev>> K{0, uint32_t(count)};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                grid.device(), alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(grid.data()), alpaka::getPtrNative(out));
+}
+
+/// Cell indexing and owned cells of a sparse grid, for ActiveCells.
+template <typename Acc>
+SparseCells<alpaka::Dev<Acc>> cell_index(const SparseGrid<Acc> &grid) {
+    return grid.device();
+}
+
+template <typename Acc>
+uint32_t owned_cells(const SparseGrid<Acc> &grid) {
+    return grid.capacity;
+}
+
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Singles.hpp>
+#include <fpt/Pairs.hpp>
+#include <fpt/Active.hpp>
+
+#include <cassert>
+#include <thread>
+#include <vector>
+
+namespace fpt {
+
+/** Device side of CellScheduler.
+ *
+ *  Tile t covers blocks [first[t], first[t+1]).  Every worker
+ *  owns a deque of consecutive tiles, packed as head | tail << 32.
+ *  Workers pop tiles from the front of their own deque, and steal
+ *  from the back of the others once it runs dry.
+ */
+struct TileDeques {
+    const uint32_t *first;
+    unsigned long long *q;        // current deques
+    const unsigned long long *q0; // deques at launch
+    uint32_t *done;               // workers finished
+    uint32_t workers;
+
+    /// Next tile for worker w, or CELL_NONE when all deques are empty.
+    template <typename TAcc>
+    ALPAKA_FN_ACC uint32_t next(TAcc const &acc, const uint32_t w) const {
+        uint32_t t = take(acc, w, false);
+        for(uint32_t v = 1; t == CELL_NONE && v < workers; v++)
+            t = take(acc, (w + v) % workers, true);
+        return t;
+    }
+
+    /** Called once by every worker when it quits.
+     *  The last one restores the deques, so the same
+     *  task can be enqueued again.
+     */
+    template <typename TAcc>
+    ALPAKA_FN_ACC void finish(TAcc const &acc) const {
+        if(alpaka::atomicOp<alpaka::AtomicAdd>(acc, done, uint32_t(1)) != workers-1)
+            return;
+        for(uint32_t w = 0; w < workers; w++)
+            q[w] = q0[w];
+        *done = 0;
+    }
+
+  private:
+    template <typename TAcc>
+    ALPAKA_FN_ACC uint32_t take(TAcc const &acc, const uint32_t v, const bool back) const {
+        unsigned long long s = q[v];
+        while(true) {
+            const uint32_t head = uint32_t(s);
+            const uint32_t tail = uint32_t(s >> 32);
+            if(head >= tail) return CELL_NONE;
+            const unsigned long long s2 = back
+                    ? (s & 0xFFFFFFFFull) | (uint64_t(tail-1) << 32)
+                    : (s & ~0xFFFFFFFFull) | (head+1);
+            const unsigned long long old = alpaka::atomicOp<alpaka::AtomicCas>(acc, &q[v], s, s2);
+            if(old == s) return back ? tail-1 : head;
+            s = old;
+        }
+    }
+};
+
+/** Run Body::cell over every block of a CellScheduler's tiles.
+ *  Launched with one block per worker.
+ */
+template <typename Body>
+struct StealKernel {
+    Body body;
+
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename... Args>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const TileDeques tiles,
+                Args... args
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const w = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        auto &tile = alpaka::declareSharedVar<uint32_t, __COUNTER__>(acc);
+
+        while(true) {
+            if(idx == 0)
+                tile = tiles.next(acc, w);
+            alpaka::syncBlockThreads(acc);
+            const uint32_t t = tile;
+            if(t == CELL_NONE) break;
+            for(uint32_t b = tiles.first[t]; b < tiles.first[t+1]; b++)
+                body.cell(acc, args..., b);
+            alpaka::syncBlockThreads(acc);
+        }
+        if(idx == 0)
+            tiles.finish(acc);
+    }
+};
+
+/** Cut blocks with the given weights into at most `ntiles'
+ *  runs of similar weight, and deal consecutive runs out to
+ *  `workers' deques of similar weight.
+ *
+ *  On return, tile t covers blocks [first[t], first[t+1]),
+ *  and worker w owns tiles [head[w], tail[w]).
+ */
+inline void deal_tiles(const std::vector<uint32_t> &weight,
+                       const uint32_t workers, const uint32_t ntiles,
+                       std::vector<uint32_t> &first,
+                       std::vector<uint32_t> &head, std::vector<uint32_t> &tail) {
+    double total = 0.0;
+    for(auto x : weight) total += x;
+
+    first.assign(1, 0);
+    std::vector<double> mid; // weight before the middle of each tile
+    double sum = 0.0, start = 0.0;
+    for(uint32_t b = 0; b < weight.size(); b++) {
+        sum += weight[b];
+        const bool last = b+1 == weight.size();
+        if(last || (first.size() < ntiles && sum >= total*first.size()/ntiles)) {
+            first.push_back(b+1);
+            mid.push_back(0.5*(start + sum));
+            start = sum;
+        }
+    }
+
+    head.assign(workers, 0);
+    tail.assign(workers, 0);
+    uint32_t t = 0;
+    for(uint32_t w = 0; w < workers; w++) {
+        head[w] = t;
+        while(t < mid.size() && (w+1 == workers || mid[t] < total*(w+1)/workers))
+            t++;
+        tail[w] = t;
+    }
+}
+
+/** Dynamic load balancing of cell kernels.
+ *
+ *  alpaka hands every CPU thread a fixed share of the blocks,
+ *  so threads owning dense cells finish last.  Kernels created
+ *  with a CellScheduler instead launch one block per worker.
+ *  Workers pull tiles of cells from their own deque and steal
+ *  from the others when it runs dry.
+ *
+ *  Tiles are cut by weight.  update(act, Q) weighs every listed
+ *  cell by 1 + occupancy^2, following the cost of its pairs.
+ *  Call it after every ActiveCells::update.
+ */
+template <typename Acc>
+class CellScheduler {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using IdxBuf = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
+        using DequeBuf = alpaka::Buf<Dev, unsigned long long, Dim, Idx>;
+
+        const Dev &devAcc;
+        const Idx workers;    // blocks launched
+        const Idx per_worker; // tiles cut per worker
+        Idx nblocks;          // blocks tiled by the last update()
+
+        CellScheduler(const Dev &devAcc_,
+                      const Idx workers_ = std::max(1u, std::thread::hardware_concurrency()),
+                      const Idx per_worker_ = 8)
+            : devAcc(devAcc_), workers(workers_), per_worker(per_worker_), nblocks(0)
+            , first( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, workers_*per_worker_ + 1)} )
+            , q( DequeBuf{alpaka::allocBuf<unsigned long long, Idx>(devAcc_, workers_)} )
+            , q0( DequeBuf{alpaka::allocBuf<unsigned long long, Idx>(devAcc_, workers_)} )
+            , done( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(1))} ) {}
+
+        /// Tile blocks [0, count) with equal weights.
+        template <typename Queue>
+        void update(const Idx count, Queue &Q) {
+            update(std::vector<uint32_t>(count, 1), Q);
+        }
+
+        /// Tile the cells listed by act, weighted by occupancy.
+        template <typename Queue>
+        void update(const ActiveCells<Acc> &act, Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            const Idx n = act.size(Q);
+            auto occ = alpaka::allocBuf<uint32_t, Idx>(devHost, act.ncells);
+            auto lst = alpaka::allocBuf<uint32_t, Idx>(devHost, n);
+            alpaka::memcpy(Q, occ, act.occupancy(), act.ncells);
+            alpaka::memcpy(Q, lst, act.list(), n);
+            alpaka::wait(Q);
+
+            std::vector<uint32_t> weight(n);
+            for(Idx b = 0; b < n; b++) {
+                const uint32_t c = alpaka::getPtrNative(occ)[alpaka::getPtrNative(lst)[b]];
+                weight[b] = 1 + c*c;
+            }
+            update(weight, Q);
+        }
+
+        /// Tile blocks [0, weight.size()) by weight.  Waits on Q.
+        template <typename Queue>
+        void update(const std::vector<uint32_t> &weight, Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            std::vector<uint32_t> f, head, tail;
+            deal_tiles(weight, workers, workers*per_worker, f, head, tail);
+            nblocks = weight.size();
+
+            std::vector<unsigned long long> s(workers);
+            for(Idx w = 0; w < workers; w++)
+                s[w] = head[w] | (uint64_t(tail[w]) << 32);
+
+            alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vf(
+                    f.data(), devHost, Idx(f.size()));
+            alpaka::ViewPlainPtr<alpaka::DevCpu, unsigned long long, Dim, Idx> vs(
+                    s.data(), devHost, workers);
+            alpaka::memcpy(Q, first, vf, Idx(f.size()));
+            alpaka::memcpy(Q, q0, vs, workers);
+            alpaka::memcpy(Q, q, vs, workers);
+            alpaka::memset(Q, done, 0, Idx(1));
+            alpaka::wait(Q);
+        }
+
+        ///! Return the device-side deques.
+        TileDeques device() {
+            return TileDeques{alpaka::getPtrNative(first), alpaka::getPtrNative(q),
+                              alpaka::getPtrNative(q0), alpaka::getPtrNative(done),
+                              uint32_t(workers)};
+        }
+
+        alpaka::WorkDivMembers<Dim, Idx> workDiv() const {
+            return cellWorkDiv<Dim,Idx>(devAcc, workers);
+        }
+
+    private:
+        IdxBuf first;
+        DequeBuf q, q0;
+        IdxBuf done;
+};
+
+/** Create a 1-body operation over the blocks tiled by sched.
+ */
+template <typename Oper1, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk1Body(const Dev &devAcc, const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out,
+             CellScheduler<Acc> &sched) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(X) == alpaka::extent::getExtent<0>(out) );
+    assert( sched.nblocks <= alpaka::extent::getExtent<0>(X) );
+
+    std::cout << "Creating 1-body kernel for " << sched.nblocks << " cells on "
+              << sched.workers << " workers.\n";
+    Oper1Kernel<Oper1,Vec> body{};
+    return alpaka::createTaskKernel<Acc>(sched.workDiv(), StealKernel<decltype(body)>{body},
+                sched.device(), alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+/** Create a 1-body operation over the cells listed by act.
+ *  sched must have been updated from act.
+ */
+template <typename Oper1, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk1Body(const Dev &devAcc, const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper1::Output, Dim, Idx> &out,
+             const ActiveCells<Acc> &act, CellScheduler<Acc> &sched) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( act.ncells == alpaka::extent::getExtent<0>(X) );
+    assert( act.ncells == alpaka::extent::getExtent<0>(out) );
+    assert( sched.nblocks <= act.ncells );
+
+    std::cout << "Creating 1-body kernel for " << sched.nblocks << " active cells on "
+              << sched.workers << " workers.\n";
+    Oper1Kernel<Oper1,Vec> body{0, alpaka::getPtrNative(act.list())};
+    return alpaka::createTaskKernel<Acc>(sched.workDiv(), StealKernel<decltype(body)>{body},
+                sched.device(), alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+/** Create a 2-body operation over the cells tiled by sched.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev>
+auto mk2Body(const Dev &devAcc, const CellSorter &srt,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out,
+             CellScheduler<Acc> &sched) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    // Spaces must match.
+    assert( alpaka::extent::getExtent<0>(X) == alpaka::extent::getExtent<0>(out) );
+    assert( sched.nblocks <= srt.cells );
+
+    std::cout << "Creating 2-body kernel for " << sched.nblocks << " cells on "
+              << sched.workers << " workers.\n";
+    Oper2Kernel<Oper2,Vec> body{};
+    return alpaka::createTaskKernel<Acc>(sched.workDiv(), StealKernel<decltype(body)>{body},
+                sched.device(), BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+/** Create a 2-body operation over the cells listed by act.
+ *  sched must have been updated from act.
+ */
+template <typename Oper2, typename Acc, typename Dim, typename Idx, typename Dev, typename Grid>
+auto mk2Body(const Dev &devAcc, const Grid &grid,
+             const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+             const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+             alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx> &out,
+             const ActiveCells<Acc> &act, CellScheduler<Acc> &sched) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+    using Cells = decltype(act.device(grid));
+
+    // Spaces must match.
+    assert( act.ncells == alpaka::extent::getExtent<0>(X) );
+    assert( act.ncells == alpaka::extent::getExtent<0>(out) );
+    assert( sched.nblocks <= act.ncells );
+
+    std::cout << "Creating 2-body kernel for " << sched.nblocks << " active cells on "
+              << sched.workers << " workers.\n";
+    Oper2Kernel<Oper2,Vec,Cells> body{};
+    return alpaka::createTaskKernel<Acc>(sched.workDiv(), StealKernel<decltype(body)>{body},
+                sched.device(), act.device(grid), alpaka::getPtrNative(nbr),
+                alpaka::getPtrNative(X), alpaka::getPtrNative(X), alpaka::getPtrNative(out));
+}
+
+}
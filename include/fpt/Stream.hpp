@@ -0,0 +1,170 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+#include <fpt/Domain.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace fpt {
+
+/** Pair kernels over a box too large for device memory.
+ *
+ *  The cells stay in host memory (box.cells long, in CellSorter
+ *  order), which may be pinned, pageable or mmap'd.  pairs() walks
+ *  the box in z-slabs of `nz' layers.  Each slab is copied to the
+ *  device together with `ghost' layers on either side, the pair
+ *  kernel runs on it, and the owned part of its output is copied
+ *  back.  Two stages alternate, each on its own queue, so the copies
+ *  for one slab overlap the kernel of the other.  Device memory use
+ *  is two slabs of cells and outputs, whatever the size of the box.
+ *
+ *  Copies only overlap kernels on GPUs when the host memory is pinned.
+ *
+ *  Within a stage, coordinates are stored relative to the bottom of
+ *  its lowest ghost layer.  Periodic images in z are shifted into place.
+ */
+template <typename Acc>
+class SlabStream {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using Vec = alpaka::Vec<Dim, Idx>;
+        using Queue = alpaka::Queue<Acc, alpaka::NonBlocking>;
+        template <typename T>
+        using Buf = alpaka::Buf<Dev, T, Dim, Idx>;
+
+        const CellSorter box;
+        const int ghost;
+        const int nz;    // owned layers per slab
+        const Idx layer; // cells per z-layer
+
+        SlabStream(const Dev &dev_, const CellSorter &box_, const float Rc, const int nz_)
+            : box(box_), ghost(ghost_layers(box_.list_cells(Rc)))
+            , nz(std::min(nz_, box_.n[2])), layer(box_.n[0]*box_.n[1])
+            , dev(dev_)
+            , srt(box_.L[0], box_.L[1], box_.L[2]/box_.n[2]*(nz + 2*ghost),
+                  box_.n[0], box_.n[1], nz + 2*ghost)
+            , stages{Stage(dev_, srt.cells), Stage(dev_, srt.cells)}
+            , nbr( Buf<CellRange>{alpaka::allocBuf<CellRange, Idx>(
+                            dev_, Idx(box_.list_cells(Rc).size()))} ) {
+            // Sheared boxes would need an x/y shift on the images.
+            assert(box.L[3] == 0.0 && box.L[4] == 0.0 && box.L[5] == 0.0);
+            assert(box.bc[2] != BC_REFLECT);
+            // Images of the far side come from within one box length.
+            assert(ghost <= box.n[2]);
+            srt.set_boundary(box.bc[0], box.bc[1], BC_OPEN);
+
+            const auto nbr_h = box.list_cells(Rc);
+            alpaka::memcpy(stages[0].q, nbr, nbr_h, Idx(nbr_h.size()));
+            alpaka::wait(stages[0].q);
+        }
+
+        /// Number of slabs covering the box.
+        int slabs() const {
+            return (box.n[2] + nz - 1)/nz;
+        }
+
+        /// First global layer owned by slab s.
+        int k0(const int s) const {
+            return s*nz;
+        }
+
+        /// Layers owned by slab s.
+        int layers(const int s) const {
+            return std::min(nz, box.n[2] - k0(s));
+        }
+
+        /** Start copying slab s and its ghost layers from host
+         *  into the cells of its stage.
+         */
+        void fetch(const int s, const Cell *host) {
+            auto &st = stages[s%2];
+            const float hz = box.L[2]/box.n[2];
+            const int lo = k0(s) - ghost;            // global layer of local layer 0
+            const int hi = k0(s) + layers(s) + ghost;
+
+            alpaka::memset(st.q, st.X, 0, Idx(srt.cells));
+            // runs of global layers [a, b) sharing one periodic image
+            for(int img = -1; img <= 1; img++) {
+                if(img != 0 && box.bc[2] != BC_PERIODIC) continue;
+                const int a = std::max(lo, img*box.n[2]);
+                const int b = std::min(hi, (img+1)*box.n[2]);
+                if(a >= b) continue;
+                load(st, host, a - img*box.n[2], a - lo, b - a,
+                     img*box.L[2] - lo*hz);
+            }
+        }
+
+        /// Cells of the stage holding slab s.
+        const Buf<Cell> &cells(const int s) const {
+            return stages[s%2].X;
+        }
+
+        /** Compute Oper2 over every cell of the host array `host'
+         *  and write the result to `out' (box.cells long).
+         *  Waits for completion.
+         */
+        template <typename Oper2>
+        void pairs(const Cell *host, typename Oper2::Output *out) {
+            using T = typename Oper2::Output;
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            std::vector<Buf<T>> res;
+            for(int b=0; b<2; b++)
+                res.emplace_back(alpaka::allocBuf<T, Idx>(dev, Idx(srt.cells)));
+
+            for(int s=0; s<slabs(); s++) {
+                auto &st = stages[s%2];
+                const Idx count = Idx(layers(s))*layer;
+                fetch(s, host);
+                alpaka::exec<Acc>(st.q, cellWorkDiv<Dim,Idx>(dev, count),
+                                  Oper2Kernel<Oper2,Vec>{Idx(ghost)*layer},
+                                  BoxCells{srt.device()}, alpaka::getPtrNative(nbr),
+                                  alpaka::getPtrNative(st.X), alpaka::getPtrNative(res[s%2]));
+
+                alpaka::ViewPlainPtr<alpaka::DevCpu, T, Dim, Idx> to(
+                        out + Idx(k0(s))*layer, devHost, Vec::all(count));
+                alpaka::ViewSubView<Dev, T, Dim, Idx> from(
+                        res[s%2], Vec::all(count), Vec::all(Idx(ghost)*layer));
+                alpaka::memcpy(st.q, to, from, Vec::all(count));
+            }
+            sync();
+        }
+
+        /// Wait for both stages.
+        void sync() {
+            for(auto &st : stages)
+                alpaka::wait(st.q);
+        }
+
+    private:
+        struct Stage {
+            Queue q;
+            Buf<Cell> X;
+            Stage(const Dev &dev, const Idx ncells)
+                : q(dev), X( Buf<Cell>{alpaka::allocBuf<Cell, Idx>(dev, ncells)} ) {}
+        };
+
+        Dev dev;
+        CellSorter srt; // stage grid, including ghost layers
+        Stage stages[2];
+        Buf<CellRange> nbr;
+
+        /// Copy global layers [k, k+nl) into local layers [l, l+nl), shifted by dz.
+        void load(Stage &st, const Cell *host, int k, int l, int nl, float dz) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            const Idx count = Idx(nl)*layer;
+            alpaka::ViewPlainPtr<alpaka::DevCpu, Cell, Dim, Idx> from(
+                    const_cast<Cell *>(host) + Idx(k)*layer, devHost, Vec::all(count));
+            alpaka::ViewSubView<Dev, Cell, Dim, Idx> to(
+                    st.X, Vec::all(count), Vec::all(Idx(l)*layer));
+            alpaka::memcpy(st.q, to, from, Vec::all(count));
+            alpaka::exec<Acc>(st.q, cellWorkDiv<Dim,Idx>(dev, count), ShiftCellsKernel{},
+                              alpaka::getPtrNative(st.X) + Idx(l)*layer, dz);
+        }
+};
+
+}
@@ -2,45 +2,353 @@
 
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
 #include <alpaka/alpaka.hpp>
+#ifdef FPT_PERF
+#include <fpt/Perf.hpp>
+#endif
+
+/** Instrumentation points.  They compile away unless FPT_PROFILE
+ *  is defined, so production builds pay nothing for them.
+ *
+ *    FPT_REGION("step");                       // until end of scope
+ *    FPT_ENQUEUE(queue, "pair energy", LJEnK); // time one kernel task
+ *    FPT_ENQUEUE_WORK(queue, "pair energy", LJEnK, pairs); // per-pair metrics
+ *
+ *  Defining FPT_PERF as well (Linux only) adds hardware counters
+ *  to kernel tasks on CPU devices.
+ */
+#define FPT_CAT2(a, b) a##b
+#define FPT_CAT(a, b) FPT_CAT2(a, b)
+#ifdef FPT_PROFILE
+#define FPT_REGION(name) fpt::Region FPT_CAT(fpt_region_, __LINE__)(name)
+#define FPT_ENQUEUE(queue, name, task) fpt::Profiler::get().enqueue(queue, name, task)
+#define FPT_ENQUEUE_WORK(queue, name, task, work) fpt::Profiler::get().enqueue(queue, name, task, work)
+#else
+#define FPT_REGION(name) ((void)0)
+#define FPT_ENQUEUE(queue, name, task) alpaka::enqueue(queue, task)
+#define FPT_ENQUEUE_WORK(queue, name, task, work) alpaka::enqueue(queue, task)
+#endif
 
 namespace fpt {
 
-struct Timed {
-    const char *name;
-    const std::chrono::time_point<std::chrono::steady_clock> beginT;
-    std::chrono::time_point<std::chrono::steady_clock> endT;
-    Timed(const char *name_) :
-        name(name_),
-        beginT(std::chrono::steady_clock::now()),
-        endT(beginT) {}
-    void stop() {
-        if(beginT == endT)
-            endT = std::chrono::steady_clock::now();
-    }
-    ~Timed() {
-        stop();
-        std::cout << "Time for " << name << ": "
-                  << std::chrono::duration<double>(endT - beginT).count() << 's'
-                  << std::endl;
-    }
+/// Summary of the samples of one region.
+struct RegionStats {
+    std::string path;
+    size_t count;
+    double total, min, median, p99; // seconds
+    /** Counter totals (FPT_PERF) by PerfSample::name, and "work",
+     *  the work items passed to Profiler::enqueue.
+     */
+    std::map<std::string, double> counters;
+};
+
+/** Registry of timed regions.
+ *
+ *  Regions nest: a region opened while another one is open on the
+ *  same thread is recorded under "outer/inner".  Every sample is
+ *  kept, both for the statistics and for the timeline written by
+ *  write_trace().
+ *
+ *  Kernel tasks are timed by enqueue(), which brackets the task
+ *  with queue events and waits on both.  This attributes time to
+ *  each task exactly, at the cost of draining the queue around it.
+ */
+class Profiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static Profiler &get() {
+            static Profiler prof;
+            return prof;
+        }
+
+        /// Open a region on this thread, returning its path.
+        std::string push(const std::string &name) {
+            auto &s = stack();
+            s.push_back(s.empty() ? name : s.back() + "/" + name);
+            return s.back();
+        }
+
+        /// Close the innermost region of this thread, opened at t0.
+        void pop(const Clock::time_point t0) {
+            auto &s = stack();
+            record(s.back(), t0, Clock::now(), HOST);
+            s.pop_back();
+        }
+
+        /** Enqueue a kernel task, and record its run time under `name'.
+         *  `work' (e.g. pairs evaluated) is summed for per-item metrics.
+         *  With FPT_PERF, tasks on CPU devices also record counters.
+         */
+        template <typename Queue, typename Task>
+        void enqueue(Queue &queue, const std::string &name, Task const &task,
+                     const double work = 0.0) {
+            using Event = alpaka::Event<Queue>;
+            Event start(alpaka::getDev(queue)), stop(alpaka::getDev(queue));
+            const std::string path = push(name);
+            alpaka::enqueue(queue, start);
+            alpaka::wait(start);
+#ifdef FPT_PERF
+            const bool cpu = std::is_same<alpaka::Dev<Queue>, alpaka::DevCpu>::value;
+            PerfSample c0;
+            if(cpu) c0 = perf.read();
+#endif
+            const auto t0 = Clock::now();
+            alpaka::enqueue(queue, task);
+            alpaka::enqueue(queue, stop);
+            alpaka::wait(stop);
+            const auto t1 = Clock::now();
+            std::map<std::string, double> args;
+#ifdef FPT_PERF
+            if(cpu) {
+                const PerfSample d = perf.read() - c0;
+                count(path, d);
+                for(int e = 0; e < PerfSample::EVENTS; e++)
+                    if(d.has(e)) args[PerfSample::name(e)] = d.count[e];
+            }
+#endif
+            record(path, t0, t1, KERNEL, work, args);
+            stack().pop_back();
+        }
+
+        /// Path a region named `name' would get on this thread.
+        std::string path(const std::string &name) const {
+            const auto &s = stack();
+            return s.empty() ? name : s.back() + "/" + name;
+        }
+
+        /// Statistics of one region.  count is 0 if it never ran.
+        RegionStats stats(const std::string &path) const {
+            std::lock_guard<std::mutex> lock(mtx);
+            const auto it = samples.find(path);
+            if(it == samples.end())
+                return RegionStats{path, 0, 0.0, 0.0, 0.0, 0.0, {}};
+            return summarize(path, it->second);
+        }
+
+        /// Statistics of every region, sorted by path.
+        std::vector<RegionStats> stats() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            std::vector<RegionStats> ans;
+            for(const auto &s : samples)
+                ans.push_back(summarize(s.first, s.second));
+            return ans;
+        }
+
+        /** Print a table of region statistics.  Regions with
+         *  counters get derived metrics on the following line.
+         */
+        void report(std::ostream &os) const {
+            os << "region count total min median p99 (s)\n";
+            for(const auto &s : stats()) {
+                os << s.path << ' ' << s.count << ' ' << s.total << ' '
+                   << s.min << ' ' << s.median << ' ' << s.p99 << '\n';
+#ifdef FPT_PERF
+                const auto c = [&](const char *key) {
+                    const auto it = s.counters.find(key);
+                    return it == s.counters.end() ? -1.0 : it->second;
+                };
+                if(c("task_clock") < 0.0) continue;
+                os << "   cpu_s " << c("task_clock")*1e-9;
+                if(c("cycles") > 0.0 && c("instructions") >= 0.0)
+                    os << " ipc " << c("instructions")/c("cycles");
+                if(c("instructions") > 0.0 && c("cache_misses") >= 0.0)
+                    os << " misses_per_kinst " << 1e3*c("cache_misses")/c("instructions");
+                if(c("instructions") > 0.0 && c("branch_misses") >= 0.0)
+                    os << " branch_misses_per_kinst " << 1e3*c("branch_misses")/c("instructions");
+                if(c("fp_packed") + c("fp_scalar") > 0.0 && c("fp_packed") >= 0.0 && c("fp_scalar") >= 0.0)
+                    os << " vector_share " << c("fp_packed")/(c("fp_packed") + c("fp_scalar"));
+                if(c("work") > 0.0 && c("cache_misses") >= 0.0)
+                    os << " bytes_per_work " << FPT_CACHE_LINE*c("cache_misses")/c("work");
+                if(c("work") > 0.0 && c("instructions") >= 0.0)
+                    os << " inst_per_work " << c("instructions")/c("work");
+                os << '\n';
+#endif
+            }
+        }
+
+        /** Write every sample as a Chrome trace ("X" events), for
+         *  chrome://tracing or Perfetto.  Host regions are on
+         *  thread 0, kernel tasks on thread 1.
+         */
+        void write_trace(std::ostream &os) const {
+            std::lock_guard<std::mutex> lock(mtx);
+            os << "{\"traceEvents\": [";
+            for(size_t i = 0; i < spans.size(); i++) {
+                const auto &e = spans[i];
+                os << (i == 0 ? "\n" : ",\n")
+                   << "  {\"name\": " << json_string(e.path) << ", \"cat\": \""
+                   << (e.tid == HOST ? "host" : "kernel")
+                   << "\", \"ph\": \"X\", \"ts\": " << e.ts
+                   << ", \"dur\": " << e.dur
+                   << ", \"pid\": 0, \"tid\": " << e.tid;
+                if(!e.args.empty()) {
+                    os << ", \"args\": {";
+                    for(auto it = e.args.begin(); it != e.args.end(); ++it)
+                        os << (it == e.args.begin() ? "" : ", ")
+                           << json_string(it->first) << ": " << it->second;
+                    os << '}';
+                }
+                os << '}';
+            }
+            os << "\n]}\n";
+        }
+
+        /// Forget all samples.
+        void clear() {
+            std::lock_guard<std::mutex> lock(mtx);
+            samples.clear();
+            counters.clear();
+            spans.clear();
+        }
+
+    private:
+        enum Track : int {HOST = 0, KERNEL = 1};
+        struct Span {
+            std::string path;
+            double ts, dur; // microseconds since epoch
+            int tid;
+            std::map<std::string, double> args;
+        };
+
+        mutable std::mutex mtx;
+        const Clock::time_point epoch = Clock::now();
+        std::map<std::string, std::vector<double>> samples;
+        std::map<std::string, std::map<std::string, double>> counters;
+        std::vector<Span> spans;
+#ifdef FPT_PERF
+        PerfCounters perf;
+
+        void count(const std::string &path, const PerfSample &d) {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto &c = counters[path];
+            for(int e = 0; e < PerfSample::EVENTS; e++)
+                if(d.has(e)) c[PerfSample::name(e)] += d.count[e];
+        }
+#endif
+
+        Profiler() = default;
+
+        /// s as a quoted JSON string.
+        static std::string json_string(const std::string &s) {
+            std::string ans = "\"";
+            for(const char ch : s) {
+                const unsigned char c = ch;
+                if(c == '"' || c == '\\') {
+                    ans += '\\';
+                    ans += ch;
+                } else if(c < 0x20) {
+                    const char *hex = "0123456789abcdef";
+                    ans += "\\u00";
+                    ans += hex[c >> 4];
+                    ans += hex[c & 15];
+                } else {
+                    ans += ch;
+                }
+            }
+            return ans + '"';
+        }
+
+        static std::vector<std::string> &stack() {
+            thread_local std::vector<std::string> s;
+            return s;
+        }
+
+        void record(const std::string &path, const Clock::time_point t0,
+                    const Clock::time_point t1, const int tid, const double work = 0.0,
+                    std::map<std::string, double> args = {}) {
+            const double dt = std::chrono::duration<double>(t1 - t0).count();
+            const double ts = std::chrono::duration<double, std::micro>(t0 - epoch).count();
+            if(work > 0.0)
+                args["work"] = work;
+            std::lock_guard<std::mutex> lock(mtx);
+            samples[path].push_back(dt);
+            if(work > 0.0)
+                counters[path]["work"] += work;
+            spans.push_back(Span{path, ts, dt*1e6, tid, args});
+        }
+
+        RegionStats summarize(const std::string &path, std::vector<double> v) const {
+            std::sort(v.begin(), v.end());
+            const size_t n = v.size();
+            double total = 0.0;
+            for(auto x : v) total += x;
+            // nearest-rank percentiles
+            const size_t p99 = size_t(std::ceil(0.99*n)) - 1;
+            const auto it = counters.find(path);
+            return RegionStats{path, n, total, v[0], v[(n-1)/2], v[p99],
+                               it == counters.end() ? std::map<std::string, double>{}
+                                                    : it->second};
+        }
 };
 
+/** Times the enclosing scope as a region of the Profiler.
+ */
+class Region {
+    public:
+        Region(const std::string &name)
+            : path(Profiler::get().push(name)), t0(Profiler::Clock::now()) {}
+        ~Region() {
+            Profiler::get().pop(t0);
+        }
+        const std::string path;
+
+    private:
+        const Profiler::Clock::time_point t0;
+};
+
+/** Time `calls' runs of fn, which enqueues work on queue.
+ *
+ *  By default the runs are enqueued back to back and waited for
+ *  once, so launches overlap as they would in a run.  The time
+ *  per run is printed.  With each_run, the queue is drained after
+ *  every run instead, and the median, min and p99 of the runs are
+ *  printed.  These include the launch latency the drain exposes.
+ *
+ *  The printed times are measured here.  With FPT_PROFILE, the
+ *  batch (or every run) is also recorded as the region `name'.
+ */
 template <typename Q, typename F>
-void time_kernel(Q queue, const std::string &name, F fn, int calls=1000) {
+void time_kernel(Q queue, const std::string &name, F fn, int calls=1000,
+                 const bool each_run=false) {
+    using Clock = std::chrono::steady_clock;
     std::cout << name << " (" << calls << " runs)" << std::endl;
 
-    { alpaka::wait(queue);
-      fpt::Timed timer(name.c_str());
-      for(int i=0; i<calls; i++) {
-        fn();
-      }
-      alpaka::wait(queue);
-      //GPUCheckErrors("streams execution error");
+    alpaka::wait(queue);
+    if(!each_run) {
+        const auto t0 = Clock::now();
+        {
+            FPT_REGION(name);
+            for(int i=0; i<calls; i++)
+                fn();
+            alpaka::wait(queue);
+        }
+        const double dt = std::chrono::duration<double>(Clock::now() - t0).count();
+        std::cout << "Time for " << name << ": " << dt/calls << "s per run" << std::endl;
+        return;
     }
-
-    //et1 = dtime_usec(et1);
-    //std::cout << "time per call (ms): " << et1/(calls*(float)USECPSEC/1000.0) << std::endl;
+    std::vector<double> v(calls);
+    for(int i=0; i<calls; i++) {
+        const auto t0 = Clock::now();
+        {
+            FPT_REGION(name);
+            fn();
+            alpaka::wait(queue);
+        }
+        v[i] = std::chrono::duration<double>(Clock::now() - t0).count();
+    }
+    // nearest-rank percentiles, as in Profiler::stats()
+    std::sort(v.begin(), v.end());
+    const size_t p99 = size_t(std::ceil(0.99*calls)) - 1;
+    std::cout << "Time for " << name << ": " << v[(calls-1)/2] << "s median, "
+              << v[0] << "s min, " << v[p99] << "s p99" << std::endl;
 }
 
 }
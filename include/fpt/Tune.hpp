@@ -0,0 +1,382 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Launch.hpp>
+#include <fpt/Sort.hpp>
+#include <fpt/Singles.hpp>
+#include <fpt/Pairs.hpp>
+#include <fpt/Active.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace fpt {
+
+/** Add every owned cell of X to hist[occupancy].
+ *  Launched with one block per owned cell.
+ */
+struct OccupancyKernel {
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<typename TAcc, typename Cells>
+    ALPAKA_FN_ACC void operator()(
+                TAcc const& acc,
+                const Cells cells,
+                const Cell *__restrict__ X,
+                uint32_t *__restrict__ hist
+                ) const {
+        auto const idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const threads = alpaka::getWorkDiv<alpaka::Block, alpaka::Threads>(acc)[0];
+        auto const bin = cells.home(alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0]);
+        auto &part = alpaka::declareSharedVar<uint32_t[ATOMS_PER_CELL], __COUNTER__>(acc);
+
+        uint32_t c = 0;
+        for(uint32_t m = idx; m < ATOMS_PER_CELL; m += threads)
+            c += X[bin].n[m] != 0;
+        part[idx] = c;
+        alpaka::syncBlockThreads(acc);
+
+        if(idx == 0) {
+            for(uint32_t t = 1; t < threads; t++)
+                c += part[t];
+            alpaka::atomicOp<alpaka::AtomicAdd>(acc, &hist[c], uint32_t(1));
+        }
+    }
+};
+
+/// Occupancy histogram of a cell buffer.
+struct Occupancy {
+    std::vector<uint32_t> hist; // hist[k] = cells holding k atoms, k <= ATOMS_PER_CELL
+    uint32_t dropped;           // atoms lost to full cells by the sorts counted
+
+    uint32_t cells() const {
+        uint32_t n = 0;
+        for(auto h : hist) n += h;
+        return n;
+    }
+
+    uint64_t atoms() const {
+        uint64_t n = 0;
+        for(size_t k = 0; k < hist.size(); k++)
+            n += k*uint64_t(hist[k]);
+        return n;
+    }
+
+    /// Most atoms in any cell.
+    uint32_t max() const {
+        uint32_t k = hist.size();
+        while(k > 0 && hist[k-1] == 0) k--;
+        return k > 0 ? k-1 : 0;
+    }
+
+    /// Fraction of atom slots in use.
+    double fill() const {
+        return cells() > 0 ? double(atoms()) / (double(cells())*ATOMS_PER_CELL) : 0.0;
+    }
+
+    /** No atom was dropped, and no cell is full, so
+     *  the next sort is unlikely to overflow.
+     */
+    bool safe() const {
+        return dropped == 0 && hist[ATOMS_PER_CELL] == 0;
+    }
+};
+
+/** Occupancy histogram and overflow count after a sort.
+ *
+ *  Sorters created with a CellDiagnostics count the atoms
+ *  they could not fit into a full cell.  update() histograms
+ *  the occupancy of a sorted buffer and reads that count.
+ */
+template <typename Acc>
+class CellDiagnostics {
+    public:
+        using Dim = alpaka::Dim<Acc>;
+        using Idx = alpaka::Idx<Acc>;
+        using Dev = alpaka::Dev<Acc>;
+        using IdxBuf = alpaka::Buf<Dev, uint32_t, Dim, Idx>;
+
+        const Dev &devAcc;
+
+        CellDiagnostics(const Dev &devAcc_)
+            : devAcc(devAcc_)
+            , hist( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(ATOMS_PER_CELL+1))} )
+            , drop( IdxBuf{alpaka::allocBuf<uint32_t, Idx>(devAcc_, Idx(1))} ) { }
+
+        /// Zero the overflow count.
+        template <typename Queue>
+        void reset(Queue &Q) {
+            alpaka::memset(Q, drop, 0, Idx(1));
+        }
+
+        /** Histogram the owned cells of X, and read the overflow
+         *  count of the sorts since the last reset().  Waits for Q.
+         */
+        template <typename Grid, typename Queue>
+        Occupancy update(const Grid &grid, const alpaka::Buf<Dev, Cell, Dim, Idx> &X, Queue &Q) {
+            const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+            auto h = alpaka::allocBuf<uint32_t, Idx>(devHost, Idx(ATOMS_PER_CELL+2));
+
+            alpaka::memset(Q, hist, 0, Idx(ATOMS_PER_CELL+1));
+            alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, Idx(owned_cells(grid))),
+                              OccupancyKernel{}, cell_index(grid),
+                              alpaka::getPtrNative(X), alpaka::getPtrNative(hist));
+            alpaka::ViewSubView<alpaka::DevCpu, uint32_t, Dim, Idx> hh(
+                    h, Idx(ATOMS_PER_CELL+1), Idx(0));
+            alpaka::ViewSubView<alpaka::DevCpu, uint32_t, Dim, Idx> hd(
+                    h, Idx(1), Idx(ATOMS_PER_CELL+1));
+            alpaka::memcpy(Q, hh, hist, Idx(ATOMS_PER_CELL+1));
+            alpaka::memcpy(Q, hd, drop, Idx(1));
+            alpaka::wait(Q);
+
+            const uint32_t *p = alpaka::getPtrNative(h);
+            return Occupancy{std::vector<uint32_t>(p, p + ATOMS_PER_CELL+1), p[ATOMS_PER_CELL+1]};
+        }
+
+        /// Device-side overflow counter, for sortAtomsKernel.
+        uint32_t *dropped() {
+            return alpaka::getPtrNative(drop);
+        }
+
+    private:
+        IdxBuf hist, drop;
+};
+
+/** Return a kernel sorting the atoms of X into Y (zeroed beforehand),
+ *  counting atoms lost to full cells into diag.
+ */
+template<typename Acc, typename Dim, typename Idx, typename Dev>
+auto mkSorter(const Dev &devAcc,
+              const CellSorter &srt,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+              alpaka::Buf<Dev, Cell, Dim, Idx> &Y,
+              CellDiagnostics<Acc> &diag) {
+    using Vec = alpaka::Vec<Dim,Idx>;
+
+    Idx const per = launch_cells<Acc>(devAcc, "sort", Idx(srt.cells));
+    auto const workDiv = cellWorkDiv<Dim,Idx>(devAcc, Idx(srt.cells), per);
+
+    std::cout << "Creating sorting kernel for " << srt.cells << " cells.\n";
+    sortAtomsKernel<Vec> K{BoxCells{srt.device()}, 0, diag.dropped(), srt.cells};
+    return alpaka::createTaskKernel<Acc>(workDiv, K,
+                alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+}
+
+/// One grid tried by tune_cells.
+struct CellCandidate {
+    CellSorter srt;
+    float width;     // cell width, in units of the cutoff
+    size_t stencil;  // neighbor cells per cell
+    Occupancy occ;
+    double seconds;  // per run of the 2-body kernel
+};
+
+/** Try cell grids over the box of `box' and return them,
+ *  safe ones first, each group fastest first.
+ *
+ *  Every candidate has cells about width*Rc wide along each
+ *  axis.  Narrow cells hold fewer atoms, at the cost of more
+ *  neighbor cells per cell.  The atoms of `atoms' (any cell
+ *  layout) are sorted onto each grid, the occupancy checked,
+ *  and Oper2 timed over `iters' runs.  A grid is safe when the
+ *  sort dropped nothing and no cell is full.
+ *
+ *  Use front().srt, if front().occ.safe().
+ */
+template <typename Acc, typename Oper2 = LJEnOper, typename Queue>
+std::vector<CellCandidate> tune_cells(const alpaka::Dev<Acc> &devAcc, Queue &Q,
+                                      const CellSorter &box, const float Rc,
+                                      const std::vector<Cell> &atoms, const int iters = 10,
+                                      const std::vector<float> &widths = {1.0f, 0.75f, 0.5f, 0.4f, 1.0f/3}) {
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Dev = alpaka::Dev<Acc>;
+    using Vec = alpaka::Vec<Dim, Idx>;
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+
+    std::vector<Cell> packed; // atoms, in any order
+    uint64_t natoms = 0;
+    for(const auto &c : atoms) {
+        for(int m = 0; m < ATOMS_PER_CELL; m++) {
+            if(c.n[m] == 0) continue;
+            if(natoms % ATOMS_PER_CELL == 0) {
+                packed.emplace_back();
+                for(int k = 0; k < ATOMS_PER_CELL; k++)
+                    packed.back().n[k] = 0;
+            }
+            Cell &p = packed.back();
+            const int k = natoms % ATOMS_PER_CELL;
+            p.n[k] = c.n[m];
+            p.x[k] = c.x[m];
+            p.y[k] = c.y[m];
+            p.z[k] = c.z[m];
+            natoms++;
+        }
+    }
+
+    std::vector<CellCandidate> ans;
+    std::vector<int> seen;
+    CellDiagnostics<Acc> diag(devAcc);
+    for(const float w : widths) {
+        int n[3];
+        for(int a = 0; a < 3; a++)
+            n[a] = std::max(1, int(box.L[a] / (w*Rc)));
+        if(std::find(seen.begin(), seen.end(), n[0] + 1024*(n[1] + 1024*n[2])) != seen.end())
+            continue;
+        seen.push_back(n[0] + 1024*(n[1] + 1024*n[2]));
+
+        CellSorter srt(box.L[0], box.L[1], box.L[2], n[0], n[1], n[2],
+                       box.L[3], box.L[4], box.L[5]);
+        srt.set_boundary(box.bc[0], box.bc[1], box.bc[2]);
+        const Idx ncells = srt.cells;
+        if(packed.size() > ncells) // can not hold every atom
+            continue;
+
+        const auto nbr_h = srt.list_cells(Rc);
+        size_t stencil = 0;
+        for(const auto &r : nbr_h)
+            if(r.i0 <= r.i1) stencil += r.i1 - r.i0 + 1;
+
+        auto X = alpaka::Buf<Dev, Cell, Dim, Idx>{alpaka::allocBuf<Cell, Idx>(devAcc, ncells)};
+        auto Y = alpaka::Buf<Dev, Cell, Dim, Idx>{alpaka::allocBuf<Cell, Idx>(devAcc, ncells)};
+        auto out = alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx>{
+                alpaka::allocBuf<typename Oper2::Output, Idx>(devAcc, ncells)};
+        auto nbr = alpaka::Buf<Dev, CellRange, Dim, Idx>{
+                alpaka::allocBuf<CellRange, Idx>(devAcc, Idx(nbr_h.size()))};
+        alpaka::memset(Q, X, 0, ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, Cell, Dim, Idx> view(
+                packed.data(), devHost, Idx(packed.size()));
+        alpaka::ViewSubView<Dev, Cell, Dim, Idx> head(X, Idx(packed.size()), Idx(0));
+        alpaka::memcpy(Q, head, view, Idx(packed.size()));
+        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+
+        const auto workDiv = cellWorkDiv<Dim,Idx>(devAcc, ncells);
+        const BoxCells cells{srt.device()};
+        alpaka::memset(Q, Y, 0, ncells);
+        diag.reset(Q);
+        alpaka::exec<Acc>(Q, workDiv, sortAtomsKernel<Vec>{cells, 0, diag.dropped()},
+                          alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+        const Occupancy occ = diag.update(srt, Y, Q);
+
+        alpaka::exec<Acc>(Q, workDiv, Oper2Kernel<Oper2,Vec>{}, cells, // warm-up
+                          alpaka::getPtrNative(nbr), alpaka::getPtrNative(Y),
+                          alpaka::getPtrNative(out));
+        alpaka::wait(Q);
+        const auto t0 = std::chrono::steady_clock::now();
+        for(int it = 0; it < iters; it++)
+            alpaka::exec<Acc>(Q, workDiv, Oper2Kernel<Oper2,Vec>{}, cells,
+                              alpaka::getPtrNative(nbr), alpaka::getPtrNative(Y),
+                              alpaka::getPtrNative(out));
+        alpaka::wait(Q);
+        const auto t1 = std::chrono::steady_clock::now();
+
+        ans.push_back(CellCandidate{srt, w, stencil, occ,
+                      std::chrono::duration<double>(t1 - t0).count() / std::max(1, iters)});
+    }
+
+    // CellSorter can not be assigned, so sort an index.
+    std::vector<size_t> order(ans.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](const size_t i, const size_t j) {
+        if(ans[i].occ.safe() != ans[j].occ.safe()) return ans[i].occ.safe();
+        return ans[i].seconds < ans[j].seconds;
+    });
+    std::vector<CellCandidate> sorted;
+    for(auto i : order)
+        sorted.push_back(ans[i]);
+    return sorted;
+}
+
+/// One launch shape timed by tune_launch.
+struct LaunchCandidate {
+    std::string kind;   // "sort", "1body" or "2body"
+    uint32_t per_block; // cells per block
+    double seconds;     // per run
+};
+
+/** Pick the work division of mkSorter, mk1Body and mk2Body
+ *  on devAcc, once per kind of kernel.
+ *
+ *  The sort, a 1-body kernel (ZeroEnOper) and Oper2 are timed
+ *  over `iters' runs on the atoms of X, sorted on srt with the
+ *  cell list nbr, for every candidate number of cells per block.
+ *  The fastest of each kind goes into the LaunchCache, which
+ *  kernels created afterwards read.  Kinds already in the cache
+ *  are skipped: LaunchCache::get().clear() to tune again.
+ *
+ *  Returns every timing, fastest first within each kind.
+ */
+template <typename Acc, typename Oper2 = LJEnOper, typename Queue, typename Dim, typename Idx, typename Dev>
+std::vector<LaunchCandidate> tune_launch(const Dev &devAcc, Queue &Q, const CellSorter &srt,
+                                         const alpaka::Buf<Dev, CellRange, Dim, Idx> &nbr,
+                                         const alpaka::Buf<Dev, Cell, Dim, Idx> &X,
+                                         const int iters = 10,
+                                         const std::vector<uint32_t> &per_block = {1, 2, 4, 16, 64, 256}) {
+    using Vec = alpaka::Vec<Dim, Idx>;
+    const Idx ncells = srt.cells;
+    assert( alpaka::extent::getExtent<0>(X) == ncells );
+
+    auto Y = alpaka::Buf<Dev, Cell, Dim, Idx>{alpaka::allocBuf<Cell, Idx>(devAcc, ncells)};
+    auto en = alpaka::Buf<Dev, CellEnergy, Dim, Idx>{alpaka::allocBuf<CellEnergy, Idx>(devAcc, ncells)};
+    auto out = alpaka::Buf<Dev, typename Oper2::Output, Dim, Idx>{
+            alpaka::allocBuf<typename Oper2::Output, Idx>(devAcc, ncells)};
+    const BoxCells cells{srt.device()};
+
+    // Seconds per run of launch(per), which enqueues one kernel.
+    auto time = [&](auto launch, const Idx per, const bool zeroY) {
+        double total = 0.0;
+        for(int it = -1; it < iters; it++) { // run -1 is a warm-up
+            if(zeroY) alpaka::memset(Q, Y, 0, ncells);
+            alpaka::wait(Q);
+            const auto t0 = std::chrono::steady_clock::now();
+            launch(per);
+            alpaka::wait(Q);
+            const auto t1 = std::chrono::steady_clock::now();
+            if(it >= 0) total += std::chrono::duration<double>(t1 - t0).count();
+        }
+        return total / std::max(1, iters);
+    };
+
+    std::vector<LaunchCandidate> ans;
+    auto tune = [&](const std::string &kind, auto launch, const bool zeroY) {
+        const std::string key = LaunchCache::key<Acc>(devAcc, kind);
+        if(LaunchCache::get().find(key) != 0) return;
+        const size_t first = ans.size();
+        Idx last = 0; // blocks launched by the last candidate
+        for(const uint32_t p : per_block) {
+            const Idx blocks = p == 0 ? 0 : (ncells + p - 1)/p;
+            if(blocks == 0 || blocks == last) continue;
+            last = blocks;
+            ans.push_back(LaunchCandidate{kind, p, time(launch, Idx(p), zeroY)});
+        }
+        std::stable_sort(ans.begin() + first, ans.end(),
+                [](const LaunchCandidate &a, const LaunchCandidate &b) {
+                    return a.seconds < b.seconds;
+                });
+        if(ans.size() > first)
+            LaunchCache::get().set(key, ans[first].per_block);
+    };
+
+    tune("sort", [&](const Idx per) {
+        alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, ncells, per),
+                          sortAtomsKernel<Vec>{cells, 0, nullptr, uint32_t(ncells)},
+                          alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+    }, true);
+    tune("1body", [&](const Idx per) {
+        alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, ncells, per),
+                          Oper1Kernel<ZeroEnOper,Vec>{0, nullptr, uint32_t(ncells)},
+                          alpaka::getPtrNative(X), alpaka::getPtrNative(en));
+    }, false);
+    tune("2body", [&](const Idx per) {
+        alpaka::exec<Acc>(Q, cellWorkDiv<Dim,Idx>(devAcc, ncells, per),
+                          Oper2Kernel<Oper2,Vec>{0, uint32_t(ncells)}, cells,
+                          alpaka::getPtrNative(nbr), alpaka::getPtrNative(X),
+                          alpaka::getPtrNative(out));
+    }, false);
+    return ans;
+}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <fpt/Cell.hpp>
+#include <fpt/Pairs.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace fpt { namespace test {
+
+/// Counts the atoms within unit distance of each atom.
+struct NearOper {
+    using Output = fpt::CellEnergy;
+    using Accum = double[1];
+
+    static inline ALPAKA_FN_ACC void pair(Accum c, float dx, float dy, float dz) {
+        c[0] += dx*dx + dy*dy + dz*dz < 1.0f;
+    }
+    static inline ALPAKA_FN_ACC void finalize(Output &E, Accum c, uint32_t n, int j) {
+        E.n[j] = n;
+        E.en[j] = n != 0 ? c[0] : 0.0;
+    }
+};
+
+/** Atoms a+1 = 1, 2, ... at random positions in [0,L) along
+ *  each axis, with brute-force references for the pair kernels.
+ */
+struct Atoms {
+    std::vector<float> x, y, z;
+
+    Atoms(const int natoms, const float Lx, const float Ly, const float Lz, uint32_t seed = 7)
+        : x(natoms), y(natoms), z(natoms) {
+        auto uniform = [&](const float L) {
+            seed = seed*1664525u + 1013904223u;
+            return L*float(seed >> 8)/float(1u << 24);
+        };
+        for(int a=0; a<natoms; a++) {
+            x[a] = uniform(Lx);
+            y[a] = uniform(Ly);
+            z[a] = uniform(Lz);
+        }
+    }
+
+    int size() const {
+        return x.size();
+    }
+
+    /** Bin every atom into the next free slot of its cell of srt.
+     *  Slots are filled from the top, so the kernels see holes.
+     */
+    std::vector<fpt::Cell> cells(const fpt::CellSorter &srt) const {
+        const auto box = srt.device();
+        std::vector<fpt::Cell> X(srt.cells);
+        for(auto &c : X)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                c.n[m] = 0;
+        for(int a=0; a<size(); a++) {
+            fpt::Cell &c = X[box.calcBinF(x[a], y[a], z[a])];
+            int m = ATOMS_PER_CELL-1;
+            while(m >= 0 && c.n[m] != 0) m--;
+            if(m < 0) continue;
+            c.n[m] = a + 1;
+            c.x[m] = x[a];
+            c.y[m] = y[a];
+            c.z[m] = z[a];
+        }
+        return X;
+    }
+
+    /** Atoms within unit distance of each atom, over the
+     *  nearest image along the periodic axes of srt.
+     */
+    std::vector<double> near(const fpt::CellSorter &srt) const {
+        return near(*this, srt, true);
+    }
+
+    /// Atoms of `far' within unit distance of each atom, the same way.
+    std::vector<double> near(const Atoms &far, const fpt::CellSorter &srt,
+                             const bool same = false) const {
+        std::vector<double> count(size(), 0.0);
+        for(int a=0; a<size(); a++)
+            for(int b=0; b<far.size(); b++) {
+                if(same && a == b) continue;
+                const float d[3] = {x[a]-far.x[b], y[a]-far.y[b], z[a]-far.z[b]};
+                float r2 = 0.0f;
+                for(int k=0; k<3; k++) {
+                    float dk = d[k];
+                    if(srt.bc[k] == fpt::BC_PERIODIC)
+                        dk -= srt.L[k]*std::round(dk/srt.L[k]);
+                    r2 += dk*dk;
+                }
+                count[a] += r2 < 1.0f;
+            }
+        return count;
+    }
+};
+
+/** Number of atoms in X whose NearOper count in en differs from
+ *  `near', or that are missing from X.  X and en are indexed alike.
+ */
+inline int near_mismatches(const std::vector<fpt::Cell> &X, const std::vector<fpt::CellEnergy> &en,
+                           const std::vector<double> &near) {
+    int bad = 0;
+    std::vector<int> seen(near.size(), 0);
+    for(size_t c=0; c<X.size(); c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++) {
+            const uint32_t n = X[c].n[m];
+            if(n == 0) continue;
+            seen[n-1]++;
+            bad += en[c].n[m] != n || en[c].en[m] != near[n-1];
+        }
+    for(const int s : seen)
+        bad += s != 1;
+    return bad;
+}
+
+} }
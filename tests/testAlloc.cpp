@@ -3,6 +3,9 @@
 #include <fpt/Alloc.hpp>
 #include "TestAlpaka.hpp"
 
+#include <random>
+#include <vector>
+
 TEST_CASE( "allocator indices", "[allocator]") {
     uint32_t N = 540;
 
@@ -18,6 +21,78 @@ TEST_CASE( "allocator indices", "[allocator]") {
             }
         }
     }
+
+    SECTION( "fpt::searchNext covers more than 2^16 blocks" ) {
+        const uint32_t N2 = 3*(1u<<20) + 7;
+        const int bins = 256;
+        const uint32_t trials = 1u<<16;
+        std::vector<double> hist(bins, 0.0);
+        uint32_t top = 0;
+
+        for(uint32_t blockId = 0; blockId < trials; blockId++) {
+            uint32_t next = fpt::searchNext(blockId, blockId, N2);
+            REQUIRE(next < N2);
+            hist[uint64_t(next)*bins/N2] += 1.0;
+            top = next > top ? next : top;
+        }
+        REQUIRE(top > N2 - N2/100);
+
+        // chi^2 with 255 degrees of freedom (mean 255, sd ~ 23)
+        const double expect = double(trials)/bins;
+        double chi2 = 0.0;
+        for(double x : hist) chi2 += (x-expect)*(x-expect)/expect;
+        REQUIRE(chi2 < 400.0);
+    }
+}
+
+/* Fill a pool of N blocks up to fraction `fill`, one block per
+ * simulated warp, probing one free-list word at a time.
+ * `next` maps (probe state, warp) to the next probe state.
+ * Returns the mean number of probes over the last 5% of allocations,
+ * or a negative number if some warp needed more than 1000 probes.
+ */
+template <typename F>
+double fill_probes(uint32_t N, double fill, F next) {
+    std::vector<uint32_t> frl((N+31)/32, 0xFFFFFFFFu);
+    const uint32_t target = fill*N;
+    const uint32_t tail = (fill-0.05)*N;
+    double probes = 0.0;
+    uint32_t used = 0, counted = 0;
+
+    for(uint32_t blockId = 0; used < target; blockId++) {
+        uint32_t h = blockId;
+        int p;
+        for(p = 1; p <= 1000; p++) {
+            h = next(h, blockId);
+            uint32_t m = fpt::probeIndex(h, N) / 32;
+            if(frl[m] != 0) {
+                frl[m] &= frl[m] - 1; // claim lowest free bit
+                break;
+            }
+        }
+        if(p > 1000) return -1.0;
+        if(++used > tail) {
+            probes += p;
+            counted++;
+        }
+    }
+    return probes / counted;
+}
+
+TEST_CASE( "allocator probe sequence does not cluster", "[allocator]") {
+    const uint32_t N = 1u<<18; // beyond the old 2^16 limit
+
+    for(double fill : {0.9, 0.95, 0.99}) {
+        std::mt19937 rng(1729);
+        double ideal = fill_probes(N, fill, [&](uint32_t, uint32_t) {
+                            return uint32_t(rng()); });
+        double hashed = fill_probes(N, fill, fpt::probeHash);
+
+        INFO( "fill = " << fill << ", ideal = " << ideal
+                        << ", probeHash = " << hashed );
+        REQUIRE( hashed > 0.0 );
+        REQUIRE( hashed < 1.25*ideal );
+    }
 }
 
 template <typename Dev>
@@ -38,10 +113,99 @@ public:
         const auto idx = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
         //std::int32_t const warpExtent = alpaka::warp::getSize(acc);
 
-        ALPAKA_CHECK(*success, false);
         for(int i=0; i<32; i++) {
             uint32_t k = idx*32 + i;
-            ALPAKA_CHECK(*success, alloc.is_free(idx*32 + i) == (k >= N0) && (k < alloc.N));
+            ALPAKA_CHECK(*success, alloc.is_free(k) == (k >= N0 && k < alloc.N));
+        }
+    }
+};
+
+template <typename Dev>
+class AllocOnceKernel
+{
+public:
+    //-----------------------------------------------------------------------------
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<
+        typename TAcc>
+    ALPAKA_FN_ACC auto operator()(
+        TAcc const & acc,
+        bool * success,
+        bool expect_fail,
+        fpt::Alloc_d<int,Dev> alloc) const
+    -> void
+    {
+        const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+
+        uint32_t n = alloc.alloc(acc, blk);
+        if(expect_fail) {
+            ALPAKA_CHECK(*success, n == ALLOC_FAIL);
+        } else {
+            ALPAKA_CHECK(*success, n < alloc.N);
+            ALPAKA_CHECK(*success, !alloc.is_free(n));
+            if(idx == 0) {
+                alloc[n] = n; // tag the block with its original index
+            }
+        }
+    }
+};
+
+template <typename Dev>
+class AllocBatchKernel
+{
+public:
+    //-----------------------------------------------------------------------------
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<
+        typename TAcc>
+    ALPAKA_FN_ACC auto operator()(
+        TAcc const & acc,
+        bool * success,
+        bool release,
+        fpt::Alloc_d<int,Dev> alloc) const
+    -> void
+    {
+        const auto idx = alpaka::getIdx<alpaka::Block, alpaka::Threads>(acc)[0];
+        const auto blk = alpaka::getIdx<alpaka::Grid, alpaka::Blocks>(acc)[0];
+        std::int32_t const warpExtent = alpaka::warp::getSize(acc);
+
+        uint32_t n = alloc.alloc_batch(acc, blk, true);
+        ALPAKA_CHECK(*success, n < alloc.N);
+        ALPAKA_CHECK(*success, !alloc.is_free(n));
+        for(int j=0; j<warpExtent; j++) { // all lanes got distinct blocks
+            uint32_t nj = alpaka::warp::shfl(acc, n, j);
+            ALPAKA_CHECK(*success, (nj == n) == (j == idx));
+        }
+        if(release) { // other warps may take n back at once: count_free checks
+            alloc.free_batch(acc, n, true);
+        }
+    }
+};
+
+template <typename Dev>
+class RelocCheckKernel
+{
+public:
+    //-----------------------------------------------------------------------------
+    ALPAKA_NO_HOST_ACC_WARNING
+    template<
+        typename TAcc>
+    ALPAKA_FN_ACC auto operator()(
+        TAcc const & acc,
+        bool * success,
+        uint32_t L,
+        fpt::Alloc_d<int,Dev> alloc,
+        const uint32_t *reloc) const
+    -> void
+    {
+        const auto idx = alpaka::getIdx<alpaka::Grid, alpaka::Threads>(acc)[0];
+
+        for(int i=0; i<32; i++) {
+            uint32_t k = idx*32 + i;
+            if(k >= alloc.N || reloc[k] == ALLOC_FAIL) continue;
+            ALPAKA_CHECK(*success, reloc[k] < L);
+            ALPAKA_CHECK(*success, alloc[reloc[k]] == int(k));
         }
     }
 };
@@ -67,6 +231,7 @@ TEMPLATE_LIST_TEST_CASE( "fpt::Alloc returns empty block", "[warp]", alpaka::tes
     alpaka::wait(Q);
 
     auto const warpExtent = alpaka::getWarpSize(dev);
+    auto const M0 = A.M;
 
     using ExecutionFixture = alpaka::test::KernelExecutionFixture<Acc,Queue>;
     // Enforce one warp per thread block
@@ -79,11 +244,62 @@ TEMPLATE_LIST_TEST_CASE( "fpt::Alloc returns empty block", "[warp]", alpaka::tes
     SECTION( "fpt::Alloc.reinit initializes correctly" ) {
         EmptyTestKernel<Dev> kernel;
         REQUIRE( fixture( kernel, N0, A.device() ) );
+        REQUIRE( A.count_free(Q) == N - N0 );
+    }
+    SECTION( "fpt::Alloc.alloc finds the last free blocks" ) {
+        // exactly one free block per warp, all at the end of the pool
+        AllocOnceKernel<Dev> kernel;
+        A.reinit(N - M0, Q);
+        REQUIRE( fixture( kernel, false, A.device() ) );
+        REQUIRE( A.failures(Q) == 0 );
+        REQUIRE( A.count_free(Q) == 0 );
+    }
+    SECTION( "fpt::Alloc.alloc_batch serves every lane" ) {
+        AllocBatchKernel<Dev> kernel;
+        const uint32_t taken = M0*warpExtent;
+        REQUIRE( fixture( kernel, false, A.device() ) );
+        REQUIRE( A.count_free(Q) == N - N0 - taken );
+        REQUIRE( fixture( kernel, true, A.device() ) ); // alloc + free_batch
+        REQUIRE( A.count_free(Q) == N - N0 - taken );
+        REQUIRE( A.failures(Q) == 0 );
+    }
+    SECTION( "fpt::Alloc.compact packs allocated blocks" ) {
+        A.reinit(0, Q);
+        AllocOnceKernel<Dev> kernel; // M0 scattered blocks
+        REQUIRE( fixture( kernel, false, A.device() ) );
+
+        typename fpt::Alloc<int,Acc>::FreeDev reloc{
+                    alpaka::allocBuf<uint32_t, Idx>(dev, A.N)};
+        const uint32_t L = A.compact(reloc, Q);
+        REQUIRE( L == M0 );
+
+        EmptyTestKernel<Dev> packed;
+        REQUIRE( fixture( packed, L, A.device() ) );
+        RelocCheckKernel<Dev> moved;
+        REQUIRE( fixture( moved, L, A.device(), alpaka::getPtrNative(reloc) ) );
+
+        A.shrink(L, Q);
+        REQUIRE( A.N == L );
+        REQUIRE( A.count_free(Q) == 0 );
     }
     SECTION( "fpt::Alloc.alloc test" ) {
         //EmptyTestKernel<Dev> kernel;
         //REQUIRE( fixture( kernel, N0, A.device() ) );
     }
+    SECTION( "fpt::Alloc.alloc reports OOM and recovers after grow" ) {
+        AllocOnceKernel<Dev> kernel;
+        A.reinit(N, Q); // every block in use
+        REQUIRE( fixture( kernel, true, A.device() ) );
+        REQUIRE( A.failures(Q) == M0 );
+
+        A.grow(8*N, Q); // blocks [N, 8N) are now free
+        REQUIRE( A.N == 8*N );
+        REQUIRE( fixture( kernel, false, A.device() ) );
+        REQUIRE( A.failures(Q) == M0 ); // unchanged
+
+        A.reset_failures(Q);
+        REQUIRE( A.failures(Q) == 0 );
+    }
     SECTION( "fpt::Alloc.free test" ) {
         //EmptyTestKernel<Dev> kernel;
         //REQUIRE( fixture( kernel, N0, A.device() ) );
@@ -0,0 +1,128 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Analysis.hpp>
+#include <fpt/Query.hpp>
+#include "TestAlpaka.hpp"
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::PairHistogram and StructureOper match brute force", "[analysis]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+    constexpr int Bins = 10, Types = 2, NK = 4;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const float L = 8.0f, R = 2.5f;
+    uint32_t seed = 3;
+    auto uniform = [&](const float lo, const float hi) {
+        seed = seed*1664525u + 1013904223u;
+        return lo + (hi - lo)*float(seed >> 8)/float(1u << 24);
+    };
+    const int natoms = 600;
+    std::vector<fpt::Probe> atoms(natoms);
+    for(auto &a : atoms)
+        a = fpt::Probe{uniform(0, L), uniform(0, L), uniform(0, L)};
+    // atom n has type n%2
+    std::vector<uint8_t> types_h(natoms + 1);
+    for(int n=0; n<=natoms; n++)
+        types_h[n] = n%2;
+
+    auto srt = fpt::CellSorter(L, L, L, 8, 8, 8);
+    srt.set_boundary(fpt::BC_PERIODIC, fpt::BC_PERIODIC, fpt::BC_PERIODIC);
+    const auto box = srt.device();
+    const Idx ncells = srt.cells;
+
+    std::vector<fpt::Cell> host(ncells);
+    for(auto &c : host)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            c.n[m] = 0;
+    for(int a=0; a<natoms; a++) {
+        fpt::Cell &c = host[box.calcBinF(atoms[a].x, atoms[a].y, atoms[a].z)];
+        int m = 0;
+        while(c.n[m] != 0) m++;
+        c.n[m] = a + 1;
+        c.x[m] = atoms[a].x;
+        c.y[m] = atoms[a].y;
+        c.z[m] = atoms[a].z;
+    }
+
+    const auto nbr_h = srt.list_cells(R);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vX(host.data(), devHost, ncells);
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    alpaka::memcpy(Q, X, vX, ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, uint8_t, Dim, Idx> vT(types_h.data(), devHost, Idx(natoms + 1));
+    auto types = alpaka::Buf<Dev, uint8_t, Dim, Idx>{alpaka::allocBuf<uint8_t, Idx>(dev, Idx(natoms + 1))};
+    alpaka::memcpy(Q, types, vT, Idx(natoms + 1));
+
+    SECTION( "pair histogram" ) {
+        fpt::PairHistogram<Bins, Types, Acc> ph(dev, fpt::CellSorter(srt), R); // keeps a copy
+        REQUIRE(ph.get(Q) == std::vector<unsigned long long>(Types*Types*Bins, 0));
+        ph.enqueue(Q, nbr, X, alpaka::getPtrNative(types));
+        ph.enqueue(Q, nbr, X, alpaka::getPtrNative(types));
+        const auto h = ph.get(Q);
+        REQUIRE(ph.frames == 2);
+
+        // brute force over ordered pairs and nearest images
+        std::vector<long> brute(Types*Types*Bins, 0);
+        for(int a=0; a<natoms; a++)
+            for(int b=0; b<natoms; b++) {
+                if(a == b) continue;
+                const float r[3] = {atoms[a].x, atoms[a].y, atoms[a].z};
+                const float s[3] = {atoms[b].x, atoms[b].y, atoms[b].z};
+                float d2 = 0.0f;
+                for(int d=0; d<3; d++) {
+                    float dd = r[d] - s[d];
+                    dd -= L*std::round(dd/L);
+                    d2 += dd*dd;
+                }
+                if(d2 >= R*R) continue;
+                const int k = std::min(int(std::sqrt(d2)*Bins/R), Bins-1);
+                brute[(types_h[a+1]*Types + types_h[b+1])*Bins + k] += 2; // two frames
+            }
+
+        long total = 0, diff = 0;
+        for(int i=0; i<Types*Types*Bins; i++) {
+            total += brute[i] - long(h[i]);
+            diff += std::labs(brute[i] - long(h[i]));
+        }
+        REQUIRE(total == 0);
+        REQUIRE(diff <= 8); // rounding at bin edges
+        // pairs are counted from both atoms
+        for(int k=0; k<Bins; k++)
+            REQUIRE(h[(0*Types + 1)*Bins + k] == h[(1*Types + 0)*Bins + k]);
+
+        // an ideal gas has g(r) near 1 at large r
+        const auto g = ph.rdf(h, 0, 0, natoms/2, natoms/2);
+        REQUIRE(g[Bins-1] > 0.7);
+        REQUIRE(g[Bins-1] < 1.3);
+
+        ph.reset(Q);
+        REQUIRE(ph.frames == 0);
+    }
+
+    SECTION( "structure factor" ) {
+        using S = fpt::StructureOper<NK>;
+        const S op = S::along(0, L);
+        const auto a = fpt::reduce1Body<S,Acc>(dev, Q, X, op);
+        REQUIRE(a.n == natoms);
+        for(int q=0; q<NK; q++) {
+            std::complex<double> sum = 0.0;
+            for(const auto &p : atoms)
+                sum += std::exp(std::complex<double>(0.0, op.kx[q]*p.x));
+            const double s = std::norm(sum)/natoms;
+            REQUIRE(std::fabs(S::sk(a, q) - s) < 1e-3*(1.0 + s));
+        }
+    }
+}
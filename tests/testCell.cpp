@@ -0,0 +1,284 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Active.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Count the cells visited around (i,j,k), the way Oper2Kernel does.
+static int visited(const fpt::BoxCells &cells, const std::vector<fpt::CellRange> &nbr,
+                   int i, int j, int k) {
+    int r = 0, count = 0;
+    fpt::CellRange off = nbr[0];
+    while(fpt::next_row(cells, nbr.data(), r, i, j, k, off)) {
+        count += off.i1 - off.i0 + 1;
+        r++;
+    }
+    return count;
+}
+
+TEST_CASE( "stencil clipping at open walls", "[cell]") {
+    auto srt = fpt::CellSorter(8.0, 8.0, 8.0, 8, 8, 8);
+    const auto nbr = srt.list_cells(1.0);
+
+    SECTION( "periodic boxes visit the whole stencil" ) {
+        const fpt::BoxCells cells{srt.device()};
+        REQUIRE(visited(cells, nbr, 0, 0, 0) == 27);
+        REQUIRE(visited(cells, nbr, 7, 3, 7) == 27);
+    }
+
+    SECTION( "open boxes visit only cells inside" ) {
+        srt.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+        const fpt::BoxCells cells{srt.device()};
+        REQUIRE(visited(cells, nbr, 0, 0, 0) == 8);
+        REQUIRE(visited(cells, nbr, 7, 0, 3) == 12);
+        REQUIRE(visited(cells, nbr, 3, 4, 5) == 27);
+    }
+
+    SECTION( "mixed boundaries clip only the bounded axes" ) {
+        srt.set_boundary(fpt::BC_PERIODIC, fpt::BC_OPEN, fpt::BC_REFLECT);
+        const fpt::BoxCells cells{srt.device()};
+        REQUIRE(visited(cells, nbr, 0, 0, 0) == 12);
+        // wrapped row in x
+        fpt::CellRange off(-1, 1, 1, 0);
+        REQUIRE(cells.clip(0, 3, 4, off));
+        REQUIRE(cells.col(cells.row(3, 4, off), 0, off.i0)
+                == srt.device().calcBin(7, 4, 4));
+    }
+}
+
+TEST_CASE( "boundary modes fold positions", "[cell]") {
+    auto srt = fpt::CellSorter(8.0, 8.0, 8.0, 8, 8, 8);
+    srt.set_boundary(fpt::BC_OPEN, fpt::BC_PERIODIC, fpt::BC_REFLECT);
+    const fpt::BoxCells cells{srt.device()};
+
+    float x = 0.5, y = 8.5, z = -0.25;
+    REQUIRE(cells.wrap(x, y, z));
+    REQUIRE(x == 0.5);
+    REQUIRE(y == Catch::Approx(0.5));
+    REQUIRE(z == Catch::Approx(0.25));
+
+    z = 8.25;
+    REQUIRE(cells.wrap(x, y, z));
+    REQUIRE(z == Catch::Approx(7.75));
+
+    // rounding must not leave a position on the upper wall
+    y = -1e-9f;
+    REQUIRE(cells.fold(y, 1));
+    REQUIRE(y < 8.0f);
+    z = 8.0f;
+    REQUIRE(cells.fold(z, 2));
+    REQUIRE(z < 8.0f);
+
+    x = -0.5;
+    REQUIRE_FALSE(cells.wrap(x, y, z));
+}
+
+TEMPLATE_LIST_TEST_CASE( "pair kernel follows per-axis boundaries", "[cell]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const fpt::test::Atoms atoms(700, 6.0, 5.0, 4.0);
+    const fpt::Boundary P = fpt::BC_PERIODIC, O = fpt::BC_OPEN, R = fpt::BC_REFLECT;
+    const fpt::Boundary modes[][3] = {{P, P, P}, {P, O, R}, {O, P, P}, {R, R, O}};
+
+    for(const auto &bc : modes) {
+        auto srt = fpt::CellSorter(6.0, 5.0, 4.0, 6, 5, 4);
+        srt.set_boundary(bc[0], bc[1], bc[2]);
+        const Idx ncells = srt.cells;
+        auto host = atoms.cells(srt);
+
+        const auto nbr_h = srt.list_cells(1.0);
+        auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vX(host.data(), devHost, ncells);
+        auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+        alpaka::memcpy(Q, X, vX, ncells);
+        alpaka::memset(Q, Y, 0, ncells);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, srt, X, Y));
+        alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, srt, nbr, Y, en));
+
+        std::vector<fpt::CellEnergy> en_h(ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> ven(en_h.data(), devHost, ncells);
+        alpaka::memcpy(Q, vX, Y, ncells);
+        alpaka::memcpy(Q, ven, en, ncells);
+        alpaka::wait(Q);
+
+        REQUIRE(fpt::test::near_mismatches(host, en_h, atoms.near(srt)) == 0);
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::ActiveCells lists occupied cells", "[cell]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    auto srt = fpt::CellSorter(8.0, 8.0, 8.0, 8, 8, 8);
+    std::vector<fpt::Cell> host(srt.cells);
+    for(auto &A : host)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            A.n[m] = 0;
+
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+            host.data(), devHost, Idx(srt.cells));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, Idx(srt.cells))};
+    fpt::ActiveCells<Acc> act(dev, srt.cells);
+
+    SECTION( "an empty box lists no cell" ) {
+        alpaka::memcpy(Q, X, view, Idx(srt.cells));
+        act.update(srt, X, Q);
+        REQUIRE(act.size(Q) == 0);
+    }
+
+    SECTION( "every occupied cell is listed once with its count" ) {
+        // cell c holds c%5 atoms in every 7th cell
+        std::vector<uint32_t> want;
+        for(unsigned int c=0; c<srt.cells; c += 7) {
+            for(unsigned int m=0; m<c%5; m++)
+                host[c].n[(3*m)%ATOMS_PER_CELL] = 1;
+            if(c%5 != 0)
+                want.push_back(c);
+        }
+        alpaka::memcpy(Q, X, view, Idx(srt.cells));
+        act.update(srt, X, Q);
+        REQUIRE(act.size(Q) == want.size());
+
+        std::vector<uint32_t> occ(srt.cells), lst(srt.cells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vocc(occ.data(), devHost, Idx(srt.cells));
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vlst(lst.data(), devHost, Idx(srt.cells));
+        alpaka::memcpy(Q, vocc, act.occupancy(), Idx(srt.cells));
+        alpaka::memcpy(Q, vlst, act.list(), Idx(srt.cells));
+        alpaka::wait(Q);
+
+        lst.resize(act.size(Q));
+        std::sort(lst.begin(), lst.end());
+        REQUIRE(lst == want);
+        for(unsigned int c=0; c<srt.cells; c++)
+            REQUIRE(occ[c] == (c%7 == 0 ? c%5 : 0));
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "active-cell kernels match the full grid", "[cell]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // Atoms fill x < 3 of a periodic box, binned before moving
+    // 0.5 down in x, so that some have to be sorted into other
+    // (possibly empty) cells and across the periodic wall.
+    auto srt = fpt::CellSorter(8.0, 8.0, 8.0, 8, 8, 8);
+    const Idx ncells = srt.cells;
+    fpt::test::Atoms atoms(250, 3.0, 8.0, 8.0);
+    auto host = atoms.cells(srt);
+    for(auto &x : atoms.x)
+        x = x < 0.5f ? x + 7.5f : x - 0.5f;
+    for(auto &A : host)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(A.n[m] != 0)
+                A.x[m] = atoms.x[A.n[m]-1];
+
+    const auto nbr_h = srt.list_cells(1.0);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+
+    // Sort, count atoms per cell and count near atoms
+    // over the full grid (act == nullptr) or the listed cells.
+    auto run = [&](fpt::ActiveCells<Acc> *act, std::vector<fpt::Cell> &Yh,
+                   std::vector<uint32_t> &num, std::vector<fpt::CellEnergy> &en) {
+        auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        auto N = alpaka::Buf<Dev, uint32_t, Dim, Idx>{alpaka::allocBuf<uint32_t, Idx>(dev, ncells)};
+        auto E = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+        alpaka::memset(Q, Y, 0, ncells);
+        alpaka::memset(Q, N, 0, ncells);
+        if(act == nullptr) {
+            alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, srt, X, Y));
+            alpaka::enqueue(Q, fpt::mk1Body<fpt::NumCellOper,Acc,Dim,Idx>(dev, Y, N));
+            alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, srt, nbr, Y, E));
+        } else {
+            // tasks made before an update() run over the list it builds
+            auto sortK = fpt::mkSorter<Acc,Dim,Idx>(dev, srt, X, Y, *act);
+            auto numK = fpt::mk1Body<fpt::NumCellOper,Acc,Dim,Idx>(dev, Y, N, *act);
+            auto nearK = fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, srt, nbr, Y, E, *act);
+            act->update(srt, X, Q);
+            alpaka::enqueue(Q, sortK);
+            act->update(srt, Y, Q);
+            alpaka::enqueue(Q, numK);
+            alpaka::enqueue(Q, nearK);
+        }
+        Yh.resize(ncells);
+        num.resize(ncells);
+        en.resize(ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vY(Yh.data(), devHost, ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vN(num.data(), devHost, ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vE(en.data(), devHost, ncells);
+        alpaka::memcpy(Q, vY, Y, ncells);
+        alpaka::memcpy(Q, vN, N, ncells);
+        alpaka::memcpy(Q, vE, E, ncells);
+        alpaka::wait(Q);
+    };
+
+    std::vector<fpt::Cell> full, listed;
+    std::vector<uint32_t> full_num, listed_num;
+    std::vector<fpt::CellEnergy> full_en, listed_en;
+    run(nullptr, full, full_num, full_en);
+    fpt::ActiveCells<Acc> act(dev, ncells);
+    run(&act, listed, listed_num, listed_en);
+    REQUIRE(act.size(Q) > 0);
+    REQUIRE(act.size(Q) < ncells/2);
+
+    std::vector<double> want(atoms.size(), 0.0);
+    REQUIRE(fpt::test::near_mismatches(full, full_en, atoms.near(srt)) == 0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(full[c].n[m] != 0)
+                want[full[c].n[m]-1] = full_en[c].en[m];
+
+    // same atoms in every cell, and the same outputs in the occupied ones
+    REQUIRE(fpt::test::near_mismatches(listed, listed_en, want) == 0);
+    for(Idx c=0; c<ncells; c++) {
+        std::vector<uint32_t> a, b;
+        for(int m=0; m<ATOMS_PER_CELL; m++) {
+            if(full[c].n[m] != 0) a.push_back(full[c].n[m]);
+            if(listed[c].n[m] != 0) b.push_back(listed[c].n[m]);
+        }
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        REQUIRE(a == b);
+        if(!a.empty())
+            REQUIRE(listed_num[c] == full_num[c]);
+    }
+}
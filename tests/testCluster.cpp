@@ -0,0 +1,122 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Cluster.hpp>
+#include <fpt/Query.hpp>
+#include "TestAlpaka.hpp"
+
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::Clusters labels bonded atoms", "[cluster]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const float L = 8.0f, R = 0.9f;
+    uint32_t seed = 17;
+    auto uniform = [&](const float lo, const float hi) {
+        seed = seed*1664525u + 1013904223u;
+        return lo + (hi - lo)*float(seed >> 8)/float(1u << 24);
+    };
+    // near the percolation threshold, for clusters of many sizes
+    const int natoms = 500;
+    std::vector<fpt::Probe> atoms(natoms);
+    for(auto &a : atoms)
+        a = fpt::Probe{uniform(0, L), uniform(0, L), uniform(0, L)};
+
+    for(const auto bc : {fpt::BC_PERIODIC, fpt::BC_OPEN}) {
+        auto srt = fpt::CellSorter(L, L, L, 8, 8, 8);
+        srt.set_boundary(bc, bc, bc);
+        const auto box = srt.device();
+        const Idx ncells = srt.cells;
+        const Idx nslots = ncells*ATOMS_PER_CELL;
+
+        std::vector<fpt::Cell> host(ncells);
+        for(auto &c : host)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                c.n[m] = 0;
+        for(int a=0; a<natoms; a++) {
+            fpt::Cell &c = host[box.calcBinF(atoms[a].x, atoms[a].y, atoms[a].z)];
+            int m = 0;
+            while(c.n[m] != 0) m++;
+            c.n[m] = a + 1;
+            c.x[m] = atoms[a].x;
+            c.y[m] = atoms[a].y;
+            c.z[m] = atoms[a].z;
+        }
+
+        const auto nbr_h = srt.list_cells(R);
+        auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vX(host.data(), devHost, ncells);
+        auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        alpaka::memcpy(Q, X, vX, ncells);
+
+        const uint32_t max_size = 20;
+        fpt::Clusters<Acc> cl(dev, fpt::CellSorter(srt), R, max_size); // keeps a copy
+        cl.enqueue(Q, nbr, X);
+        const auto hist = cl.sizes(Q);
+        std::vector<uint32_t> label(nslots);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vl(label.data(), devHost, nslots);
+        alpaka::memcpy(Q, vl, cl.labels(), nslots);
+        alpaka::wait(Q);
+
+        // brute force, over the nearest images
+        std::vector<int> root(natoms);
+        std::iota(root.begin(), root.end(), 0);
+        auto find = [&](int a) {
+            while(root[a] != a) a = root[a];
+            return a;
+        };
+        for(int a=0; a<natoms; a++)
+            for(int b=a+1; b<natoms; b++) {
+                const float r[3] = {atoms[a].x, atoms[a].y, atoms[a].z};
+                const float s[3] = {atoms[b].x, atoms[b].y, atoms[b].z};
+                float d2 = 0.0f;
+                for(int d=0; d<3; d++) {
+                    float dd = r[d] - s[d];
+                    if(bc == fpt::BC_PERIODIC)
+                        dd -= L*std::round(dd/L);
+                    d2 += dd*dd;
+                }
+                if(d2 < R*R) root[find(a)] = find(b);
+            }
+
+        // labels and brute-force roots must map one-to-one
+        std::map<uint32_t, int> to_root;
+        std::map<int, uint32_t> to_label;
+        std::map<int, uint32_t> size;
+        for(Idx s=0; s<nslots; s++) {
+            const uint32_t n = host[s/ATOMS_PER_CELL].n[s%ATOMS_PER_CELL];
+            if(n == 0) {
+                REQUIRE(label[s] == CLUSTER_NONE);
+                continue;
+            }
+            REQUIRE(label[s] <= s);
+            REQUIRE(label[label[s]] == label[s]); // the label is a root slot
+            const int r = find(n - 1);
+            if(to_root.count(label[s]) == 0) to_root[label[s]] = r;
+            if(to_label.count(r) == 0) to_label[r] = label[s];
+            REQUIRE(to_root[label[s]] == r);
+            REQUIRE(to_label[r] == label[s]);
+            size[r]++;
+        }
+
+        std::vector<uint32_t> brute(max_size+1, 0);
+        for(const auto &rs : size)
+            brute[std::min(rs.second, max_size)]++;
+        for(uint32_t k=0; k<=max_size; k++)
+            REQUIRE(hist[k] == brute[k]);
+        REQUIRE(hist[1] < size.size()); // some atoms are bonded
+    }
+}
@@ -0,0 +1,191 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Domain.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <tuple>
+#include <vector>
+
+// Two well-separated atoms per cell, so LJ energies stay finite.
+static std::vector<fpt::Cell> lattice_cells(const fpt::CellSorter &box) {
+    std::vector<fpt::Cell> cells(box.cells);
+    const auto box_d = box.device();
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> U(-0.05, 0.05);
+
+    for(unsigned int c=0; c<box.cells; c++) {
+        int i, j, k;
+        box_d.decodeBin(c, i, j, k);
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            cells[c].n[m] = 0;
+        const float f[2][3] = {{0.25, 0.25, 0.25}, {0.75, 0.7, 0.6}};
+        for(int m=0; m<2; m++) {
+            cells[c].n[m] = 1;
+            cells[c].x[m] = (i + f[m][0] + U(rng))*box_d.h[0];
+            cells[c].y[m] = (j + f[m][1] + U(rng))*box_d.h[1];
+            cells[c].z[m] = (k + f[m][2] + U(rng))*box_d.h[2];
+        }
+    }
+    return cells;
+}
+
+using Atom = std::tuple<float, float, float>;
+
+static std::vector<Atom> atom_list(const std::vector<fpt::Cell> &cells) {
+    std::vector<Atom> atoms;
+    for(const auto &A : cells) {
+        for(int m=0; m<ATOMS_PER_CELL; m++) {
+            if(A.n[m] != 0)
+                atoms.emplace_back(A.x[m], A.y[m], A.z[m]);
+        }
+    }
+    std::sort(atoms.begin(), atoms.end());
+    return atoms;
+}
+
+TEST_CASE( "ghost depth follows the cell list", "[domain]") {
+    auto box = fpt::CellSorter(8.0, 8.0, 12.0, 8, 8, 12);
+    REQUIRE(fpt::ghost_layers(box.list_cells(0.5)) == 1);
+    REQUIRE(fpt::ghost_layers(box.list_cells(1.5)) == 2);
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::SlabDecomposition", "[domain]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Idx = alpaka::Idx<Acc>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const float Rc = 1.5;
+    auto box = fpt::CellSorter(8.0, 8.0, 12.0, 8, 8, 12);
+    const auto ref = lattice_cells(box);
+
+    // Three slabs sharing one device.
+    fpt::SlabDecomposition<Acc> dd(box, Rc, std::vector<Dev>(3, dev));
+    REQUIRE(dd.ghost == 2);
+    REQUIRE(dd.slabs.size() == 3);
+    REQUIRE(dd.scatter(ref.data(), box.cells) == 0);
+
+    SECTION( "gather inverts scatter" ) {
+        std::vector<fpt::Cell> out(box.cells);
+        dd.gather(out.data());
+        const auto a = atom_list(ref), b = atom_list(out);
+        REQUIRE(a.size() == b.size());
+        for(size_t i=0; i<a.size(); i++) {
+            REQUIRE(std::get<0>(a[i]) == std::get<0>(b[i]));
+            REQUIRE(std::get<1>(a[i]) == std::get<1>(b[i]));
+            REQUIRE(std::get<2>(a[i]) == Catch::Approx(std::get<2>(b[i])).margin(1e-4));
+        }
+    }
+
+    SECTION( "exchange fills ghost layers with shifted periodic images" ) {
+        const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+        const float hz = box.L[2]/box.n[2];
+        const int nz = box.n[2];
+        dd.exchange();
+        dd.sync();
+
+        for(auto &s : dd.slabs) {
+            std::vector<fpt::Cell> loc(s.srt.cells);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, alpaka::DimInt<1u>, Idx> view(
+                    loc.data(), devHost, Idx(s.srt.cells));
+            alpaka::memcpy(s.compute, view, s.X, Idx(s.srt.cells));
+            alpaka::wait(s.compute);
+
+            for(int l=0; l<s.srt.n[2]; l++) {
+                // global layer of local layer l, and its image offset
+                const int kg = s.k0 + l - dd.ghost;
+                const int kw = (kg + nz) % nz;
+                const float z0 = (s.k0 - dd.ghost - kg + kw)*hz;
+                for(Idx c=0; c<s.layer; c++) {
+                    const auto &A = loc[s.cell0(l) + c];
+                    const auto &B = ref[kw*s.layer + c];
+                    for(int m=0; m<ATOMS_PER_CELL; m++) {
+                        REQUIRE(A.n[m] == B.n[m]);
+                        if(B.n[m] == 0) continue;
+                        REQUIRE(A.x[m] == B.x[m]);
+                        REQUIRE(A.y[m] == B.y[m]);
+                        REQUIRE(A.z[m] + z0 == Catch::Approx(B.z[m]).margin(1e-4));
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "decomposed sort and pairs match one device", "[domain]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+    const float Rc = 1.5, dz = 0.5;
+    auto box = fpt::CellSorter(8.0, 8.0, 12.0, 8, 8, 12);
+    const Idx ncells = box.cells;
+
+    // Before the sort, atoms of slabs 0 and 2 move up by dz and those
+    // of slab 1 down, across slab walls and the periodic wall in z.
+    const fpt::test::Atoms start(1500, 8.0, 8.0, 12.0);
+    fpt::test::Atoms moved = start;
+    for(auto &z : moved.z)
+        z = std::fmod(z + (int(z)/4 == 1 ? -dz : dz) + box.L[2], box.L[2]);
+
+    // single device
+    const auto nbr_h = box.list_cells(Rc);
+    auto host = moved.cells(box);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto en1 = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+    alpaka::memset(Q, Y, 0, ncells);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, box, X, Y));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, box, nbr, Y, en1));
+
+    std::vector<fpt::CellEnergy> one(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vone(one.data(), devHost, ncells);
+    alpaka::memcpy(Q, vhost, Y, ncells);
+    alpaka::memcpy(Q, vone, en1, ncells);
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(host, one, moved.near(box)) == 0);
+
+    std::vector<double> want(moved.size(), 0.0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(host[c].n[m] != 0)
+                want[host[c].n[m]-1] = one[c].en[m];
+
+    // three slabs of four layers, moved on the device
+    fpt::SlabDecomposition<Acc> dd(box, Rc, std::vector<Dev>(3, dev));
+    const auto initial = start.cells(box);
+    REQUIRE(dd.scatter(initial.data(), ncells) == 0);
+    for(size_t d=0; d<dd.slabs.size(); d++) {
+        auto &s = dd.slabs[d];
+        REQUIRE(s.k0 == 4*int(d));
+        alpaka::exec<Acc>(s.compute, fpt::cellWorkDiv<Dim,Idx>(s.dev, Idx(s.srt.cells)),
+                          fpt::ShiftCellsKernel{}, alpaka::getPtrNative(s.X), d == 1 ? -dz : dz);
+    }
+    dd.sort();
+    auto out = dd.template alloc_out<fpt::CellEnergy>();
+    dd.template pairs<fpt::test::NearOper>(out);
+    dd.sync();
+
+    std::vector<fpt::Cell> cells(ncells);
+    std::vector<fpt::CellEnergy> en(ncells);
+    dd.gather(cells.data());
+    dd.gather_out(out, en.data());
+    REQUIRE(fpt::test::near_mismatches(cells, en, want) == 0);
+}
@@ -0,0 +1,176 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Ensemble.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+TEST_CASE( "ensemble blocks find their replica", "[ensemble]") {
+    std::vector<fpt::CellSorter> boxes{
+        fpt::CellSorter(6.0, 6.0, 6.0, 3, 3, 3),
+        fpt::CellSorter(8.0, 6.0, 4.0, 4, 3, 2),
+        fpt::CellSorter(10.0, 10.0, 10.0, 5, 5, 5)
+    };
+    boxes[1].set_boundary(fpt::BC_PERIODIC, fpt::BC_OPEN, fpt::BC_PERIODIC);
+    const float Rc = 2.0;
+
+    std::vector<fpt::CellSorter_d> geom;
+    std::vector<uint32_t> first{0}, nbr_first;
+    std::vector<fpt::CellRange> nbr;
+    for(const auto &box : boxes) {
+        geom.push_back(box.device());
+        first.push_back(first.back() + box.cells);
+        nbr_first.push_back(nbr.size());
+        const auto lst = box.list_cells(Rc);
+        nbr.insert(nbr.end(), lst.begin(), lst.end());
+    }
+    const fpt::EnsembleCells ens{geom.data(), first.data(), nbr.data(),
+                                 nbr_first.data(), uint32_t(boxes.size())};
+
+    for(uint32_t r=0; r<boxes.size(); r++) {
+        const auto cells = ens.cells(r);
+        const fpt::BoxCells plain{geom[r]};
+        const fpt::CellRange *rows = ens.nbr + ens.nbr_first[r];
+
+        for(uint32_t b=first[r]; b<first[r+1]; b++) {
+            REQUIRE(ens.replica(b) == r);
+            const uint32_t bin = cells.home(b - first[r]);
+            REQUIRE(bin == b);
+
+            // same stencil as the replica on its own, shifted by first[r]
+            int i, j, k, pi, pj, pk;
+            cells.decode(bin, i, j, k);
+            plain.decode(b - first[r], pi, pj, pk);
+            REQUIRE(i == pi);
+            REQUIRE(j == pj);
+            REQUIRE(k == pk);
+
+            int n = 0, pn = 0;
+            fpt::CellRange off = rows[0], poff = rows[0];
+            while(fpt::next_row(cells, rows, n, i, j, k, off)) {
+                REQUIRE(fpt::next_row(plain, rows, pn, i, j, k, poff));
+                const uint32_t start = cells.row(j, k, off);
+                const uint32_t pstart = plain.row(j, k, poff);
+                for(int di = off.i0; di <= off.i1; di++)
+                    REQUIRE(cells.col(start, i, di) == first[r] + plain.col(pstart, i, di));
+                n++;
+                pn++;
+            }
+            REQUIRE(!fpt::next_row(plain, rows, pn, i, j, k, poff));
+        }
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "ensemble kernels match each replica run alone", "[ensemble]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+    using CellBuf = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>;
+    using EnBuf = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    std::vector<fpt::CellSorter> boxes{
+        fpt::CellSorter(6.0, 6.0, 6.0, 3, 3, 3),
+        fpt::CellSorter(8.0, 6.0, 4.0, 4, 3, 2),
+        fpt::CellSorter(10.0, 10.0, 10.0, 12, 12, 12) // a wider stencil
+    };
+    boxes[1].set_boundary(fpt::BC_PERIODIC, fpt::BC_OPEN, fpt::BC_PERIODIC);
+    const int natoms[3] = {200, 150, 400};
+    const float Rc = 1.0;
+    fpt::Ensemble<Acc> ens(dev, boxes, Rc, Q);
+
+    // Atoms are binned, then moved 0.7 up in x (across the
+    // periodic wall), so the sorter has to move some of them.
+    std::vector<fpt::test::Atoms> atoms;
+    std::vector<fpt::Cell> packed;
+    for(Idx r=0; r<ens.replicas; r++) {
+        const auto &box = boxes[r];
+        atoms.emplace_back(natoms[r], box.L[0], box.L[1], box.L[2], 7 + r);
+        auto host = atoms[r].cells(box);
+        for(auto &x : atoms[r].x)
+            x = std::fmod(x + 0.7f, box.L[0]);
+        for(auto &A : host)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                if(A.n[m] != 0)
+                    A.x[m] = atoms[r].x[A.n[m]-1];
+        REQUIRE(packed.size() == ens.offset(r));
+        packed.insert(packed.end(), host.begin(), host.end());
+    }
+
+    auto X = CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, ens.cells)};
+    auto Y = CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, ens.cells)};
+    auto en = EnBuf{alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ens.cells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vpacked(packed.data(), devHost, ens.cells);
+    alpaka::memcpy(Q, X, vpacked, ens.cells);
+    alpaka::memset(Q, Y, 0, ens.cells);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, ens, X, Y));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, ens, Y, en));
+
+    std::vector<fpt::Cell> sorted(ens.cells);
+    std::vector<fpt::CellEnergy> ens_en(ens.cells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vsorted(sorted.data(), devHost, ens.cells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vens(ens_en.data(), devHost, ens.cells);
+    alpaka::memcpy(Q, vsorted, Y, ens.cells);
+    alpaka::memcpy(Q, vens, en, ens.cells);
+    alpaka::wait(Q);
+
+    for(Idx r=0; r<ens.replicas; r++) {
+        const auto &box = boxes[r];
+        const Idx n = box.cells;
+        const Idx base = ens.offset(r);
+
+        // replica r on its own
+        const auto nbr_h = box.list_cells(Rc);
+        auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+        auto RX = CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, n)};
+        auto RY = CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, n)};
+        auto ren = EnBuf{alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, n)};
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vin(packed.data() + base, devHost, n);
+        alpaka::memcpy(Q, RX, vin, n);
+        alpaka::memset(Q, RY, 0, n);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, box, RX, RY));
+        alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, box, nbr, RY, ren));
+
+        std::vector<fpt::Cell> alone(n);
+        std::vector<fpt::CellEnergy> alone_en(n);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> valone(alone.data(), devHost, n);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vaen(alone_en.data(), devHost, n);
+        alpaka::memcpy(Q, valone, RY, n);
+        alpaka::memcpy(Q, vaen, ren, n);
+        alpaka::wait(Q);
+        REQUIRE(fpt::test::near_mismatches(alone, alone_en, atoms[r].near(box)) == 0);
+
+        std::vector<double> want(atoms[r].size(), 0.0);
+        for(Idx c=0; c<n; c++)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                if(alone[c].n[m] != 0)
+                    want[alone[c].n[m]-1] = alone_en[c].en[m];
+
+        // the packed slice holds the same atoms in every cell,
+        // with the same results
+        const std::vector<fpt::Cell> slice(sorted.begin() + base, sorted.begin() + base + n);
+        const std::vector<fpt::CellEnergy> slice_en(ens_en.begin() + base, ens_en.begin() + base + n);
+        REQUIRE(fpt::test::near_mismatches(slice, slice_en, want) == 0);
+        for(Idx c=0; c<n; c++) {
+            std::vector<uint32_t> a, b;
+            for(int m=0; m<ATOMS_PER_CELL; m++) {
+                if(alone[c].n[m] != 0) a.push_back(alone[c].n[m]);
+                if(slice[c].n[m] != 0) b.push_back(slice[c].n[m]);
+            }
+            std::sort(a.begin(), a.end());
+            std::sort(b.begin(), b.end());
+            REQUIRE(a == b);
+        }
+    }
+}
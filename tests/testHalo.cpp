@@ -0,0 +1,199 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Halo.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <vector>
+
+TEST_CASE( "halo depth follows the cell list", "[halo]") {
+    auto box = fpt::CellSorter(6.0, 8.0, 10.0, 6, 4, 10);
+    fpt::HaloGrid grid(box, 1.5);
+
+    // h = (1, 2, 1)
+    REQUIRE(grid.g[0] == 2);
+    REQUIRE(grid.g[1] == 1);
+    REQUIRE(grid.g[2] == 2);
+    REQUIRE(grid.pad.n[0] == 10);
+    REQUIRE(grid.pad.n[1] == 6);
+    REQUIRE(grid.pad.n[2] == 14);
+    REQUIRE(grid.origin(1) == Catch::Approx(2.0));
+
+    SECTION( "wrap folds positions into the owned cells" ) {
+        const auto cells = grid.device();
+        float x = 1.5, y = 2.5, z = 12.5; // below in x, inside in y, above in z
+        cells.wrap(x, y, z);
+        REQUIRE(x == Catch::Approx(7.5));
+        REQUIRE(y == Catch::Approx(2.5));
+        REQUIRE(z == Catch::Approx(2.5));
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::HaloFillKernel", "[halo]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    auto box = fpt::CellSorter(6.0, 8.0, 10.0, 6, 4, 10);
+    fpt::HaloGrid grid(box, 1.5);
+    const auto pad = grid.pad.device();
+
+    // one atom per owned cell, tagged with its cell number
+    std::vector<fpt::Cell> host(grid.pad.cells);
+    for(unsigned int c=0; c<grid.pad.cells; c++) {
+        int i, j, k;
+        pad.decodeBin(c, i, j, k);
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            host[c].n[m] = 0;
+        if(i < grid.g[0] || i >= grid.g[0] + box.n[0]
+        || j < grid.g[1] || j >= grid.g[1] + box.n[1]
+        || k < grid.g[2] || k >= grid.g[2] + box.n[2])
+            continue;
+        host[c].n[1] = c + 1;
+        host[c].x[1] = (i + 0.5)*pad.h[0];
+        host[c].y[1] = (j + 0.25)*pad.h[1];
+        host[c].z[1] = (k + 0.75)*pad.h[2];
+    }
+
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+            host.data(), devHost, Idx(grid.pad.cells));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, Idx(grid.pad.cells))};
+    alpaka::memcpy(Q, X, view, Idx(grid.pad.cells));
+    alpaka::enqueue(Q, fpt::mkHaloFill<Acc,Dim,Idx>(dev, grid, X));
+    alpaka::memcpy(Q, view, X, Idx(grid.pad.cells));
+    alpaka::wait(Q);
+
+    // every cell holds one atom sitting at the same spot in its cell
+    for(unsigned int c=0; c<grid.pad.cells; c++) {
+        int i, j, k;
+        pad.decodeBin(c, i, j, k);
+        const int si = (i - grid.g[0] + box.n[0])%box.n[0] + grid.g[0];
+        const int sj = (j - grid.g[1] + box.n[1])%box.n[1] + grid.g[1];
+        const int sk = (k - grid.g[2] + box.n[2])%box.n[2] + grid.g[2];
+
+        REQUIRE(host[c].n[0] == 0);
+        REQUIRE(host[c].n[1] == pad.calcBin(si, sj, sk) + 1);
+        REQUIRE(host[c].x[1] == Catch::Approx((i + 0.5)*pad.h[0]));
+        REQUIRE(host[c].y[1] == Catch::Approx((j + 0.25)*pad.h[1]));
+        REQUIRE(host[c].z[1] == Catch::Approx((k + 0.75)*pad.h[2]));
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "ghost cells reproduce the periodic pair kernel", "[halo]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    auto box = fpt::CellSorter(6.0, 8.0, 10.0, 6, 4, 10);
+    const fpt::test::Atoms atoms(900, 6.0, 8.0, 10.0);
+    const Idx ncells = box.cells;
+
+    // periodic CellSorter
+    const auto nbr_h = box.list_cells(1.0);
+    auto host = atoms.cells(box);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+    alpaka::memset(Q, Y, 0, ncells);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, box, X, Y));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, box, nbr, Y, en));
+
+    std::vector<fpt::CellEnergy> one(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vone(one.data(), devHost, ncells);
+    alpaka::memcpy(Q, vhost, Y, ncells);
+    alpaka::memcpy(Q, vone, en, ncells);
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(host, one, atoms.near(box)) == 0);
+
+    std::vector<double> want(atoms.size(), 0.0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(host[c].n[m] != 0)
+                want[host[c].n[m]-1] = one[c].en[m];
+
+    // Padded grid.  Atoms within 0.3 of a lower wall are stored one
+    // box length above it, so the sorter has to fold them back.
+    fpt::HaloGrid grid(box, nbr_h);
+    const auto pad = grid.pad.device();
+    const Idx npad = grid.pad.cells;
+    REQUIRE(grid.g[0] == 1);
+    REQUIRE(grid.g[1] == 1);
+    REQUIRE(grid.g[2] == 1);
+    std::vector<fpt::Cell> phost(npad);
+    for(auto &c : phost)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            c.n[m] = 0;
+    for(int a=0; a<atoms.size(); a++) {
+        const float r[3] = {atoms.x[a], atoms.y[a], atoms.z[a]};
+        float p[3], q[3];
+        for(int d=0; d<3; d++) {
+            p[d] = r[d] + grid.origin(d);
+            q[d] = r[d] < 0.3f ? p[d] + box.L[d] : p[d];
+        }
+        fpt::Cell &c = phost[pad.calcBinF(p[0], p[1], p[2])];
+        int m = 0;
+        while(c.n[m] != 0) m++;
+        c.n[m] = a + 1;
+        c.x[m] = q[0];
+        c.y[m] = q[1];
+        c.z[m] = q[2];
+    }
+
+    const auto pnbr_h = grid.pad.list_cells(1.0);
+    auto pnbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(pnbr_h.size()))};
+    alpaka::memcpy(Q, pnbr, pnbr_h, Idx(pnbr_h.size()));
+    auto PX = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, npad)};
+    auto PY = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, npad)};
+    auto pen = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, npad)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vpad(phost.data(), devHost, npad);
+    alpaka::memcpy(Q, PX, vpad, npad);
+    alpaka::memset(Q, PY, 0, npad);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, grid, PX, PY));
+    alpaka::enqueue(Q, fpt::mkHaloFill<Acc,Dim,Idx>(dev, grid, PY));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, grid, pnbr, PY, pen));
+
+    std::vector<fpt::CellEnergy> pone(npad);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vpone(pone.data(), devHost, npad);
+    alpaka::memcpy(Q, vpad, PY, npad);
+    alpaka::memcpy(Q, vpone, pen, npad);
+    alpaka::wait(Q);
+
+    // owned cells hold every atom once, with the periodic result
+    std::vector<fpt::Cell> owned;
+    std::vector<fpt::CellEnergy> owned_en;
+    for(Idx c=0; c<npad; c++) {
+        int i, j, k;
+        pad.decodeBin(c, i, j, k);
+        if(i < grid.g[0] || i >= grid.g[0] + box.n[0]
+        || j < grid.g[1] || j >= grid.g[1] + box.n[1]
+        || k < grid.g[2] || k >= grid.g[2] + box.n[2])
+            continue;
+        owned.push_back(phost[c]);
+        owned_en.push_back(pone[c]);
+    }
+    REQUIRE(owned.size() == ncells);
+    REQUIRE(fpt::test::near_mismatches(owned, owned_en, want) == 0);
+}
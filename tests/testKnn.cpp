@@ -0,0 +1,120 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Knn.hpp>
+#include <fpt/Query.hpp>
+#include "TestAlpaka.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::KnnKernel finds the nearest atoms", "[knn]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+    constexpr int K = 8;
+    using Nbrs = fpt::Neighbors<K>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const float L = 6.0f;
+    uint32_t seed = 5;
+    auto uniform = [&](const float lo, const float hi) {
+        seed = seed*1664525u + 1013904223u;
+        return lo + (hi - lo)*float(seed >> 8)/float(1u << 24);
+    };
+    const int natoms = 400;
+    std::vector<fpt::Probe> atoms(natoms);
+    for(auto &a : atoms)
+        a = fpt::Probe{uniform(0, L), uniform(0, L), uniform(0, L)};
+
+    for(const auto bc : {fpt::BC_PERIODIC, fpt::BC_OPEN}) {
+        auto srt = fpt::CellSorter(L, L, L, 6, 6, 6);
+        srt.set_boundary(bc, bc, bc);
+        const auto box = srt.device();
+        const Idx ncells = srt.cells;
+
+        // atom a gets n = a+1, in the next free slot of its cell
+        std::vector<fpt::Cell> host(ncells);
+        for(auto &c : host)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                c.n[m] = 0;
+        for(int a=0; a<natoms; a++) {
+            fpt::Cell &c = host[box.calcBinF(atoms[a].x, atoms[a].y, atoms[a].z)];
+            int m = 0;
+            while(c.n[m] != 0) m++;
+            c.n[m] = a + 1;
+            c.x[m] = atoms[a].x;
+            c.y[m] = atoms[a].y;
+            c.z[m] = atoms[a].z;
+        }
+
+        auto radii_h = fpt::knn_radii(srt);
+        const auto shells_h = fpt::knn_shells(srt, radii_h);
+        // periodic shells stop before wrapping: 2*2+1 <= 6 cells
+        if(bc == fpt::BC_PERIODIC)
+            REQUIRE(radii_h.size() == 2);
+        const Idx nshells = radii_h.size();
+        auto shells = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(shells_h.size()))};
+        alpaka::memcpy(Q, shells, shells_h, Idx(shells_h.size()));
+        auto radii = alpaka::Buf<Dev, float, Dim, Idx>{alpaka::allocBuf<float, Idx>(dev, nshells)};
+        alpaka::memcpy(Q, radii, radii_h, nshells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vX(host.data(), devHost, ncells);
+        auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        alpaka::memcpy(Q, X, vX, ncells);
+
+        const Idx nslots = ncells*ATOMS_PER_CELL;
+        auto out = alpaka::Buf<Dev, Nbrs, Dim, Idx>{alpaka::allocBuf<Nbrs, Idx>(dev, nslots)};
+        alpaka::enqueue(Q, fpt::mkKnn<K,Acc,Dim,Idx>(dev, srt, shells, radii, X, out));
+
+        std::vector<Nbrs> out_h(nslots);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, Nbrs, Dim, Idx> vo(out_h.data(), devHost, nslots);
+        alpaka::memcpy(Q, vo, out, nslots);
+        alpaka::wait(Q);
+
+        auto dist = [&](const int a, const int b) { // over the nearest images
+            const float r[3] = {atoms[a].x, atoms[a].y, atoms[a].z};
+            const float s[3] = {atoms[b].x, atoms[b].y, atoms[b].z};
+            float d2 = 0.0f;
+            for(int d=0; d<3; d++) {
+                float dd = r[d] - s[d];
+                if(bc == fpt::BC_PERIODIC)
+                    dd -= L*std::round(dd/L);
+                d2 += dd*dd;
+            }
+            return std::sqrt(d2);
+        };
+
+        for(Idx c=0; c<ncells; c++) {
+            for(int m=0; m<ATOMS_PER_CELL; m++) {
+                const Nbrs &o = out_h[c*ATOMS_PER_CELL + m];
+                if(host[c].n[m] == 0) {
+                    REQUIRE(o.count == 0);
+                    continue;
+                }
+                const int a = host[c].n[m] - 1;
+                std::vector<float> brute;
+                for(int b=0; b<natoms; b++)
+                    if(b != a) brute.push_back(dist(a, b));
+                std::sort(brute.begin(), brute.end());
+
+                REQUIRE(o.count == K);
+                REQUIRE(o.dist[K-1] <= o.radius); // exact
+                for(int q=0; q<K; q++) {
+                    const uint32_t s = o.slot[q];
+                    const uint32_t n = host[s/ATOMS_PER_CELL].n[s%ATOMS_PER_CELL];
+                    REQUIRE(n != 0);
+                    REQUIRE(int(n) - 1 != a);
+                    REQUIRE(std::fabs(o.dist[q] - dist(a, n - 1)) < 1e-4f);
+                    REQUIRE(std::fabs(o.dist[q] - brute[q]) < 1e-4f);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,170 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Levels.hpp>
+#include <fpt/Sort.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+// Far cells visited around home cell c, the way Oper2Kernel does.
+static std::multiset<uint32_t> visited(const fpt::LevelCells &cells,
+                                       const std::vector<fpt::CellRange> &nbr, uint32_t c) {
+    std::multiset<uint32_t> ans;
+    int i, j, k;
+    cells.decode(c, i, j, k);
+    int r = 0;
+    fpt::CellRange off = nbr[0];
+    while(fpt::next_row(cells, nbr.data(), r, i, j, k, off)) {
+        const uint32_t start = cells.row(j, k, off);
+        for(int di = off.i0; di <= off.i1; di++)
+            ans.insert(cells.col(start, i, di));
+        r++;
+    }
+    return ans;
+}
+
+// Distance between the intervals [a, a+ha) and [b, b+hb),
+// or between their nearest images in a periodic length L.
+static float gap(float a, float ha, float b, float hb, float L = 0.0f) {
+    float g = std::max(0.0f, std::max(b - (a+ha), a - (b+hb)));
+    if(L > 0.0f) {
+        g = std::min(g, gap(a, ha, b - L, hb));
+        g = std::min(g, gap(a, ha, b + L, hb));
+    }
+    return g;
+}
+
+TEST_CASE( "cross-level stencils cover the cutoff", "[levels]") {
+    auto fine = fpt::CellSorter(12.0, 12.0, 12.0, 8, 8, 8);
+    auto coarse = fpt::CellSorter(12.0, 12.0, 12.0, 3, 3, 3);
+    const float Rc = 2.5;
+
+    // Every far cell within Rc is visited exactly once.
+    auto check = [&](const fpt::LevelGrid &grid) {
+        for(auto home : {fpt::LevelGrid::FINE, fpt::LevelGrid::COARSE}) {
+            const auto far = home == fpt::LevelGrid::FINE ? fpt::LevelGrid::COARSE
+                                                          : fpt::LevelGrid::FINE;
+            const auto A = grid.level[home].device();
+            const auto B = grid.level[far].device();
+            const fpt::LevelCells cells(A, B);
+            const auto nbr = grid.list_cells(home, far, Rc);
+
+            float L[3];
+            for(int a=0; a<3; a++)
+                L[a] = B.bc[a] == fpt::BC_PERIODIC ? grid.level[far].L[a] : 0.0f;
+            for(uint32_t c=0; c<grid.level[home].cells; c++) {
+                const auto got = visited(cells, nbr, c);
+                int i, j, k;
+                A.decodeBin(c, i, j, k);
+                for(uint32_t f=0; f<grid.level[far].cells; f++) {
+                    int p, q, s;
+                    B.decodeBin(f, p, q, s);
+                    const float dx = gap(i*A.h[0], A.h[0], p*B.h[0], B.h[0], L[0]);
+                    const float dy = gap(j*A.h[1], A.h[1], q*B.h[1], B.h[1], L[1]);
+                    const float dz = gap(k*A.h[2], A.h[2], s*B.h[2], B.h[2], L[2]);
+                    if(dx*dx + dy*dy + dz*dz < Rc*Rc)
+                        REQUIRE(got.count(f) == 1);
+                }
+            }
+        }
+    };
+
+    SECTION( "open box" ) {
+        fine.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+        coarse.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+        check(fpt::LevelGrid(fine, coarse));
+    }
+
+    SECTION( "periodic box" ) {
+        const fpt::LevelGrid grid(fine, coarse);
+        // coarse homes reach 8 fine cells, all of them
+        REQUIRE(fpt::stencil_span(grid.list_cells(fpt::LevelGrid::FINE, fpt::LevelGrid::COARSE, Rc), 0) == 3);
+        REQUIRE(fpt::stencil_span(grid.list_cells(fpt::LevelGrid::COARSE, fpt::LevelGrid::FINE, Rc), 0) == 8);
+        check(grid);
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "cross-level pair kernel matches brute force", "[levels]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+    using L = fpt::LevelGrid;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // small atoms on 0.75 cells, large ones on 2.0 cells,
+    // several to a cell
+    auto fine = fpt::CellSorter(6.0, 6.0, 6.0, 8, 8, 8);
+    auto coarse = fpt::CellSorter(6.0, 6.0, 6.0, 3, 3, 3);
+    const fpt::test::Atoms atoms[2] = {fpt::test::Atoms(1200, 6.0, 6.0, 6.0),
+                                       fpt::test::Atoms(150, 6.0, 6.0, 6.0, 11)};
+
+    auto run = [&](const L &grid) {
+        using CellBuf = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>;
+        using EnBuf = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>;
+        std::vector<CellBuf> X, Y;
+        std::vector<std::vector<fpt::Cell>> host;
+        for(auto lvl : {L::FINE, L::COARSE}) {
+            const Idx n = grid.level[lvl].cells;
+            host.push_back(atoms[lvl].cells(grid.level[lvl]));
+            X.push_back(CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, n)});
+            Y.push_back(CellBuf{alpaka::allocBuf<fpt::Cell, Idx>(dev, n)});
+            alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> v(host[lvl].data(), devHost, n);
+            alpaka::memcpy(Q, X[lvl], v, n);
+            alpaka::memset(Q, Y[lvl], 0, n);
+            alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, grid.level[lvl], X[lvl], Y[lvl]));
+        }
+
+        for(auto home : {L::FINE, L::COARSE}) {
+            const auto far = home == L::FINE ? L::COARSE : L::FINE;
+            const Idx n = grid.level[home].cells;
+            const auto nbr_h = grid.list_cells(home, far, 1.0);
+            auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                    alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+            alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+            auto en = EnBuf{alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, n)};
+            alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(
+                                dev, grid, home, far, nbr, Y[home], Y[far], en));
+
+            std::vector<fpt::Cell> cells(n);
+            std::vector<fpt::CellEnergy> out(n);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vc(cells.data(), devHost, n);
+            alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vo(out.data(), devHost, n);
+            alpaka::memcpy(Q, vc, Y[home], n);
+            alpaka::memcpy(Q, vo, en, n);
+            alpaka::wait(Q);
+            REQUIRE(fpt::test::near_mismatches(cells, out,
+                        atoms[home].near(atoms[far], grid.level[home])) == 0);
+        }
+    };
+
+    SECTION( "periodic box" ) {
+        run(L(fine, coarse));
+    }
+
+    SECTION( "open box" ) {
+        fine.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+        coarse.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+        run(L(fine, coarse));
+    }
+}
+
+TEST_CASE( "level grids size cells by cutoff", "[levels]") {
+    fpt::LevelGrid grid(40.0, 40.0, 30.0, 2.5, 10.0);
+    REQUIRE(grid.level[fpt::LevelGrid::FINE].n[0] == 16);
+    REQUIRE(grid.level[fpt::LevelGrid::FINE].n[2] == 12);
+    REQUIRE(grid.level[fpt::LevelGrid::COARSE].n[0] == 4);
+    REQUIRE(grid.level[fpt::LevelGrid::COARSE].n[2] == 3);
+
+    // a level paired with itself uses the ordinary cell list
+    const auto same = grid.list_cells(fpt::LevelGrid::FINE, fpt::LevelGrid::FINE, 2.5);
+    REQUIRE(same.size() == grid.level[0].list_cells(2.5).size());
+}
@@ -0,0 +1,46 @@
+#include <catch2/catch_all.hpp>
+
+#ifdef __linux__
+#include <fpt/Perf.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static void spin(const double seconds) {
+    const auto t0 = std::chrono::steady_clock::now();
+    volatile double x = 0.0;
+    while(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() < seconds)
+        x = x + 1.0;
+}
+
+TEST_CASE( "perf counters sum over the threads of the process", "[perf]") {
+    fpt::PerfCounters perf;
+    const auto c0 = perf.read();
+    if(!c0.has(fpt::PerfSample::TASK_CLOCK))
+        return; // perf_event_open not permitted here
+
+    // a worker started after the first read, while this thread sleeps
+    std::atomic<bool> go{false};
+    std::thread worker([&] {
+        while(!go) std::this_thread::yield();
+        spin(0.05);
+    });
+    const auto c1 = perf.read();
+    go = true;
+    worker.join();
+
+    const auto d = perf.read() - c1;
+    // the worker's CPU time, in ns
+    REQUIRE(d.count[fpt::PerfSample::TASK_CLOCK] > 0.03e9);
+    if(d.has(fpt::PerfSample::INSTRUCTIONS))
+        REQUIRE(d.count[fpt::PerfSample::INSTRUCTIONS] > 0.0);
+    REQUIRE(!(c1 - fpt::PerfSample::none()).has(fpt::PerfSample::TASK_CLOCK));
+
+    // a worker started and joined between two reads
+    const auto c2 = perf.read();
+    std::thread([] { spin(0.05); }).join();
+    const auto d2 = perf.read() - c2;
+    REQUIRE(d2.count[fpt::PerfSample::TASK_CLOCK] > 0.03e9);
+}
+#endif
@@ -0,0 +1,78 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Timer.hpp>
+#include <fpt/Singles.hpp>
+#include "TestAlpaka.hpp"
+
+#include <sstream>
+#include <thread>
+
+TEST_CASE( "profiler regions nest and keep statistics", "[profile]") {
+    auto &prof = fpt::Profiler::get();
+    prof.clear();
+
+    for(int i=0; i<10; i++) {
+        fpt::Region outer("step");
+        REQUIRE(outer.path == "step");
+        for(int j=0; j<2; j++) {
+            fpt::Region inner("force");
+            REQUIRE(inner.path == "step/force");
+            std::this_thread::sleep_for(std::chrono::microseconds(100*(j+1)));
+        }
+    }
+
+    const auto step = prof.stats("step");
+    const auto force = prof.stats("step/force");
+    REQUIRE(step.count == 10);
+    REQUIRE(force.count == 20);
+    REQUIRE(prof.stats("force").count == 0);
+    REQUIRE(force.min >= 1e-4);
+    REQUIRE(force.min <= force.median);
+    REQUIRE(force.median <= force.p99);
+    REQUIRE(step.total >= force.total);
+    REQUIRE(prof.stats().size() == 2);
+
+    std::stringstream trace;
+    prof.write_trace(trace);
+    const std::string s = trace.str();
+    REQUIRE(s.find("\"traceEvents\"") != std::string::npos);
+    REQUIRE(s.find("\"name\": \"step/force\"") != std::string::npos);
+    prof.clear();
+
+    // names are escaped in the trace
+    { fpt::Region r("say \"hi\"\\\n"); }
+    trace.str("");
+    prof.write_trace(trace);
+    REQUIRE(trace.str().find("\"name\": \"say \\\"hi\\\"\\\\\\u000a\"") != std::string::npos);
+    prof.clear();
+    REQUIRE(prof.stats().size() == 0);
+}
+
+TEMPLATE_LIST_TEST_CASE( "profiler times kernel tasks", "[profile]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::NonBlocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    auto Q = Queue(dev);
+    auto &prof = fpt::Profiler::get();
+    prof.clear();
+
+    const Idx ncells = 64;
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto K = fpt::mk1Body<fpt::ZeroCellOper,Acc,Dim,Idx>(dev, X, X);
+    {
+        fpt::Region r("init");
+        for(int i=0; i<3; i++)
+            prof.enqueue(Q, "zero", K);
+    }
+    alpaka::wait(Q);
+
+    REQUIRE(prof.stats("init/zero").count == 3);
+    REQUIRE(prof.stats("init").total >= prof.stats("init/zero").total);
+    prof.clear();
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Query.hpp>
+#include "TestAlpaka.hpp"
+
+#include <algorithm>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::QueryKernel finds atoms near probes", "[query]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const float L = 6.0f, R = 1.0f;
+    uint32_t seed = 11;
+    auto uniform = [&](const float lo, const float hi) {
+        seed = seed*1664525u + 1013904223u;
+        return lo + (hi - lo)*float(seed >> 8)/float(1u << 24);
+    };
+    const int natoms = 400;
+    std::vector<fpt::Probe> atoms(natoms);
+    for(auto &a : atoms)
+        a = fpt::Probe{uniform(0, L), uniform(0, L), uniform(0, L)};
+    // probes spill out of the box on every side
+    const Idx nprobes = 300;
+    std::vector<fpt::Probe> probes(nprobes);
+    for(auto &p : probes)
+        p = fpt::Probe{uniform(-2, L+2), uniform(-2, L+2), uniform(-2, L+2)};
+
+    for(const auto bc : {fpt::BC_PERIODIC, fpt::BC_OPEN}) {
+        auto srt = fpt::CellSorter(L, L, L, 5, 5, 5);
+        srt.set_boundary(bc, bc, bc);
+        const auto box = srt.device();
+        const fpt::BoxCells cells{box};
+        const Idx ncells = srt.cells;
+
+        // atom a gets n = a+1, in the next free slot of its cell
+        std::vector<fpt::Cell> host(ncells);
+        for(auto &c : host)
+            for(int m=0; m<ATOMS_PER_CELL; m++)
+                c.n[m] = 0;
+        for(int a=0; a<natoms; a++) {
+            fpt::Cell &c = host[box.calcBinF(atoms[a].x, atoms[a].y, atoms[a].z)];
+            int m = 0;
+            while(c.n[m] != 0) m++;
+            c.n[m] = a + 1;
+            c.x[m] = atoms[a].x;
+            c.y[m] = atoms[a].y;
+            c.z[m] = atoms[a].z;
+        }
+
+        const auto nbr_h = srt.list_cells(R);
+        auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+                alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+        alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vX(host.data(), devHost, ncells);
+        auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        alpaka::memcpy(Q, X, vX, ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Probe, Dim, Idx> vP(probes.data(), devHost, nprobes);
+        auto P = alpaka::Buf<Dev, fpt::Probe, Dim, Idx>{alpaka::allocBuf<fpt::Probe, Idx>(dev, nprobes)};
+        alpaka::memcpy(Q, P, vP, nprobes);
+
+        using List = fpt::ListQuery<8>;
+        auto count = alpaka::Buf<Dev, uint32_t, Dim, Idx>{alpaka::allocBuf<uint32_t, Idx>(dev, nprobes)};
+        auto list = alpaka::Buf<Dev, List::Output, Dim, Idx>{
+                alpaka::allocBuf<List::Output, Idx>(dev, nprobes)};
+        alpaka::enqueue(Q, fpt::mkQuery<fpt::CountQuery,Acc,Dim,Idx>(dev, srt, nbr, X, R, P, count));
+        alpaka::enqueue(Q, fpt::mkQuery<List,Acc,Dim,Idx>(dev, srt, nbr, X, R, P, list));
+
+        std::vector<uint32_t> count_h(nprobes);
+        std::vector<List::Output> list_h(nprobes);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vc(count_h.data(), devHost, nprobes);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, List::Output, Dim, Idx> vl(list_h.data(), devHost, nprobes);
+        alpaka::memcpy(Q, vc, count, nprobes);
+        alpaka::memcpy(Q, vl, list, nprobes);
+        alpaka::wait(Q);
+
+        for(Idx p=0; p<nprobes; p++) {
+            fpt::Probe q = probes[p];
+            std::vector<uint32_t> near; // brute force, over the nearest images
+            if(cells.wrap(q.x, q.y, q.z)) {
+                for(int a=0; a<natoms; a++) {
+                    const float r[3] = {q.x, q.y, q.z};
+                    const float s[3] = {atoms[a].x, atoms[a].y, atoms[a].z};
+                    float d2 = 0.0f;
+                    for(int d=0; d<3; d++) {
+                        float best = r[d] - s[d];
+                        if(bc == fpt::BC_PERIODIC)
+                            for(const int w : {-1, 1}) {
+                                const float dd = r[d] - (s[d] + w*5*box.h[d]);
+                                if(std::fabs(dd) < std::fabs(best)) best = dd;
+                            }
+                        d2 += best*best;
+                    }
+                    if(d2 < R*R) near.push_back(a + 1);
+                }
+            }
+            REQUIRE(count_h[p] == near.size());
+            REQUIRE(list_h[p].count == near.size());
+            for(uint32_t m=0; m<std::min(list_h[p].count, 8u); m++)
+                REQUIRE(std::find(near.begin(), near.end(), list_h[p].n[m]) != near.end());
+        }
+    }
+}
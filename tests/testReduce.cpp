@@ -0,0 +1,74 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Reduce.hpp>
+#include "TestAlpaka.hpp"
+
+#include <string>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::Reduction of 1-body quantities", "[reduce]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // cell c holds c % 5 atoms at z = c/10, x = m, y = -c,
+    // scattered over its slots.  Empty slots hold junk.
+    const Idx ncells = 200;
+    std::vector<fpt::Cell> host(ncells);
+    double natoms = 0.0, sx = 0.0, sy = 0.0, sz = 0.0;
+    std::vector<uint32_t> zhist(4, 0);
+    for(Idx c=0; c<ncells; c++) {
+        for(int m=0; m<ATOMS_PER_CELL; m++) {
+            host[c].n[m] = 0;
+            host[c].x[m] = 1e6f;
+        }
+        for(int m=0; m<int(c % 5); m++) {
+            const int s = (m*11 + c) % ATOMS_PER_CELL;
+            host[c].n[s] = 1;
+            host[c].x[s] = m;
+            host[c].y[s] = -float(c);
+            host[c].z[s] = c/10;
+            natoms += 1.0;
+            sx += m;
+            sy += -float(c);
+            sz += c/10;
+            zhist[std::min(3, int(c/10)/5)]++;
+        }
+    }
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(host.data(), devHost, ncells);
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    alpaka::memcpy(Q, X, view, ncells);
+
+    // one cell per block, and several
+    for(const uint32_t per : {1u, 7u}) {
+        fpt::LaunchCache::get().set(fpt::LaunchCache::key<Acc>(dev, std::string("1body")), per);
+
+        const auto c = fpt::reduce1Body<fpt::CenterOper, Acc>(dev, Q, X);
+        REQUIRE(c.n == natoms);
+        REQUIRE(c.x == Catch::Approx(sx));
+        REQUIRE(c.y == Catch::Approx(sy));
+        REQUIRE(c.z == Catch::Approx(sz));
+
+        const auto b = fpt::reduce1Body<fpt::BoundsOper, Acc>(dev, Q, X);
+        REQUIRE(b.lo[0] == 0.0f);
+        REQUIRE(b.hi[0] == 3.0f);
+        REQUIRE(b.lo[1] == -199.0f);
+        REQUIRE(b.hi[1] == -1.0f);
+        REQUIRE(b.lo[2] == 0.0f);
+        REQUIRE(b.hi[2] == 19.0f);
+
+        // bins of width 5 from 0, the last one also holding z >= 20
+        const fpt::HistOper<4> zh{2, 0.0f, 5.0f};
+        const auto h = fpt::reduce1Body<fpt::HistOper<4>, Acc>(dev, Q, X, zh);
+        for(int k=0; k<4; k++)
+            REQUIRE(h.count[k] == zhist[k]);
+    }
+    fpt::LaunchCache::get().clear();
+}
@@ -0,0 +1,188 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Sparse.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <algorithm>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::SparseGrid", "[sparse]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    auto box = fpt::CellSorter(16.0, 16.0, 16.0, 16, 16, 16);
+    const auto box_d = box.device();
+
+    // one atom in every 13th cell, tagged with its cell number
+    std::vector<fpt::Cell> host(box.cells);
+    std::vector<uint32_t> want;
+    for(unsigned int c=0; c<box.cells; c++) {
+        int i, j, k;
+        box_d.decodeBin(c, i, j, k);
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            host[c].n[m] = 0;
+        if(c%13 != 0) continue;
+        host[c].n[0] = c + 1;
+        host[c].x[0] = (i + 0.5)*box_d.h[0];
+        host[c].y[0] = (j + 0.25)*box_d.h[1];
+        host[c].z[0] = (k + 0.75)*box_d.h[2];
+        want.push_back(c);
+    }
+
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+            host.data(), devHost, Idx(box.cells));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, Idx(box.cells))};
+    alpaka::memcpy(Q, X, view, Idx(box.cells));
+
+    // Every block holding an atom must hold the atom of its own cell.
+    auto check = [&](fpt::SparseGrid<Acc> &grid) {
+        std::vector<fpt::Cell> loc(grid.capacity);
+        std::vector<uint32_t> own(grid.capacity);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vloc(
+                loc.data(), devHost, Idx(grid.capacity));
+        alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vown(
+                own.data(), devHost, Idx(grid.capacity));
+        alpaka::memcpy(Q, vloc, grid.data(), Idx(grid.capacity));
+        alpaka::memcpy(Q, vown, grid.owners(), Idx(grid.capacity));
+        alpaka::wait(Q);
+
+        std::vector<uint32_t> got;
+        for(uint32_t b=0; b<grid.capacity; b++) {
+            if(loc[b].n[0] == 0) continue;
+            REQUIRE(b != 0); // the empty block
+            REQUIRE(loc[b].n[0] == own[b] + 1);
+            REQUIRE(loc[b].x[0] == host[own[b]].x[0]);
+            REQUIRE(loc[b].y[0] == host[own[b]].y[0]);
+            REQUIRE(loc[b].z[0] == host[own[b]].z[0]);
+            got.push_back(own[b]);
+        }
+        std::sort(got.begin(), got.end());
+        // blocks without a cell are marked free
+        REQUIRE(std::count(own.begin(), own.end(), SPARSE_FREE) == grid.capacity - got.size());
+        return got;
+    };
+
+    SECTION( "sorting allocates one block per occupied cell" ) {
+        fpt::SparseGrid<Acc> A(dev, box, 512);
+        fpt::SparseGrid<Acc> B(dev, box, 512);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc>(dev, X, A));
+        REQUIRE(A.failures(Q) == 0);
+        REQUIRE(A.occupied(Q) == want.size());
+        REQUIRE(check(A) == want);
+
+        // and again between sparse grids
+        alpaka::enqueue(Q, fpt::mkSorter<Acc>(dev, A.data(), B));
+        REQUIRE(B.failures(Q) == 0);
+        REQUIRE(B.occupied(Q) == want.size());
+        REQUIRE(check(B) == want);
+
+        B.clear(Q);
+        REQUIRE(B.occupied(Q) == 0);
+    }
+
+    SECTION( "cells without a free block are counted and dropped" ) {
+        // The 16 slots of the table take the first 16 cells, of which
+        // 7 get a block.  The atoms of every later cell find the table
+        // full, and count as one failure each.
+        fpt::SparseGrid<Acc> A(dev, box, 8);
+        REQUIRE(A.slots == 16);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc>(dev, X, A));
+        REQUIRE(A.occupied(Q) == 7);
+        REQUIRE(A.failures(Q) == (16 - 7) + (want.size() - 16));
+        REQUIRE(check(A).size() == 7);
+
+        // with two atoms per cell, a full table counts both
+        std::vector<fpt::Cell> two(host);
+        for(const uint32_t c : want) {
+            two[c].n[1] = c + 1;
+            two[c].x[1] = two[c].x[0] + 0.25f;
+            two[c].y[1] = two[c].y[0];
+            two[c].z[1] = two[c].z[0];
+        }
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vtwo(
+                two.data(), devHost, Idx(box.cells));
+        alpaka::memcpy(Q, X, vtwo, Idx(box.cells));
+        A.clear(Q);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc>(dev, X, A));
+        REQUIRE(A.occupied(Q) == 7);
+        REQUIRE(A.failures(Q) == (16 - 7) + 2*(want.size() - 16));
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "sparse pair kernel matches the dense grid", "[sparse]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // a slab of atoms across the periodic wall in x of a 16^3 box
+    auto box = fpt::CellSorter(16.0, 16.0, 16.0, 16, 16, 16);
+    const Idx ncells = box.cells;
+    fpt::test::Atoms atoms(600, 4.0, 16.0, 16.0);
+    for(auto &x : atoms.x)
+        x = x < 2.0f ? x + 14.0f : x - 2.0f;
+
+    // dense CellSorter
+    const auto nbr_h = box.list_cells(1.0);
+    auto host = atoms.cells(box);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+    alpaka::memset(Q, Y, 0, ncells);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, box, X, Y));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, box, nbr, Y, en));
+
+    std::vector<fpt::Cell> dense(ncells);
+    std::vector<fpt::CellEnergy> dense_en(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vdense(dense.data(), devHost, ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vden(dense_en.data(), devHost, ncells);
+    alpaka::memcpy(Q, vdense, Y, ncells);
+    alpaka::memcpy(Q, vden, en, ncells);
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(dense, dense_en, atoms.near(box)) == 0);
+
+    std::vector<double> want(atoms.size(), 0.0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(dense[c].n[m] != 0)
+                want[dense[c].n[m]-1] = dense_en[c].en[m];
+
+    // sparse grid, sorted from the dense buffer
+    fpt::SparseGrid<Acc> S(dev, box, 1024);
+    auto out = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, Idx(S.capacity))};
+    alpaka::enqueue(Q, fpt::mkSorter<Acc>(dev, X, S));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc>(dev, S, nbr, out));
+    REQUIRE(S.failures(Q) == 0);
+
+    std::vector<fpt::Cell> sparse(S.capacity);
+    std::vector<fpt::CellEnergy> sparse_en(S.capacity);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vsparse(sparse.data(), devHost, Idx(S.capacity));
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vsen(sparse_en.data(), devHost, Idx(S.capacity));
+    alpaka::memcpy(Q, vsparse, S.data(), Idx(S.capacity));
+    alpaka::memcpy(Q, vsen, out, Idx(S.capacity));
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(sparse, sparse_en, want) == 0);
+}
@@ -0,0 +1,159 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Steal.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <vector>
+
+TEST_CASE( "tiles are dealt out by weight", "[steal]") {
+    // a dense droplet in the middle of a vapor
+    std::vector<uint32_t> weight(1000, 1);
+    for(int b=400; b<500; b++)
+        weight[b] = 100;
+    std::vector<uint32_t> first, head, tail;
+    fpt::deal_tiles(weight, 4, 32, first, head, tail);
+
+    const uint32_t ntiles = first.size() - 1;
+    REQUIRE(ntiles <= 32);
+    REQUIRE(first.front() == 0);
+    REQUIRE(first.back() == weight.size());
+    for(uint32_t t=0; t<ntiles; t++)
+        REQUIRE(first[t] < first[t+1]);
+
+    // deques are consecutive and cover every tile
+    REQUIRE(head[0] == 0);
+    REQUIRE(tail[3] == ntiles);
+    for(int w=0; w<3; w++)
+        REQUIRE(tail[w] == head[w+1]);
+
+    // each worker holds about a quarter of the weight
+    const double total = 900 + 100*100;
+    for(int w=0; w<4; w++) {
+        double sum = 0.0;
+        for(uint32_t b=first[head[w]]; b<first[tail[w]]; b++)
+            sum += weight[b];
+        REQUIRE(sum == Catch::Approx(total/4).margin(total/16));
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::CellScheduler visits every cell once", "[steal]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    const Idx ncells = 500;
+    std::vector<fpt::Cell> host(ncells);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            host[c].n[m] = m == 0 && c%3 == 0;
+
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+            host.data(), devHost, ncells);
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto out = alpaka::Buf<Dev, uint32_t, Dim, Idx>{
+            alpaka::allocBuf<uint32_t, Idx>(dev, ncells)};
+    alpaka::memcpy(Q, X, view, ncells);
+    alpaka::memset(Q, out, 0, ncells);
+
+    fpt::CellScheduler<Acc> sched(dev, 4, 4);
+    sched.update(ncells, Q);
+
+    // The deques are restored after every launch, so run it twice.
+    auto K = fpt::mk1Body<fpt::NumCellOper,Acc,Dim,Idx>(dev, X, out, sched);
+    alpaka::enqueue(Q, K);
+    alpaka::enqueue(Q, K);
+
+    std::vector<uint32_t> count(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, uint32_t, Dim, Idx> vcount(
+            count.data(), devHost, ncells);
+    alpaka::memcpy(Q, vcount, out, ncells);
+    alpaka::wait(Q);
+    for(Idx c=0; c<ncells; c++)
+        REQUIRE(count[c] == (c%3 == 0 ? 2 : 0));
+}
+
+TEMPLATE_LIST_TEST_CASE( "work-stealing pair kernel matches mk2Body", "[steal]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // a dense slab at x < 2 of a periodic box, so tiles differ in weight
+    auto srt = fpt::CellSorter(8.0, 8.0, 8.0, 8, 8, 8);
+    const Idx ncells = srt.cells;
+    const fpt::test::Atoms atoms(1500, 2.0, 8.0, 8.0);
+
+    const auto nbr_h = srt.list_cells(1.0);
+    auto host = atoms.cells(srt);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+    alpaka::memset(Q, Y, 0, ncells);
+    alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, srt, X, Y));
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, srt, nbr, Y, en));
+
+    std::vector<fpt::CellEnergy> one(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vone(one.data(), devHost, ncells);
+    alpaka::memcpy(Q, vhost, Y, ncells);
+    alpaka::memcpy(Q, vone, en, ncells);
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(host, one, atoms.near(srt)) == 0);
+
+    std::vector<double> want(atoms.size(), 0.0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(host[c].n[m] != 0)
+                want[host[c].n[m]-1] = one[c].en[m];
+
+    fpt::CellScheduler<Acc> sched(dev, 4, 4);
+    auto stolen = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    std::vector<fpt::CellEnergy> two(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vtwo(two.data(), devHost, ncells);
+
+    SECTION( "every cell" ) {
+        sched.update(ncells, Q);
+        auto K = fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, srt, nbr, Y, stolen, sched);
+        for(int rep=0; rep<2; rep++) {
+            alpaka::memset(Q, stolen, 0, ncells);
+            alpaka::enqueue(Q, K);
+            alpaka::memcpy(Q, vtwo, stolen, ncells);
+            alpaka::wait(Q);
+            REQUIRE(fpt::test::near_mismatches(host, two, want) == 0);
+        }
+    }
+
+    SECTION( "active cells, weighted by occupancy" ) {
+        fpt::ActiveCells<Acc> act(dev, ncells);
+        act.update(srt, Y, Q);
+        sched.update(act, Q);
+        REQUIRE(act.size(Q) < ncells);
+        alpaka::memset(Q, stolen, 0, ncells);
+        alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(
+                            dev, srt, nbr, Y, stolen, act, sched));
+        alpaka::memcpy(Q, vtwo, stolen, ncells);
+        alpaka::wait(Q);
+        REQUIRE(fpt::test::near_mismatches(host, two, want) == 0);
+    }
+}
@@ -0,0 +1,135 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Stream.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+TEMPLATE_LIST_TEST_CASE( "fpt::SlabStream fetches slabs with periodic halos", "[stream]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Idx = alpaka::Idx<Acc>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+
+    auto box = fpt::CellSorter(8.0, 8.0, 12.0, 8, 8, 12);
+    const auto box_d = box.device();
+    std::default_random_engine rng(7);
+    std::uniform_real_distribution<float> U(0.1, 0.9);
+
+    // one atom per cell, tagged with its cell number
+    std::vector<fpt::Cell> host(box.cells);
+    for(unsigned int c=0; c<box.cells; c++) {
+        int i, j, k;
+        box_d.decodeBin(c, i, j, k);
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            host[c].n[m] = 0;
+        host[c].n[0] = c + 1;
+        host[c].x[0] = (i + U(rng))*box_d.h[0];
+        host[c].y[0] = (j + U(rng))*box_d.h[1];
+        host[c].z[0] = (k + U(rng))*box_d.h[2];
+    }
+
+    // slabs of 5, 5 and 2 layers
+    fpt::SlabStream<Acc> st(dev, box, 1.5, 5);
+    REQUIRE(st.ghost == 2);
+    REQUIRE(st.slabs() == 3);
+    REQUIRE(st.layers(2) == 2);
+
+    const float hz = box_d.h[2];
+    const int nz = box.n[2];
+    for(int s=0; s<st.slabs(); s++) {
+        st.fetch(s, host.data());
+        st.sync();
+
+        const Idx ncells = alpaka::extent::getExtent<0>(st.cells(s));
+        std::vector<fpt::Cell> loc(ncells);
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, alpaka::DimInt<1u>, Idx> view(
+                loc.data(), devHost, ncells);
+        typename fpt::SlabStream<Acc>::Queue q(dev);
+        alpaka::memcpy(q, view, st.cells(s), ncells);
+        alpaka::wait(q);
+
+        const int lo = st.k0(s) - st.ghost;
+        for(Idx l=0; l<ncells/st.layer; l++) {
+            const int kg = lo + int(l);
+            const int kw = (kg + nz) % nz;
+            const bool filled = int(l) < st.layers(s) + 2*st.ghost;
+            for(Idx c=0; c<st.layer; c++) {
+                const auto &A = loc[l*st.layer + c];
+                const auto &B = host[kw*st.layer + c];
+                if(!filled) {
+                    REQUIRE(A.n[0] == 0);
+                    continue;
+                }
+                REQUIRE(A.n[0] == B.n[0]);
+                REQUIRE(A.x[0] == B.x[0]);
+                REQUIRE(A.z[0] + lo*hz - (kg - kw)*hz == Catch::Approx(B.z[0]).margin(1e-4));
+            }
+        }
+    }
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::SlabStream pairs match one device", "[stream]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // about two atoms per cell, plus a sheet just either
+    // side of every slab wall and of the periodic wall
+    auto box = fpt::CellSorter(8.0, 8.0, 12.0, 8, 8, 12);
+    const Idx ncells = box.cells;
+    fpt::test::Atoms atoms(1500, 8.0, 8.0, 12.0);
+    const fpt::test::Atoms sheet(64, 8.0, 8.0, 1.0, 3);
+    for(const float wall : {0.0f, 5.0f, 10.0f})
+        for(int a=0; a<sheet.size(); a++) {
+            const float dz = 0.1f*sheet.z[a] - 0.05f;
+            atoms.x.push_back(sheet.x[a]);
+            atoms.y.push_back(sheet.y[a]);
+            atoms.z.push_back(std::fmod(wall + dz + box.L[2], box.L[2]));
+        }
+    auto host = atoms.cells(box);
+
+    // single device
+    const auto nbr_h = box.list_cells(1.0);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto en = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::memcpy(Q, X, vhost, ncells);
+    alpaka::enqueue(Q, fpt::mk2Body<fpt::test::NearOper,Acc,Dim,Idx>(dev, box, nbr, X, en));
+
+    std::vector<fpt::CellEnergy> one(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> vone(one.data(), devHost, ncells);
+    alpaka::memcpy(Q, vone, en, ncells);
+    alpaka::wait(Q);
+    REQUIRE(fpt::test::near_mismatches(host, one, atoms.near(box)) == 0);
+
+    std::vector<double> want(atoms.size(), 0.0);
+    for(Idx c=0; c<ncells; c++)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            if(host[c].n[m] != 0)
+                want[host[c].n[m]-1] = one[c].en[m];
+
+    // slabs of 5, 5 and 2 layers
+    fpt::SlabStream<Acc> st(dev, box, 1.0, 5);
+    REQUIRE(st.slabs() == 3);
+    std::vector<fpt::CellEnergy> streamed(ncells);
+    st.template pairs<fpt::test::NearOper>(host.data(), streamed.data());
+    REQUIRE(fpt::test::near_mismatches(host, streamed, want) == 0);
+}
@@ -0,0 +1,234 @@
+#include <catch2/catch_all.hpp>
+
+#include <fpt/Tune.hpp>
+#include "TestAlpaka.hpp"
+#include "PairCheck.hpp"
+
+#include <string>
+#include <vector>
+
+TEST_CASE( "occupancy summary", "[tune]") {
+    fpt::Occupancy occ{std::vector<uint32_t>(ATOMS_PER_CELL+1, 0), 0};
+    occ.hist[0] = 6;
+    occ.hist[3] = 2;
+    occ.hist[ATOMS_PER_CELL-1] = 2;
+    REQUIRE(occ.cells() == 10);
+    REQUIRE(occ.atoms() == 6 + 2*(ATOMS_PER_CELL-1));
+    REQUIRE(occ.max() == ATOMS_PER_CELL-1);
+    REQUIRE(occ.fill() == Catch::Approx(double(occ.atoms())/(10*ATOMS_PER_CELL)));
+    REQUIRE(occ.safe());
+
+    occ.hist[ATOMS_PER_CELL] = 1;
+    REQUIRE(!occ.safe());
+    occ.hist[ATOMS_PER_CELL] = 0;
+    occ.dropped = 1;
+    REQUIRE(!occ.safe());
+}
+
+TEMPLATE_LIST_TEST_CASE( "fpt::CellDiagnostics histograms occupancy", "[tune]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // cell c holds c % (ATOMS_PER_CELL+1) atoms, in scattered slots
+    auto srt = fpt::CellSorter(6.0, 6.0, 6.0, 6, 6, 6);
+    const Idx ncells = srt.cells;
+    std::vector<fpt::Cell> host(ncells);
+    std::vector<uint32_t> expect(ATOMS_PER_CELL+1, 0);
+    for(Idx c=0; c<ncells; c++) {
+        const int k = c % (ATOMS_PER_CELL+1);
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            host[c].n[(m*7 + c) % ATOMS_PER_CELL] = m < k;
+        expect[k]++;
+    }
+
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(
+            host.data(), devHost, ncells);
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{
+            alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    alpaka::memcpy(Q, X, view, ncells);
+
+    fpt::CellDiagnostics<Acc> diag(dev);
+    diag.reset(Q);
+    const auto occ = diag.update(srt, X, Q);
+    REQUIRE(occ.dropped == 0);
+    for(int k=0; k<=ATOMS_PER_CELL; k++)
+        REQUIRE(occ.hist[k] == expect[k]);
+    REQUIRE(occ.max() == ATOMS_PER_CELL);
+    REQUIRE(!occ.safe());
+}
+
+TEMPLATE_LIST_TEST_CASE( "cell kernels agree over launch shapes", "[tune]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Vec = alpaka::Vec<Dim, Idx>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // Open walls, so pair distances need no periodic image.
+    auto srt = fpt::CellSorter(6.0, 6.0, 6.0, 6, 6, 6);
+    srt.set_boundary(fpt::BC_OPEN, fpt::BC_OPEN, fpt::BC_OPEN);
+    const Idx ncells = srt.cells;
+    const int natoms = 1000;
+
+    // atoms a+1 scattered over all slots of the first cells
+    std::vector<float> px(natoms), py(natoms), pz(natoms);
+    std::vector<fpt::Cell> host(ncells);
+    for(auto &c : host)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            c.n[m] = 0;
+    uint32_t seed = 7;
+    auto uniform = [&]() {
+        seed = seed*1664525u + 1013904223u;
+        return 6.0f*float(seed >> 8)/float(1u << 24);
+    };
+    for(int a=0; a<natoms; a++) {
+        px[a] = uniform();
+        py[a] = uniform();
+        pz[a] = uniform();
+        fpt::Cell &c = host[a / 7];
+        const int m = (a % 7)*4 + a/7 % 4;
+        c.n[m] = a + 1;
+        c.x[m] = px[a];
+        c.y[m] = py[a];
+        c.z[m] = pz[a];
+    }
+    std::vector<double> near(natoms, 0.0);
+    for(int a=0; a<natoms; a++)
+        for(int b=0; b<natoms; b++) {
+            const float dx = px[a]-px[b], dy = py[a]-py[b], dz = pz[a]-pz[b];
+            near[a] += a != b && dx*dx + dy*dy + dz*dz < 1.0f;
+        }
+
+    const auto nbr_h = srt.list_cells(1.0f);
+    auto nbr = alpaka::Buf<Dev, fpt::CellRange, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellRange, Idx>(dev, Idx(nbr_h.size()))};
+    alpaka::memcpy(Q, nbr, nbr_h, Idx(nbr_h.size()));
+    auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+    auto out = alpaka::Buf<Dev, fpt::CellEnergy, Dim, Idx>{
+            alpaka::allocBuf<fpt::CellEnergy, Idx>(dev, ncells)};
+    std::vector<fpt::Cell> sorted(ncells);
+    std::vector<fpt::CellEnergy> en(ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vhost(host.data(), devHost, ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> vsorted(sorted.data(), devHost, ncells);
+    alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::CellEnergy, Dim, Idx> ven(en.data(), devHost, ncells);
+    const fpt::BoxCells cells{srt.device()};
+
+    for(const Idx per : {Idx(1), Idx(3), Idx(ncells)}) {
+        const auto workDiv = fpt::cellWorkDiv<Dim,Idx>(dev, ncells, per);
+        alpaka::memcpy(Q, X, vhost, ncells);
+        alpaka::memset(Q, Y, 0, ncells);
+        alpaka::exec<Acc>(Q, workDiv, fpt::sortAtomsKernel<Vec>{cells, 0, nullptr, uint32_t(ncells)},
+                          alpaka::getPtrNative(X), alpaka::getPtrNative(Y));
+        alpaka::exec<Acc>(Q, workDiv, fpt::Oper2Kernel<fpt::test::NearOper,Vec>{0, uint32_t(ncells)}, cells,
+                          alpaka::getPtrNative(nbr), alpaka::getPtrNative(Y),
+                          alpaka::getPtrNative(out));
+        alpaka::memcpy(Q, vsorted, Y, ncells);
+        alpaka::memcpy(Q, ven, out, ncells);
+        alpaka::wait(Q);
+
+        // every atom once, in its own cell, with its count of near atoms
+        std::vector<int> seen(natoms, 0);
+        for(Idx c=0; c<ncells; c++) {
+            for(int m=0; m<ATOMS_PER_CELL; m++) {
+                const fpt::Cell &A = sorted[c];
+                REQUIRE(en[c].n[m] == A.n[m]);
+                if(A.n[m] == 0) continue;
+                const int a = A.n[m] - 1;
+                seen[a]++;
+                REQUIRE(A.x[m] == px[a]);
+                REQUIRE(srt.device().calcBinF(A.x[m], A.y[m], A.z[m]) == c);
+                REQUIRE(en[c].en[m] == near[a]);
+            }
+        }
+        for(int a=0; a<natoms; a++)
+            REQUIRE(seen[a] == 1);
+    }
+
+    // tuning fills the cache once per kind
+    fpt::LaunchCache::get().clear();
+    const auto tried = fpt::tune_launch<Acc, fpt::test::NearOper>(dev, Q, srt, nbr, Y, 1);
+    REQUIRE(tried.size() > 0);
+    for(const char *kind : {"sort", "1body", "2body"}) {
+        const std::string key = fpt::LaunchCache::key<Acc>(dev, kind);
+        REQUIRE(fpt::LaunchCache::get().find(key) > 0);
+    }
+    const auto again = fpt::tune_launch<Acc, fpt::test::NearOper>(dev, Q, srt, nbr, Y, 1);
+    REQUIRE(again.empty());
+    fpt::LaunchCache::get().clear();
+}
+
+TEMPLATE_LIST_TEST_CASE( "overfilled cells are counted and rejected by tune_cells", "[tune]", alpaka::test::TestAccs) {
+    using Acc = TestType;
+    using Dev = alpaka::Dev<Acc>;
+    using Pltf = alpaka::Pltf<Dev>;
+    using Dim = alpaka::Dim<Acc>;
+    using Idx = alpaka::Idx<Acc>;
+    using Queue = alpaka::Queue<Acc, alpaka::Blocking>;
+
+    Dev const dev = alpaka::getDevByIdx<Pltf>(0u);
+    const auto devHost = alpaka::getDevByIdx<alpaka::DevCpu>(0u);
+    auto Q = Queue(dev);
+
+    // ATOMS_PER_CELL+8 atoms in [0.1, 0.9)^3, packed in drawing order
+    auto box = fpt::CellSorter(4.0, 4.0, 4.0, 4, 4, 4);
+    const int natoms = ATOMS_PER_CELL + 8;
+    const fpt::test::Atoms atoms(natoms, 0.8, 0.8, 0.8);
+    std::vector<fpt::Cell> packed(box.cells);
+    for(auto &c : packed)
+        for(int m=0; m<ATOMS_PER_CELL; m++)
+            c.n[m] = 0;
+    for(int a=0; a<natoms; a++) {
+        fpt::Cell &c = packed[a / ATOMS_PER_CELL];
+        const int m = a % ATOMS_PER_CELL;
+        c.n[m] = a + 1;
+        c.x[m] = atoms.x[a] + 0.1f;
+        c.y[m] = atoms.y[a] + 0.1f;
+        c.z[m] = atoms.z[a] + 0.1f;
+    }
+
+    SECTION( "the sorter counts the atoms a full cell drops" ) {
+        const Idx ncells = box.cells;
+        auto X = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        auto Y = alpaka::Buf<Dev, fpt::Cell, Dim, Idx>{alpaka::allocBuf<fpt::Cell, Idx>(dev, ncells)};
+        alpaka::ViewPlainPtr<alpaka::DevCpu, fpt::Cell, Dim, Idx> view(packed.data(), devHost, ncells);
+        alpaka::memcpy(Q, X, view, ncells);
+        alpaka::memset(Q, Y, 0, ncells);
+
+        fpt::CellDiagnostics<Acc> diag(dev);
+        diag.reset(Q);
+        alpaka::enqueue(Q, fpt::mkSorter<Acc,Dim,Idx>(dev, box, X, Y, diag));
+        const auto occ = diag.update(box, Y, Q);
+        REQUIRE(occ.dropped == 8);
+        REQUIRE(occ.hist[ATOMS_PER_CELL] == 1);
+        REQUIRE(occ.atoms() == ATOMS_PER_CELL);
+        REQUIRE(!occ.safe());
+    }
+
+    SECTION( "tune_cells prefers a grid that holds every atom" ) {
+        // unit cells put every atom in one cell; 0.4 cells split them
+        const auto tried = fpt::tune_cells<Acc, fpt::test::NearOper>(
+                dev, Q, box, 1.0f, packed, 1, {1.0f, 0.4f});
+        REQUIRE(tried.size() == 2);
+        REQUIRE(tried.front().width == Catch::Approx(0.4f));
+        REQUIRE(tried.front().occ.safe());
+        REQUIRE(tried.front().occ.atoms() == natoms);
+        REQUIRE(tried.back().width == Catch::Approx(1.0f));
+        REQUIRE(tried.back().occ.dropped == 8);
+        REQUIRE(!tried.back().occ.safe());
+    }
+}